@@ -23,6 +23,7 @@
 #include "dreamcast.h"
 #include "bootstrap.h"
 #include "sh4/sh4.h"
+#include "xlat/xltcache.h"
 #include "drivers/cdrom/cdrom.h"
 #include "drivers/cdrom/isofs.h"
 #include "gdrom/gdrom.h"
@@ -131,6 +132,8 @@ void bios_gdrom_run_command( gdrom_queue_entry_t cmd )
     case GD_CMD_PIOREAD:
     case GD_CMD_DMAREAD:
         ptr = mem_get_region( cmd->params.readcd.buffer );
+        /* The sector data may be read straight into RAM by the kernel */
+        xlat_invalidate_block( cmd->params.readcd.buffer, cmd->params.readcd.count * 2048 );
         status = gdrom_read_cd( cmd->params.readcd.lba,
                 cmd->params.readcd.count, 0x28, ptr, NULL );
         break;
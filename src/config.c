@@ -51,6 +51,8 @@ static struct lxdream_config_group global_group =
         { "recent", NULL, CONFIG_TYPE_FILELIST, NULL },
         { "vmu", NULL, CONFIG_TYPE_FILELIST, NULL },
         { "quick state", NULL, CONFIG_TYPE_INTEGER, "0" },
+        { "translation cache size", NULL, CONFIG_TYPE_INTEGER, NULL }, /* MB */
+        { "translation cache max size", NULL, CONFIG_TYPE_INTEGER, NULL }, /* MB */
         { NULL, CONFIG_TYPE_NONE }} };
 
 /**
@@ -80,7 +80,9 @@ typedef struct lxdream_config_group {
 #define CONFIG_RECENT 7
 #define CONFIG_VMU 8
 #define CONFIG_QUICK_STATE 9
-#define CONFIG_KEY_MAX CONFIG_QUICK_STATE
+#define CONFIG_XLAT_CACHE_SIZE 10
+#define CONFIG_XLAT_CACHE_MAX_SIZE 11
+#define CONFIG_KEY_MAX CONFIG_XLAT_CACHE_MAX_SIZE
 
 #define CONFIG_GROUP_GLOBAL 0
 #define CONFIG_GROUP_HOTKEYS 2
@@ -25,6 +25,7 @@
 #include "dreamcast.h"
 #include "syscall.h"
 #include "sh4/sh4.h"
+#include "xlat/xltcache.h"
 
 #define SYS_READ 0
 #define SYS_WRITE 1
@@ -88,6 +89,7 @@ void dcload_syscall( uint32_t syscall_id )
         } else {
             sh4ptr_t buf = mem_get_region( sh4r.r[6] );
             int length = sh4r.r[7];
+            xlat_invalidate_block( sh4r.r[6], length );
             sh4r.r[0] = read( open_fds[fd], buf, length );
         }
         break;
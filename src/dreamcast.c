@@ -80,7 +80,8 @@ extern struct mem_region_fn mem_region_pvr2yuv;
 extern struct mem_region_fn mem_region_pvr2vdma1;
 extern struct mem_region_fn mem_region_pvr2vdma2;
 
-unsigned char dc_main_ram[16 MB];
+/* Page-aligned so that translated code in RAM can be write-protected */
+unsigned char dc_main_ram[16 MB] __attribute__((aligned(8192)));
 unsigned char dc_boot_rom[2 MB];
 unsigned char dc_flash_ram[128 KB];
 
@@ -109,7 +110,7 @@ void dreamcast_configure( gboolean use_bootrom )
     mem_map_region( aica_scratch_ram,0x00703000, 8 KB,   MEM_REGION_AUDIO_SCRATCH,&mem_region_audioscratch, MEM_FLAG_RAM, 8 KB, 0 );
     mem_map_region( NULL,            0x04000000, 8 MB,   MEM_REGION_VIDEO64,      &mem_region_vram64, 0, 8 MB, 0 );
     mem_map_region( pvr2_main_ram,   0x05000000, 8 MB,   MEM_REGION_VIDEO,        &mem_region_vram32, MEM_FLAG_RAM, 8 MB, 0 ); 
-    mem_map_region( dc_main_ram,     0x0C000000, 16 MB,  MEM_REGION_MAIN,         &mem_region_sdram, MEM_FLAG_RAM, 0x01000000, 0x0F000000 );
+    mem_map_region( dc_main_ram,     0x0C000000, 16 MB,  MEM_REGION_MAIN,         &mem_region_sdram, MEM_FLAG_RAM|MEM_FLAG_DIRECT, 0x01000000, 0x0F000000 );
     mem_map_region( NULL,            0x10000000, 8 MB,   MEM_REGION_PVR2TA,       &mem_region_pvr2ta, 0, 0x02000000, 0x12000000 );
     mem_map_region( NULL,            0x10800000, 8 MB,   MEM_REGION_PVR2YUV,      &mem_region_pvr2yuv, 0, 0x02000000, 0x12800000 );
     mem_map_region( NULL,            0x11000000, 16 MB,  MEM_REGION_PVR2VDMA1,    &mem_region_pvr2vdma1, 0, 16 MB, 0 );
@@ -31,9 +31,11 @@ extern "C" {
 
 #define DEFAULT_TIMESLICE_LENGTH 1000000 /* nanoseconds */
 
-#define XLAT_NEW_CACHE_SIZE 40 MB
+#define XLAT_NEW_CACHE_SIZE 16 MB /* Initial size */
+#define XLAT_NEW_CACHE_MAX_SIZE 128 MB
 #define XLAT_TEMP_CACHE_SIZE 2 MB
 #define XLAT_OLD_CACHE_SIZE 8 MB
+#define XLAT_ARENA_SIZE 8 MB
 
 struct lxdream_config_group; // Forward declaration
 
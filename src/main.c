@@ -44,6 +44,13 @@
 #include "vmu/vmulist.h"
 
 #define GL_INFO_OPT 1
+#define BG_TRANSLATE_OPT 2
+#define XLAT_CACHE_OPT 3
+#define SMC_PROTECT_OPT 4
+#define GENERATIONAL_CACHE_OPT 5
+#define CACHE_SIZE_OPT 6
+#define PERF_OPT 7
+#define FASTMEM_OPT 8
 
 char *option_list = "a:A:bc:e:dfg:G:hHl:m:npPt:T:uvV:xX?";
 struct option longopts[] = {
@@ -68,6 +75,13 @@ struct option longopts[] = {
         { "video", no_argument, NULL, 'V' },
         { "version", no_argument, NULL, 'v' }, 
         { "sh4-profile-blocks", no_argument, NULL, 'P' },
+        { "sh4-background-translate", no_argument, NULL, BG_TRANSLATE_OPT },
+        { "sh4-translation-cache", required_argument, NULL, XLAT_CACHE_OPT },
+        { "sh4-smc-protect", no_argument, NULL, SMC_PROTECT_OPT },
+        { "sh4-generational-cache", optional_argument, NULL, GENERATIONAL_CACHE_OPT },
+        { "sh4-cache-size", required_argument, NULL, CACHE_SIZE_OPT },
+        { "sh4-perf", required_argument, NULL, PERF_OPT },
+        { "sh4-fastmem", no_argument, NULL, FASTMEM_OPT },
         { NULL, 0, 0, 0 } };
 char *aica_program = NULL;
 char *display_driver_name = NULL;
@@ -75,6 +89,8 @@ char *audio_driver_name = NULL;
 char *trace_regions = NULL;
 char *sh4_gdb_port = NULL;
 char *arm_gdb_port = NULL;
+char *sh4_translation_cache = NULL;
+char *sh4_perf_output = NULL;
 gboolean start_immediately = FALSE;
 gboolean no_start = FALSE;
 gboolean headless = FALSE;
@@ -132,7 +148,10 @@ int main (int argc, char *argv[])
     int opt;
     double t;
     gboolean display_ok, have_disc = FALSE, have_save = FALSE, have_exec = FALSE;
-    gboolean print_glinfo = FALSE, sh4_profile_blocks = FALSE;
+    gboolean print_glinfo = FALSE, sh4_profile_blocks = FALSE, sh4_background_translate = FALSE;
+    gboolean sh4_smc_protect = FALSE, sh4_fastmem = FALSE;
+    gboolean sh4_generational_cache = FALSE;
+    unsigned int sh4_cache_sizes[4] = {0,0,0,0}; /* new, new max, temp, old (MB) */
     uint32_t time_secs, time_nanos;
     const char *exec_name = NULL;
 
@@ -226,6 +245,35 @@ int main (int argc, char *argv[])
         case GL_INFO_OPT:
             print_glinfo = TRUE;
             break;
+        case BG_TRANSLATE_OPT:
+            sh4_background_translate = TRUE;
+            break;
+        case XLAT_CACHE_OPT:
+            sh4_translation_cache = optarg;
+            break;
+        case SMC_PROTECT_OPT:
+            sh4_smc_protect = TRUE;
+            break;
+        case GENERATIONAL_CACHE_OPT: /* Optional sizes in MB, as NEW,TEMP,OLD */
+            sh4_generational_cache = TRUE;
+            if( optarg != NULL &&
+                    sscanf( optarg, "%u,%u,%u", &sh4_cache_sizes[0], &sh4_cache_sizes[2], &sh4_cache_sizes[3] ) != 3 ) {
+                ERROR( "Invalid cache sizes '%s' (expected NEW,TEMP,OLD in MB)", optarg );
+                exit(1);
+            }
+            break;
+        case CACHE_SIZE_OPT: /* Size in MB, as SIZE or SIZE,MAX */
+            if( sscanf( optarg, "%u,%u", &sh4_cache_sizes[0], &sh4_cache_sizes[1] ) < 1 ) {
+                ERROR( "Invalid cache size '%s' (expected SIZE[,MAX] in MB)", optarg );
+                exit(1);
+            }
+            break;
+        case PERF_OPT: /* map or jitdump */
+            sh4_perf_output = optarg;
+            break;
+        case FASTMEM_OPT:
+            sh4_fastmem = TRUE;
+            break;
         }
     }
 
@@ -360,6 +408,27 @@ int main (int argc, char *argv[])
 
     sh4_set_core( sh4_core );
     sh4_set_profile_blocks( sh4_profile_blocks );
+    sh4_set_background_translate( sh4_background_translate );
+    sh4_set_write_protect( sh4_smc_protect );
+    if( sh4_cache_sizes[0] == 0 && lxdream_get_global_config_value(CONFIG_XLAT_CACHE_SIZE) != NULL ) {
+        sh4_cache_sizes[0] = atoi(lxdream_get_global_config_value(CONFIG_XLAT_CACHE_SIZE));
+    }
+    if( sh4_cache_sizes[1] == 0 && lxdream_get_global_config_value(CONFIG_XLAT_CACHE_MAX_SIZE) != NULL ) {
+        sh4_cache_sizes[1] = atoi(lxdream_get_global_config_value(CONFIG_XLAT_CACHE_MAX_SIZE));
+    }
+    if( sh4_generational_cache || sh4_cache_sizes[0] != 0 || sh4_cache_sizes[1] != 0 ) {
+        sh4_configure_translation_cache( sh4_generational_cache, sh4_cache_sizes[0]<<20, 
+                sh4_cache_sizes[1]<<20, sh4_cache_sizes[2]<<20, sh4_cache_sizes[3]<<20 );
+    }
+    if( sh4_translation_cache != NULL ) {
+        sh4_set_translation_cache( sh4_translation_cache );
+    }
+    if( sh4_perf_output != NULL && !sh4_set_perf_output( sh4_perf_output ) ) {
+        ERROR( "Unable to write perf output '%s' (expected map or jitdump)", sh4_perf_output );
+    }
+    if( sh4_fastmem && !sh4_set_fastmem() ) {
+        WARN( "Fastmem is not supported on this host - using the normal memory path" );
+    }
 
     /* If requested, start the gdb server immediately before we go into the main
      * loop.
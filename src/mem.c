@@ -41,6 +41,7 @@
 
 sh4ptr_t *page_map = NULL;
 mem_region_fn_t *ext_address_space = NULL;
+sh4ptr_t *direct_page_map = NULL;
 
 extern struct mem_region_fn mem_region_unmapped; 
 
@@ -138,6 +139,19 @@ void mem_unprotect( void *region, uint32_t size )
     assert( status == 0 );
 }
 
+void mem_protect( void *region, uint32_t size )
+{
+    /* Force page alignment */
+    uintptr_t i = (uintptr_t)region;
+    uintptr_t mask = ~(PAGE_SIZE-1);
+    void *ptr = (void *)(i & mask);
+    size_t len = (i & (PAGE_SIZE-1)) + size;
+    len = (len + (PAGE_SIZE-1)) & mask;
+
+    int status = mprotect( ptr, len, PROT_READ );
+    assert( status == 0 );
+}
+
 void mem_init( void )
 {
     int i;
@@ -148,6 +162,13 @@ void mem_init( void )
         FATAL( "Unable to allocate page map! (%s)", strerror(errno) );
     }
     memset( page_map, 0, sizeof(sh4ptr_t) * LXDREAM_PAGE_TABLE_ENTRIES );
+
+    direct_page_map = (sh4ptr_t *)mmap( NULL, sizeof(sh4ptr_t) * LXDREAM_PAGE_TABLE_ENTRIES,
+            PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0 );
+    if( direct_page_map == MAP_FAILED ) {
+        FATAL( "Unable to allocate direct page map! (%s)", strerror(errno) );
+    }
+    memset( direct_page_map, 0, sizeof(sh4ptr_t) * LXDREAM_PAGE_TABLE_ENTRIES );
     
     ext_address_space = (mem_region_fn_t *) mmap( NULL, sizeof(mem_region_fn_t) * LXDREAM_PAGE_TABLE_ENTRIES,
             PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0 );
@@ -359,6 +380,11 @@ struct mem_region *mem_map_region( void *mem, uint32_t base, uint32_t size,
             if( mem != NULL ) {
                 page_map[(base>>LXDREAM_PAGE_BITS)+i] = ((unsigned char *)mem) + (i<<LXDREAM_PAGE_BITS);
             }
+            if( mem != NULL && (flags & MEM_FLAG_DIRECT) ) {
+                direct_page_map[(base>>LXDREAM_PAGE_BITS)+i] = ((unsigned char *)mem) + (i<<LXDREAM_PAGE_BITS);
+            } else {
+                direct_page_map[(base>>LXDREAM_PAGE_BITS)+i] = NULL;
+            }
             ext_address_space[(base>>LXDREAM_PAGE_BITS)+i] = fn;
             mem_page_remapped( base + (i<<LXDREAM_PAGE_BITS), fn );
         }
@@ -440,6 +466,7 @@ void register_io_region( struct mmio_region *io )
         P4_io[(io->base&0x1FFFFFFF)>>19] = io;
     } else {
         page_map[io->base>>12] = (sh4ptr_t)(uintptr_t)num_io_rgns;
+        direct_page_map[io->base>>12] = NULL;
         ext_address_space[io->base>>12] = &io->fn;
         mem_page_remapped( io->base, &io->fn );
     }
@@ -140,6 +140,7 @@ struct breakpoint_struct {
 
 #define MEM_FLAG_ROM 4 /* Mem region is ROM-based */
 #define MEM_FLAG_RAM 6 
+#define MEM_FLAG_DIRECT 8 /* Loads/stores may bypass the region functions */
 
 #define WATCH_WRITE 1
 #define WATCH_READ  2
@@ -153,6 +154,28 @@ watch_point_t mem_is_watched( uint32_t addr, int size, int op );
 
 extern mem_region_fn_t *ext_address_space;
 
+/**
+ * Host pointers to the pages of the external address space that were mapped
+ * with MEM_FLAG_DIRECT, ie plain memory where a load or store has no side
+ * effects beyond the memory itself. NULL for all other pages (MMIO, VRAM, etc).
+ * Note that stores to main RAM must still invalidate any translated code when
+ * xlat_protect_active is FALSE, as the region functions would.
+ */
+extern sh4ptr_t *direct_page_map;
+
+/**
+ * @return a host pointer to the size bytes of external memory at addr, if
+ * they lie entirely within one direct page, otherwise NULL.
+ */
+static inline sh4ptr_t mem_get_direct_ptr( sh4addr_t addr, uint32_t size )
+{
+    sh4ptr_t page = direct_page_map[(addr&0x1FFFFFFF)>>12];
+    if( page == NULL || (addr&0xFFF) + size > 0x1000 ) {
+        return NULL;
+    }
+    return page + (addr&0xFFF);
+}
+
 #define SIGNEXT4(n) ((((int32_t)(n))<<28)>>28)
 #define SIGNEXT8(n) ((int32_t)((int8_t)(n)))
 #define SIGNEXT12(n) ((((int32_t)(n))<<20)>>20)
@@ -166,6 +189,11 @@ extern mem_region_fn_t *ext_address_space;
  */
 void mem_unprotect( void *ptr, uint32_t size );
 
+/* Make the given region read-only, such that any write to it will fault. As 
+ * with mem_unprotect, this applies to all of the pages overlapping the region.
+ */
+void mem_protect( void *ptr, uint32_t size );
+
 #ifdef __cplusplus
 }
 #endif
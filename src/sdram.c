@@ -39,17 +39,20 @@ static int32_t FASTCALL ext_sdram_read_byte( sh4addr_t addr )
 static void FASTCALL ext_sdram_write_long( sh4addr_t addr, uint32_t val )
 {
     *(uint32_t *)(dc_main_ram + (addr&0x00FFFFFF)) = val;
-    xlat_invalidate_long(addr);
+    if( !xlat_protect_active )
+        xlat_invalidate_long(addr);
 }
 static void FASTCALL ext_sdram_write_word( sh4addr_t addr, uint32_t val )
 {
     *(uint16_t *)(dc_main_ram + (addr&0x00FFFFFF)) = (uint16_t)val;
-    xlat_invalidate_word(addr);
+    if( !xlat_protect_active )
+        xlat_invalidate_word(addr);
 }
 static void FASTCALL ext_sdram_write_byte( sh4addr_t addr, uint32_t val )
 {
     *(uint8_t *)(dc_main_ram + (addr&0x00FFFFFF)) = (uint8_t)val;
-    xlat_invalidate_word(addr);
+    if( !xlat_protect_active )
+        xlat_invalidate_word(addr);
 }
 static void FASTCALL ext_sdram_read_burst( unsigned char *dest, sh4addr_t addr )
 {
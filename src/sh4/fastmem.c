@@ -0,0 +1,277 @@
+/**
+ * $Id$
+ *
+ * Host virtual memory windows onto the SH4 address space ("fastmem"). Main
+ * RAM is moved into a shared memory object, which can then be mapped into a
+ * 4GB window once for every SH4 address that reaches it - the P0-P3 mirrors
+ * when the TLB is off, and the pages mapped by the UTLB when it's on.
+ * Translated code can then access RAM at window+address with a single host
+ * instruction, falling back to the address space functions for anything that
+ * faults.
+ *
+ * Only main RAM is mapped - VRAM and audio RAM writes have side effects (render
+ * buffer invalidation and the G2 FIFO respectively) which the functions take
+ * care of, and are much less frequently accessed by the CPU in any case.
+ *
+ * Copyright (c) 2026 agent.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* For REG_RIP */
+#endif
+#define MODULE sh4_module
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "lxdream.h"
+#include "dream.h"
+#include "dreamcast.h"
+#include "sh4/sh4core.h"
+#include "sh4/sh4trans.h"
+#include "sh4/mmu.h"
+#include "sh4/fastmem.h"
+#include "xlat/xltcache.h"
+
+#define FASTMEM_PAGE_BITS 12
+#define FASTMEM_PAGE_SIZE (1<<FASTMEM_PAGE_BITS)
+#define FASTMEM_WINDOW_SIZE (((uint64_t)1)<<32)
+#define FASTMEM_WINDOW_PAGES (FASTMEM_WINDOW_SIZE >> FASTMEM_PAGE_BITS)
+#define FASTMEM_RAM_SIZE (16*1024*1024)
+
+/* Host pc of the faulting instruction, given the signal context */
+#if SIZEOF_VOID_P == 8 && defined(__linux__) && defined(REG_RIP)
+#define FASTMEM_CONTEXT_PC(ctx) ((void *)((ucontext_t *)(ctx))->uc_mcontext.gregs[REG_RIP])
+#elif SIZEOF_VOID_P == 8 && defined(__APPLE__)
+#define FASTMEM_CONTEXT_PC(ctx) ((void *)((ucontext_t *)(ctx))->uc_mcontext->__ss.__rip)
+#endif
+
+unsigned char *sh4_fastmem_priv_base = NULL;
+unsigned char *sh4_fastmem_user_base = NULL;
+static int sh4_fastmem_fd = -1;
+
+/**
+ * @return the offset into main RAM of the given page of the priv or user
+ * address space, or -1 if it doesn't map straight through to RAM, and
+ * set *prot to the protection the window should have for the page.
+ */
+static int32_t sh4_fastmem_page_offset( gboolean user, sh4vma_t vma, int *prot )
+{
+    sh4addr_t phys;
+    gboolean writable;
+    uintptr_t host;
+
+    *prot = PROT_NONE;
+    if( !mmu_get_page_phys( user, vma, &phys, &writable ) ) {
+        return -1;
+    }
+    host = (uintptr_t)mem_get_region( phys );
+    if( host - (uintptr_t)dc_main_ram >= FASTMEM_RAM_SIZE ) {
+        return -1;
+    }
+    *prot = PROT_READ;
+    if( writable && xlat_protect_active && !xlat_is_protected_page( phys ) ) {
+        *prot |= PROT_WRITE;
+    }
+    return (int32_t)(host - (uintptr_t)dc_main_ram);
+}
+
+static void sh4_fastmem_map( unsigned char *base, uint64_t vma, uint32_t npages, int32_t offset, int prot )
+{
+    void *result;
+    if( offset == -1 ) {
+        result = mmap( base + vma, ((size_t)npages) << FASTMEM_PAGE_BITS, PROT_NONE,
+                MAP_PRIVATE|MAP_ANON|MAP_NORESERVE|MAP_FIXED, -1, 0 );
+    } else {
+        result = mmap( base + vma, ((size_t)npages) << FASTMEM_PAGE_BITS, prot,
+                MAP_SHARED|MAP_FIXED, sh4_fastmem_fd, offset );
+    }
+    if( result == MAP_FAILED ) {
+        /* Can't leave the old mapping there, so this is fatal */
+        FATAL( "Unable to map fastmem window at %08X: %s", (uint32_t)vma, strerror(errno) );
+        abort();
+    }
+}
+
+/**
+ * Map one window according to its address space, in runs of pages that can
+ * be mapped with a single mmap.
+ */
+static void sh4_fastmem_sync_window( unsigned char *base, gboolean user, uint64_t vma, uint32_t npages )
+{
+    uint32_t i = 0;
+    while( i < npages ) {
+        int prot, next_prot;
+        int32_t offset = sh4_fastmem_page_offset( user, vma + (i<<FASTMEM_PAGE_BITS), &prot );
+        uint32_t start = i;
+        for( i++; i < npages; i++ ) {
+            int32_t next = sh4_fastmem_page_offset( user, vma + (i<<FASTMEM_PAGE_BITS), &next_prot );
+            if( next_prot != prot ||
+                    (offset == -1 ? next != -1 : next != offset + (int32_t)((i-start)<<FASTMEM_PAGE_BITS)) ) {
+                break;
+            }
+        }
+        sh4_fastmem_map( base, vma + (start<<FASTMEM_PAGE_BITS), i - start, offset, prot );
+    }
+}
+
+void sh4_fastmem_sync( sh4vma_t vma, uint32_t npages )
+{
+    uint64_t start = vma & 0xFFFFF000;
+    if( sh4_fastmem_priv_base == NULL ) {
+        return;
+    }
+    if( (start >> FASTMEM_PAGE_BITS) + npages > FASTMEM_WINDOW_PAGES ) {
+        npages = FASTMEM_WINDOW_PAGES - (start >> FASTMEM_PAGE_BITS);
+    }
+    sh4_fastmem_sync_window( sh4_fastmem_priv_base, FALSE, start, npages );
+    sh4_fastmem_sync_window( sh4_fastmem_user_base, TRUE, start, npages );
+}
+
+void sh4_fastmem_sync_all( void )
+{
+    sh4_fastmem_sync( 0, FASTMEM_WINDOW_PAGES );
+}
+
+/**
+ * Protection of RAM holding translated code has changed - update all the
+ * addresses that reach it (in each of the 4 RAM mirrors)
+ */
+static void sh4_fastmem_protect_changed( uint32_t offset, uint32_t size, void *user_data )
+{
+    int i;
+    for( i=0; i<4; i++ ) {
+        mmu_sync_fastmem_phys( 0x0C000000 + (i<<24) + offset, size );
+    }
+}
+
+/**
+ * Fault handler for accesses to the windows. Either it's a write to a page
+ * holding translated code, which is flushed as for any other write-protect
+ * fault, or the translator patches the faulting access to take the slow path.
+ */
+static gboolean sh4_fastmem_fault( void *addr, void *context )
+{
+#ifdef FASTMEM_CONTEXT_PC
+    uintptr_t host = (uintptr_t)addr;
+    sh4addr_t phys;
+    sh4vma_t vma;
+    gboolean user, writable;
+
+    if( host - (uintptr_t)sh4_fastmem_priv_base < FASTMEM_WINDOW_SIZE ) {
+        user = FALSE;
+        vma = host - (uintptr_t)sh4_fastmem_priv_base;
+    } else if( host - (uintptr_t)sh4_fastmem_user_base < FASTMEM_WINDOW_SIZE ) {
+        user = TRUE;
+        vma = host - (uintptr_t)sh4_fastmem_user_base;
+    } else {
+        return FALSE;
+    }
+
+    if( xlat_protect_active && mmu_get_page_phys( user, vma, &phys, &writable ) &&
+            writable && xlat_is_protected_page( phys ) ) {
+        xlat_invalidate_block( phys, 1 );
+        return TRUE;
+    }
+    return sh4_translate_fastmem_patch( FASTMEM_CONTEXT_PC(context) );
+#else
+    return FALSE;
+#endif
+}
+
+static int sh4_fastmem_create_fd( void )
+{
+    int fd = -1;
+#if defined(__linux__) && defined(SYS_memfd_create)
+    fd = syscall( SYS_memfd_create, "lxdream-ram", 0 );
+#endif
+    if( fd == -1 ) {
+        char filename[] = "/tmp/lxdream-ram.XXXXXX";
+        fd = mkstemp( filename );
+        if( fd != -1 ) {
+            unlink( filename );
+        }
+    }
+    if( fd != -1 && ftruncate( fd, FASTMEM_RAM_SIZE ) != 0 ) {
+        close( fd );
+        fd = -1;
+    }
+    return fd;
+}
+
+gboolean sh4_fastmem_init( void )
+{
+#ifdef FASTMEM_CONTEXT_PC
+    void *priv, *user;
+
+    if( sh4_fastmem_priv_base != NULL ) {
+        return TRUE;
+    }
+    if( sysconf(_SC_PAGESIZE) != FASTMEM_PAGE_SIZE ) {
+        WARN( "Fastmem requires %d byte host pages", FASTMEM_PAGE_SIZE );
+        return FALSE;
+    }
+
+    sh4_fastmem_fd = sh4_fastmem_create_fd();
+    if( sh4_fastmem_fd == -1 ) {
+        WARN( "Unable to create shared memory for fastmem: %s", strerror(errno) );
+        return FALSE;
+    }
+    if( pwrite( sh4_fastmem_fd, dc_main_ram, FASTMEM_RAM_SIZE, 0 ) != FASTMEM_RAM_SIZE ) {
+        WARN( "Unable to initialize shared memory for fastmem: %s", strerror(errno) );
+        close( sh4_fastmem_fd );
+        sh4_fastmem_fd = -1;
+        return FALSE;
+    }
+
+    priv = mmap( NULL, FASTMEM_WINDOW_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANON|MAP_NORESERVE, -1, 0 );
+    user = mmap( NULL, FASTMEM_WINDOW_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANON|MAP_NORESERVE, -1, 0 );
+    if( priv == MAP_FAILED || user == MAP_FAILED ) {
+        WARN( "Unable to reserve address space for fastmem: %s", strerror(errno) );
+        if( priv != MAP_FAILED ) {
+            munmap( priv, FASTMEM_WINDOW_SIZE );
+        }
+        if( user != MAP_FAILED ) {
+            munmap( user, FASTMEM_WINDOW_SIZE );
+        }
+        close( sh4_fastmem_fd );
+        sh4_fastmem_fd = -1;
+        return FALSE;
+    }
+
+    /* Replace main RAM itself with the shared mapping (same contents) */
+    if( mmap( dc_main_ram, FASTMEM_RAM_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+            sh4_fastmem_fd, 0 ) == MAP_FAILED ) {
+        FATAL( "Unable to remap main RAM for fastmem: %s", strerror(errno) );
+        abort();
+    }
+
+    sh4_fastmem_priv_base = priv;
+    sh4_fastmem_user_base = user;
+    register_xlat_protect_hook( sh4_fastmem_protect_changed, NULL );
+    xlat_set_fault_handler( sh4_fastmem_fault );
+    sh4_fastmem_sync_all();
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
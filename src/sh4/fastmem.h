@@ -0,0 +1,71 @@
+/**
+ * $Id$
+ *
+ * Host virtual memory windows onto the SH4 address space ("fastmem"), which
+ * let translated code access main RAM with a single host load or store.
+ *
+ * Copyright (c) 2026 agent.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_fastmem_H
+#define lxdream_fastmem_H 1
+
+#include "dream.h"
+#include "mem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Base of the 4GB host windows mirroring the privileged and user SH4 address
+ * spaces, or NULL if fastmem isn't enabled. A page of the window is mapped
+ * onto main RAM when the corresponding page of sh4_address_space (resp.
+ * sh4_user_address_space) maps straight through to main RAM, and is otherwise
+ * inaccessible. RAM pages are only writable while SMC write-protection is
+ * active, and then only if they don't hold translated code, so that the SMC
+ * check isn't bypassed.
+ *
+ * An access through the window which faults is either a write to a page
+ * holding code (which is flushed, and the write retried), or a site that needs
+ * the full memory path, which the translator patches to always take the slow
+ * path from then on.
+ */
+extern unsigned char *sh4_fastmem_priv_base;
+extern unsigned char *sh4_fastmem_user_base;
+
+/**
+ * Move main RAM into shared memory and create the windows. Only supported on
+ * x86-64 hosts with 4K pages. Must be called after the MMU has been
+ * initialized.
+ * @return TRUE if fastmem is now enabled.
+ */
+gboolean sh4_fastmem_init( void );
+
+/**
+ * Bring the windows back into line with the SH4 address space for the npages
+ * 4K pages starting at vma. Called by the MMU whenever it changes the page
+ * maps, and when RAM protection changes. No-op if fastmem isn't enabled.
+ */
+void sh4_fastmem_sync( sh4vma_t vma, uint32_t npages );
+
+/**
+ * Resynchronize the entire windows.
+ */
+void sh4_fastmem_sync_all( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_fastmem_H */
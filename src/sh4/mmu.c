@@ -19,16 +19,20 @@
 #define MODULE sh4_module
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include "sh4/sh4mmio.h"
 #include "sh4/sh4core.h"
 #include "sh4/sh4trans.h"
+#include "sh4/fastmem.h"
 #include "dreamcast.h"
 #include "mem.h"
 #include "mmu.h"
 
 /* An entry is a 1K entry if it's one of the mmu_utlb_1k_pages entries */
 #define IS_1K_PAGE_ENTRY(ent)  ( ((uintptr_t)(((struct utlb_1k_entry *)ent) - &mmu_utlb_1k_pages[0])) < UTLB_ENTRY_COUNT )
+/* Likewise for the (4K and larger) mmu_utlb_pages entries */
+#define IS_UTLB_PAGE_ENTRY(ent)  ( ((uintptr_t)(((struct utlb_page_entry *)ent) - &mmu_utlb_pages[0])) < UTLB_ENTRY_COUNT )
 
 /* Primary address space (used directly by SH4 cores) */
 mem_region_fn_t *sh4_address_space;
@@ -55,10 +59,55 @@ static struct utlb_1k_entry mmu_utlb_1k_pages[UTLB_ENTRY_COUNT];
 static int mmu_utlb_1k_free_list[UTLB_ENTRY_COUNT];
 static int mmu_utlb_1k_free_index;
 
+/* Lookup index over the valid UTLB entries, so that a lookup only has to
+ * check the entries that could possibly match rather than all 64. Each page
+ * size has its own hash table, keyed on the VPN at that size, holding a
+ * bitmask of the entries in each bucket. A lookup ORs together the 4 buckets
+ * the address falls into, and masks that by the entries for the ASID (plus
+ * the shared entries) - every entry that matches is in the result, so
+ * multi-hits are still detected exactly.
+ */
+#define UTLB_HASH_BITS 6
+#define UTLB_HASH_SIZE (1<<UTLB_HASH_BITS)
+#define UTLB_HASH(vpn,shift) ( (((vpn)>>(shift)) ^ ((vpn)>>((shift)+UTLB_HASH_BITS))) & (UTLB_HASH_SIZE-1) )
+#define UTLB_SIZE_INDEX(flags) ( (((flags)>>4)&0x01) | (((flags)>>6)&0x02) ) /* 1K, 4K, 64K, 1M => 0..3 */
+static const int mmu_utlb_hash_shift[4] = { 10, 12, 16, 20 };
+static uint64_t mmu_utlb_hash[4][UTLB_HASH_SIZE];
+static uint64_t mmu_utlb_asid_entries[256];
+static uint64_t mmu_utlb_shared_entries;
+static int mmu_utlb_hash_slot[UTLB_ENTRY_COUNT]; /* size*UTLB_HASH_SIZE + bucket, or -1 if not indexed */
+static uint32_t mmu_utlb_hash_asid[UTLB_ENTRY_COUNT]; /* asid the entry was indexed under */
+
+/* Address space context tags. The translator caches vma => code lookups (in
+ * the target cache and the shadow return stack) tagged with sh4r.xlat_context,
+ * which identifies the instruction mappings of the current ASID. Each ASID
+ * keeps its tag until something changes that could affect its mappings, so
+ * switching between processes doesn't lose anything, and a TLB update only
+ * costs the cached lookups of the ASID it touches. Changes to shared entries
+ * (or any change in SV mode, where privileged code sees every ASID's entries)
+ * bump the epoch instead, which retags every ASID.
+ *
+ * Instruction fetches go through the ITLB, so a cached lookup depends on a
+ * UTLB entry only once it's been copied into the ITLB (mmu_utlb_fetch_entries),
+ * and an ITLB entry that no longer matches its UTLB source (or has none)
+ * invalidates the lookups made through it when it's replaced.
+ */
+static uint32_t mmu_context_tags[256];
+static uint32_t mmu_context_epochs[256];
+static uint32_t mmu_context_epoch;
+static uint32_t mmu_context_next_tag = XLAT_CONTEXT_NONE+1;
+static uint64_t mmu_utlb_fetch_entries;
+static int mmu_itlb_source[ITLB_ENTRY_COUNT]; /* UTLB entry each ITLB entry was copied from, or -1 */
+
 
 /* Function prototypes */
 static void mmu_invalidate_tlb();
 static void mmu_utlb_register_all();
+static void mmu_utlb_index_entry(int);
+static void mmu_utlb_index_all();
+static void mmu_context_changed( uint32_t asid, gboolean shared );
+static void mmu_context_flush_all();
+static uint32_t mmu_context_tag( uint32_t asid );
 static void mmu_utlb_remove_entry(int);
 static void mmu_utlb_insert_entry(int);
 static void mmu_register_mem_region( uint32_t start, uint32_t end, mem_region_fn_t fn );
@@ -106,6 +155,15 @@ void mmu_utlb_init_storequeue_vtable( struct utlb_entry *ent, struct utlb_page_e
 void mmu_utlb_1k_init_vtable( struct utlb_1k_entry *entry )
 {
 }
+void sh4_fastmem_sync( sh4vma_t vma, uint32_t npages )
+{
+}
+void sh4_fastmem_sync_all( void )
+{
+}
+void sh4_translate_flush_return_stack( void )
+{
+}
 #endif
 
 /*********************** Module public functions ****************************/
@@ -121,6 +179,7 @@ void MMU_init()
     sh4_address_space = mem_alloc_pages( sizeof(mem_region_fn_t) * 256 );
     sh4_user_address_space = mem_alloc_pages( sizeof(mem_region_fn_t) * 256 );
     mmu_user_storequeue_regions = &mmu_default_regions[DEFAULT_STOREQUEUE_REGIONS];
+    mmu_utlb_index_all();
     
     mmu_set_tlb_enabled(0);
     mmu_register_user_mem_region( 0x80000000, 0x00000000, &mem_region_address_error );
@@ -204,6 +263,7 @@ int MMU_load_state( FILE *f )
 
     uint32_t mmucr = MMIO_READ(MMU,MMUCR);
     mmu_urc_overflow = mmu_urc >= mmu_urb;
+    mmu_utlb_index_all();
     mmu_set_tlb_enabled(mmucr&MMUCR_AT);
     mmu_set_storequeue_protected(mmucr&MMUCR_SQMD, mmucr&MMUCR_AT);
     return 0;
@@ -224,6 +284,7 @@ void MMU_ldtlb()
     mmu_utlb[urc].flags = MMIO_READ(MMU, PTEL) & 0x00001FF;
     mmu_utlb[urc].pcmcia = MMIO_READ(MMU, PTEA);
     mmu_utlb[urc].mask = get_tlb_size_mask(mmu_utlb[urc].flags);
+    mmu_utlb_index_entry( urc );
     if( IS_TLB_ENABLED() && mmu_utlb[urc].flags & TLB_VALID )
         mmu_utlb_insert_entry( urc );
 }
@@ -282,6 +343,10 @@ MMIO_REGION_WRITE_FN( MMU, reg, val )
         mmu_lrui = (val >> 26) & 0x3F;
         val &= 0x00000301;
         tmp = MMIO_READ( MMU, MMUCR );
+        if( (val ^ tmp) & (MMUCR_SV) ) {
+            /* Privileged lookups now see a different set of entries */
+            mmu_context_changed( 0, TRUE );
+        }
         if( (val ^ tmp) & (MMUCR_SQMD) ) {
             mmu_set_storequeue_protected( val & MMUCR_SQMD, val&MMUCR_AT );
         }
@@ -419,6 +484,7 @@ static gboolean mmu_ext_page_remapped( sh4addr_t page, mem_region_fn_t fn, void
             sh4_user_address_space[(page|i)>>12] = fn;
         }
     }
+    mmu_sync_fastmem_phys( page, LXDREAM_PAGE_SIZE );
     return TRUE;
 }
 
@@ -453,7 +519,10 @@ static void mmu_set_tlb_enabled( int tlb_on )
             mmu_register_user_mem_region( 0xE0000000, 0xE4000000, &p4_region_storequeue );
         }
     }
-    
+    /* Cached lookups from the other mode are meaningless now */
+    mmu_context_flush_all();
+    sh4r.xlat_context = mmu_context_tag(mmu_asid);
+    sh4_fastmem_sync_all();
 }
 
 /**
@@ -489,49 +558,32 @@ static void mmu_set_storequeue_protected( int protected, int tlb_on )
 static void mmu_set_tlb_asid( uint32_t asid )
 {
     if( IS_TLB_ENABLED() ) {
-        /* Scan for pages that need to be remapped */
+        /* Only the (non-shared) entries of the old and new ASIDs need to be
+         * remapped - the index has them directly */
+        uint64_t old_entries = mmu_utlb_asid_entries[mmu_asid] & ~mmu_utlb_shared_entries;
+        uint64_t new_entries = mmu_utlb_asid_entries[asid] & ~mmu_utlb_shared_entries;
+        gboolean remap_priv = IS_SV_ENABLED() ? FALSE : TRUE;
         int i;
-        if( IS_SV_ENABLED() ) {
-            for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
-                if( mmu_utlb[i].asid == mmu_asid &&
-                        (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
-                    // Matches old ASID - unmap out
-                    if( !mmu_utlb_unmap_pages( FALSE, TRUE, mmu_utlb[i].vpn&mmu_utlb[i].mask,
-                            get_tlb_size_pages(mmu_utlb[i].flags) ) )
-                        mmu_utlb_remap_pages( FALSE, TRUE, i );
-                }
-            }
-            for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
-                if( mmu_utlb[i].asid == asid &&
-                        (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
-                    // Matches new ASID - map in
-                    mmu_utlb_map_pages( NULL, mmu_utlb_pages[i].user_fn,
-                            mmu_utlb[i].vpn&mmu_utlb[i].mask,
-                            get_tlb_size_pages(mmu_utlb[i].flags) );
-                }
-            }
-        } else {
-            // Remap both Priv+user pages
-            for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
-                if( mmu_utlb[i].asid == mmu_asid &&
-                        (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
-                    if( !mmu_utlb_unmap_pages( TRUE, TRUE, mmu_utlb[i].vpn&mmu_utlb[i].mask,
-                            get_tlb_size_pages(mmu_utlb[i].flags) ) )
-                        mmu_utlb_remap_pages( TRUE, TRUE, i );
-                }
-            }
-            for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
-                if( mmu_utlb[i].asid == asid &&
-                        (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
-                    mmu_utlb_map_pages( &mmu_utlb_pages[i].fn, mmu_utlb_pages[i].user_fn,
-                            mmu_utlb[i].vpn&mmu_utlb[i].mask,
-                            get_tlb_size_pages(mmu_utlb[i].flags) );
-                }
-            }
+        while( old_entries != 0 ) {
+            i = __builtin_ctzll(old_entries);
+            old_entries &= old_entries - 1;
+            // Matches old ASID - unmap out
+            if( !mmu_utlb_unmap_pages( remap_priv, TRUE, mmu_utlb[i].vpn&mmu_utlb[i].mask,
+                    get_tlb_size_pages(mmu_utlb[i].flags) ) )
+                mmu_utlb_remap_pages( remap_priv, TRUE, i );
+        }
+        while( new_entries != 0 ) {
+            i = __builtin_ctzll(new_entries);
+            new_entries &= new_entries - 1;
+            // Matches new ASID - map in
+            mmu_utlb_map_pages( remap_priv ? &mmu_utlb_pages[i].fn : NULL, mmu_utlb_pages[i].user_fn,
+                    mmu_utlb[i].vpn&mmu_utlb[i].mask,
+                    get_tlb_size_pages(mmu_utlb[i].flags) );
         }
         sh4_icache.page_vma = -1; // invalidate icache as asid has changed
     }
     mmu_asid = asid;
+    sh4r.xlat_context = mmu_context_tag(asid);
 }
 
 static uint32_t get_tlb_size_mask( uint32_t flags )
@@ -638,6 +690,7 @@ static gboolean mmu_utlb_map_pages( mem_region_fn_t priv_page, mem_region_fn_t u
         }
     }
 
+    sh4_fastmem_sync( start_addr, npages == 0 ? 1 : npages );
     return mapping_ok;
 }
 
@@ -754,6 +807,7 @@ static gboolean mmu_utlb_unmap_pages( gboolean unmap_priv, gboolean unmap_user,
         }
     }
     
+    sh4_fastmem_sync( start_addr, npages == 0 ? 1 : npages );
     return unmapping_ok;
 }
 
@@ -864,6 +918,110 @@ static void mmu_invalidate_tlb()
     for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
         mmu_utlb[i].flags &= (~TLB_VALID);
     }
+    mmu_utlb_index_all();
+}
+
+/**
+ * Bring the lookup index into line with the current contents of the given
+ * UTLB entry. Must be called whenever the vpn, asid, size or valid bit of
+ * an entry changes, whether or not the TLB is enabled.
+ */
+static void mmu_utlb_index_entry( int entry )
+{
+    struct utlb_entry *ent = &mmu_utlb[entry];
+    uint64_t bit = ((uint64_t)1) << entry;
+    int slot = mmu_utlb_hash_slot[entry];
+
+    if( slot != -1 ) {
+        if( mmu_utlb_fetch_entries & bit ) {
+            int i;
+            for( i=0; i<ITLB_ENTRY_COUNT; i++ ) {
+                if( mmu_itlb_source[i] == entry ) {
+                    mmu_itlb_source[i] = -1;
+                }
+            }
+            mmu_utlb_fetch_entries &= ~bit;
+            mmu_context_changed( mmu_utlb_hash_asid[entry], (mmu_utlb_shared_entries & bit) != 0 );
+        }
+        mmu_utlb_hash[slot/UTLB_HASH_SIZE][slot%UTLB_HASH_SIZE] &= ~bit;
+        mmu_utlb_asid_entries[mmu_utlb_hash_asid[entry]] &= ~bit;
+        mmu_utlb_shared_entries &= ~bit;
+        mmu_utlb_hash_slot[entry] = -1;
+    }
+
+    if( ent->flags & TLB_VALID ) {
+        int size = UTLB_SIZE_INDEX(ent->flags);
+        int bucket = UTLB_HASH(ent->vpn, mmu_utlb_hash_shift[size]);
+        mmu_utlb_hash[size][bucket] |= bit;
+        if( ent->flags & TLB_SHARE ) {
+            mmu_utlb_shared_entries |= bit;
+        }
+        mmu_utlb_asid_entries[ent->asid] |= bit;
+        mmu_utlb_hash_asid[entry] = ent->asid;
+        mmu_utlb_hash_slot[entry] = size*UTLB_HASH_SIZE + bucket;
+    }
+}
+
+/**
+ * Rebuild the lookup index from scratch
+ */
+static void mmu_utlb_index_all()
+{
+    int i;
+    memset( mmu_utlb_hash, 0, sizeof(mmu_utlb_hash) );
+    memset( mmu_utlb_asid_entries, 0, sizeof(mmu_utlb_asid_entries) );
+    mmu_utlb_shared_entries = 0;
+    mmu_utlb_fetch_entries = 0;
+    for( i=0; i<ITLB_ENTRY_COUNT; i++ ) {
+        mmu_itlb_source[i] = -1;
+    }
+    for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
+        mmu_utlb_hash_slot[i] = -1;
+        mmu_utlb_index_entry( i );
+    }
+    mmu_context_changed( 0, TRUE );
+}
+
+/**
+ * @return the context tag for the given ASID, allocating a new one if it
+ * doesn't have a current tag.
+ */
+static uint32_t mmu_context_tag( uint32_t asid )
+{
+    if( mmu_context_tags[asid] == XLAT_CONTEXT_NONE || mmu_context_epochs[asid] != mmu_context_epoch ) {
+        if( mmu_context_next_tag == XLAT_CONTEXT_NONE ) {
+            /* Wrapped around - old tags can't be allowed to match again */
+            mmu_context_flush_all();
+        }
+        mmu_context_tags[asid] = mmu_context_next_tag++;
+        mmu_context_epochs[asid] = mmu_context_epoch;
+    }
+    return mmu_context_tags[asid];
+}
+
+/**
+ * Invalidate the cached lookups for the given ASID (or for every ASID, if
+ * shared), following a change to the instruction mappings.
+ */
+static void mmu_context_changed( uint32_t asid, gboolean shared )
+{
+    if( shared || IS_SV_ENABLED() ) {
+        mmu_context_epoch++;
+    } else {
+        mmu_context_tags[asid] = XLAT_CONTEXT_NONE;
+    }
+    sh4r.xlat_context = mmu_context_tag(mmu_asid);
+}
+
+/**
+ * Throw away all cached lookups and start over with new tags
+ */
+static void mmu_context_flush_all()
+{
+    memset( mmu_context_tags, 0, sizeof(mmu_context_tags) );
+    mmu_context_next_tag = XLAT_CONTEXT_NONE+1;
+    xlat_target_cache_flush();
+    sh4_translate_flush_return_stack();
 }
 
 /******************************************************************************/
@@ -896,6 +1054,36 @@ int mmu_utlb_entry_for_vpn( uint32_t vpn )
 }
 
 
+/**
+ * @return the set of valid UTLB entries that could contain the given address,
+ * from the lookup index.
+ */
+static inline uint64_t mmu_utlb_candidates( uint32_t vpn )
+{
+    return mmu_utlb_hash[0][UTLB_HASH(vpn,10)] | mmu_utlb_hash[1][UTLB_HASH(vpn,12)] |
+           mmu_utlb_hash[2][UTLB_HASH(vpn,16)] | mmu_utlb_hash[3][UTLB_HASH(vpn,20)];
+}
+
+/**
+ * Check the candidate entries against the address.
+ * @return the matching entry, -1 for no match, or -2 for more than one match.
+ */
+static inline int mmu_utlb_match( uint32_t vpn, uint64_t candidates )
+{
+    int result = -1;
+    while( candidates != 0 ) {
+        int i = __builtin_ctzll(candidates);
+        candidates &= candidates - 1;
+        if( ((mmu_utlb[i].vpn ^ vpn) & mmu_utlb[i].mask) == 0 ) {
+            if( result != -1 ) {
+                return -2;
+            }
+            result = i;
+        }
+    }
+    return result;
+}
+
 /**
  * Perform the actual utlb lookup w/ asid matching.
  * Possible utcomes are:
@@ -907,25 +1095,13 @@ int mmu_utlb_entry_for_vpn( uint32_t vpn )
  */
 static inline int mmu_utlb_lookup_vpn_asid( uint32_t vpn )
 {
-    int result = -1;
-    unsigned int i;
-
     mmu_urc++;
     if( mmu_urc == mmu_urb || mmu_urc == 0x40 ) {
         mmu_urc = 0;
     }
 
-    for( i = 0; i < UTLB_ENTRY_COUNT; i++ ) {
-        if( (mmu_utlb[i].flags & TLB_VALID) &&
-                ((mmu_utlb[i].flags & TLB_SHARE) || mmu_asid == mmu_utlb[i].asid) &&
-                ((mmu_utlb[i].vpn ^ vpn) & mmu_utlb[i].mask) == 0 ) {
-            if( result != -1 ) {
-                return -2;
-            }
-            result = i;
-        }
-    }
-    return result;
+    return mmu_utlb_match( vpn, mmu_utlb_candidates(vpn) &
+            (mmu_utlb_asid_entries[mmu_asid] | mmu_utlb_shared_entries) );
 }
 
 /**
@@ -939,25 +1115,12 @@ static inline int mmu_utlb_lookup_vpn_asid( uint32_t vpn )
  */
 static inline int mmu_utlb_lookup_vpn( uint32_t vpn )
 {
-    int result = -1;
-    unsigned int i;
-
     mmu_urc++;
     if( mmu_urc == mmu_urb || mmu_urc == 0x40 ) {
         mmu_urc = 0;
     }
 
-    for( i = 0; i < UTLB_ENTRY_COUNT; i++ ) {
-        if( (mmu_utlb[i].flags & TLB_VALID) &&
-                ((mmu_utlb[i].vpn ^ vpn) & mmu_utlb[i].mask) == 0 ) {
-            if( result != -1 ) {
-                return -2;
-            }
-            result = i;
-        }
-    }
-
-    return result;
+    return mmu_utlb_match( vpn, mmu_utlb_candidates(vpn) );
 }
 
 /**
@@ -982,6 +1145,12 @@ static int inline mmu_itlb_update_from_utlb( int entryNo )
         mmu_lrui = (mmu_lrui | 0x0B);
     }
 
+    if( (mmu_itlb[replace].flags & TLB_VALID) && mmu_itlb_source[replace] == -1 ) {
+        /* Lookups made through the old entry may not be repeatable */
+        mmu_context_changed( mmu_itlb[replace].asid, mmu_itlb[replace].flags & TLB_SHARE );
+    }
+    mmu_itlb_source[replace] = entryNo;
+    mmu_utlb_fetch_entries |= ((uint64_t)1) << entryNo;
     mmu_itlb[replace].vpn = mmu_utlb[entryNo].vpn;
     mmu_itlb[replace].mask = mmu_utlb[entryNo].mask;
     mmu_itlb[replace].ppn = mmu_utlb[entryNo].ppn;
@@ -1212,6 +1381,71 @@ sh4addr_t FASTCALL mmu_vma_to_phys_disasm( sh4vma_t vma )
     }
 }
 
+/**
+ * Find the external address that a page of the priv or user address space
+ * maps straight through to, either directly (TLB off, or P1/P2) or by a
+ * normal 4K+ UTLB entry. Anything else (TLB miss, protection and multi-hit
+ * pages, 1K pages, the store queues) has to go through the page's functions.
+ * Does not modify any state.
+ * @param writable set to FALSE if writes to the page must go through the
+ * page's functions for the sake of the MMU (ie it's read-only or not yet dirty)
+ * @return TRUE if the page maps through, with *phys set to the external
+ * address of the page.
+ */
+gboolean mmu_get_page_phys( gboolean user, sh4vma_t vma, sh4addr_t *phys, gboolean *writable )
+{
+    mem_region_fn_t fn = (user ? sh4_user_address_space : sh4_address_space)[vma>>12];
+
+    if( IS_UTLB_PAGE_ENTRY(fn) ) {
+        int entryNo = ((struct utlb_page_entry *)fn) - &mmu_utlb_pages[0];
+        struct utlb_entry *ent = &mmu_utlb[entryNo];
+        if( fn != &mmu_utlb_pages[entryNo].fn || (ent->vpn & 0xFC000000) == 0xE0000000 ) {
+            return FALSE;
+        }
+        *phys = VMA_TO_EXT_ADDR((ent->ppn & ent->mask) | (vma & (~ent->mask))) & 0xFFFFF000;
+        *writable = (ent->flags & (TLB_WRITABLE|TLB_DIRTY)) == (TLB_WRITABLE|TLB_DIRTY);
+        return TRUE;
+    } else if( vma < 0xE0000000 && fn == sh4_ext_address_space[VMA_TO_EXT_ADDR(vma)>>12] ) {
+        *phys = VMA_TO_EXT_ADDR(vma) & 0xFFFFF000;
+        *writable = TRUE;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Resynchronize the fastmem windows for every address that can currently map
+ * onto the given range of external addresses.
+ */
+void mmu_sync_fastmem_phys( sh4addr_t addr, uint32_t size )
+{
+    uint32_t start = VMA_TO_EXT_ADDR(addr) & 0xFFFFF000;
+    uint32_t end = VMA_TO_EXT_ADDR(addr) + size;
+    uint32_t npages = (end - start + LXDREAM_PAGE_SIZE - 1) >> 12;
+    uint32_t i;
+
+    if( IS_TLB_ENABLED() ) {
+        sh4_fastmem_sync( start|0x80000000, npages );
+        sh4_fastmem_sync( start|0xA0000000, npages );
+        for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
+            struct utlb_entry *ent = &mmu_utlb[i];
+            uint32_t ppn = VMA_TO_EXT_ADDR(ent->ppn & ent->mask);
+            uint32_t pend = ppn + (~ent->mask) + 1;
+            if( (ent->flags & TLB_VALID) && ppn < end && pend > start &&
+                    (ent->vpn & 0xFC000000) != 0xE0000000 ) {
+                uint32_t from = MAX(ppn, start), to = MIN(pend, end);
+                sh4_fastmem_sync( (ent->vpn & ent->mask) + (from - ppn),
+                        (to - from + LXDREAM_PAGE_SIZE - 1) >> 12 );
+            }
+        }
+    } else {
+        /* P0, P1, P2 and P3 (and U0 in the user space) */
+        for( i=0; i<= 0xC0000000; i+= 0x20000000 ) {
+            sh4_fastmem_sync( start|i, npages );
+        }
+    }
+}
+
 /**
  * Translate a virtual to physical address for reading, raising exceptions as
  * observed.
@@ -1440,6 +1674,8 @@ void FASTCALL mmu_itlb_addr_write( sh4addr_t addr, uint32_t val )
     ent->vpn = val & 0xFFFFFC00;
     ent->asid = val & 0x000000FF;
     ent->flags = (ent->flags & ~(TLB_VALID)) | (val&TLB_VALID);
+    mmu_itlb_source[ITLB_ENTRY(addr)] = -1;
+    mmu_context_changed( 0, TRUE );
 }
 
 int32_t FASTCALL mmu_itlb_data_read( sh4addr_t addr )
@@ -1456,6 +1692,8 @@ void FASTCALL mmu_itlb_data_write( sh4addr_t addr, uint32_t val )
     ent->mask = get_tlb_size_mask(val);
     if( ent->ppn >= 0x1C000000 )
         ent->ppn |= 0xE0000000;
+    mmu_itlb_source[ITLB_ENTRY(addr)] = -1;
+    mmu_context_changed( 0, TRUE );
 }
 
 #define UTLB_ENTRY(addr) ((addr>>8)&0x3F)
@@ -1484,18 +1722,10 @@ int32_t FASTCALL mmu_utlb_data_read( sh4addr_t addr )
  */
 static inline int mmu_utlb_lookup_assoc( uint32_t vpn, uint32_t asid )
 {
-    int result = -1;
-    unsigned int i;
-    for( i = 0; i < UTLB_ENTRY_COUNT; i++ ) {
-        if( (mmu_utlb[i].flags & TLB_VALID) &&
-                ((mmu_utlb[i].flags & TLB_SHARE) || asid == mmu_utlb[i].asid) &&
-                ((mmu_utlb[i].vpn ^ vpn) & mmu_utlb[i].mask) == 0 ) {
-            if( result != -1 ) {
-                fprintf( stderr, "TLB Multi hit: %d %d\n", result, i );
-                return -2;
-            }
-            result = i;
-        }
+    int result = mmu_utlb_match( vpn, mmu_utlb_candidates(vpn) &
+            (mmu_utlb_asid_entries[asid] | mmu_utlb_shared_entries) );
+    if( result == -2 ) {
+        WARN( "TLB Multi hit: %08X", vpn );
     }
     return result;
 }
@@ -1531,6 +1761,7 @@ void FASTCALL mmu_utlb_addr_write( sh4addr_t addr, uint32_t val, void *exc )
             ent->flags = ent->flags & ~(TLB_DIRTY|TLB_VALID);
             ent->flags |= (val & TLB_VALID);
             ent->flags |= ((val & 0x200)>>7);
+            mmu_utlb_index_entry( utlb );
             if( IS_TLB_ENABLED() && ((old_flags^ent->flags) & (TLB_VALID|TLB_DIRTY)) != 0 ) {
                 if( old_flags & TLB_VALID )
                     mmu_utlb_remove_entry( utlb );
@@ -1543,6 +1774,8 @@ void FASTCALL mmu_utlb_addr_write( sh4addr_t addr, uint32_t val, void *exc )
         if( itlb >= 0 ) {
             struct itlb_entry *ent = &mmu_itlb[itlb];
             ent->flags = (ent->flags & (~TLB_VALID)) | (val & TLB_VALID);
+            mmu_itlb_source[itlb] = -1;
+            mmu_context_changed( 0, TRUE );
         }
 
         if( itlb == -2 || utlb == -2 ) {
@@ -1559,6 +1792,7 @@ void FASTCALL mmu_utlb_addr_write( sh4addr_t addr, uint32_t val, void *exc )
         ent->flags = (ent->flags & ~(TLB_DIRTY|TLB_VALID));
         ent->flags |= (val & TLB_VALID);
         ent->flags |= ((val & 0x200)>>7);
+        mmu_utlb_index_entry( UTLB_ENTRY(addr) );
         if( IS_TLB_ENABLED() && ent->flags & TLB_VALID )
             mmu_utlb_insert_entry( UTLB_ENTRY(addr) );
     }
@@ -1575,6 +1809,7 @@ void FASTCALL mmu_utlb_data_write( sh4addr_t addr, uint32_t val )
         ent->ppn = (val & 0x1FFFFC00);
         ent->flags = (val & 0x000001FF);
         ent->mask = get_tlb_size_mask(val);
+        mmu_utlb_index_entry( UTLB_ENTRY(addr) );
         if( IS_TLB_ENABLED() && ent->flags & TLB_VALID )
             mmu_utlb_insert_entry( UTLB_ENTRY(addr) );
     }
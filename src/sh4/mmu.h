@@ -117,6 +117,10 @@ mem_region_fn_t FASTCALL mmu_get_region_for_vma_read( sh4vma_t *addr );
 mem_region_fn_t FASTCALL mmu_get_region_for_vma_write( sh4vma_t *addr );
 mem_region_fn_t FASTCALL mmu_get_region_for_vma_prefetch( sh4vma_t *addr );
 
+/* Fastmem support (see sh4/fastmem.h) */
+gboolean mmu_get_page_phys( gboolean user, sh4vma_t vma, sh4addr_t *phys, gboolean *writable );
+void mmu_sync_fastmem_phys( sh4addr_t addr, uint32_t size );
+
 /* Translator provided helpers */
 void mmu_utlb_init_vtable( struct utlb_entry *ent, struct utlb_page_entry *page, gboolean writable ); 
 void mmu_utlb_1k_init_vtable( struct utlb_1k_entry *ent ); 
@@ -18,7 +18,6 @@
  */
 
 #define MODULE sh4_module
-#include <math.h>
 #include <setjmp.h>
 #include <assert.h>
 #include "lxdream.h"
@@ -36,10 +35,8 @@
 #include "sh4/sh4stat.h"
 #include "sh4/sh4trans.h"
 #include "xlat/xltcache.h"
-
-#ifndef M_PI
-#define M_PI        3.14159265358979323846264338327950288
-#endif
+#include "xlat/xltperf.h"
+#include "sh4/fastmem.h"
 
 void sh4_init( void );
 void sh4_poweron_reset( void );
@@ -189,6 +186,7 @@ void sh4_init(void)
     MMU_init();
     TMU_init();
     xlat_cache_init();
+    sh4_decode_cache_init();
     sh4_poweron_reset();
 #ifdef ENABLE_SH4STATS
     sh4_stats_reset();
@@ -198,6 +196,9 @@ void sh4_init(void)
 void sh4_start(void)
 {
     sh4_starting = TRUE;
+    if( sh4_use_translator ) {
+        xlat_protect_start();
+    }
 }
 
 void sh4_poweron_reset(void)
@@ -207,6 +208,7 @@ void sh4_poweron_reset(void)
     if(	sh4_use_translator ) {
         xlat_flush_cache();
     }
+    sh4_decode_cache_flush();
 
     /* Resume running if we were halted */
     sh4r.sh4_state = SH4_STATE_RUNNING;
@@ -240,7 +242,9 @@ void sh4_stop(void)
         if( sh4_profile_blocks ) {
             sh4_translate_dump_cache_by_activity(30);
         }
+        sh4_translate_save_persistent_cache();
 #endif
+        xlat_protect_stop();
     }
 }
 
@@ -348,6 +352,7 @@ int sh4_load_state( FILE * f )
     if(	sh4_use_translator ) {
         xlat_flush_cache();
     }
+    sh4_decode_cache_flush();
     fread( &sh4r, offsetof(struct sh4_registers, xlat_sh4_mode), 1, f );
     sh4r.xlat_sh4_mode = (sh4r.sr & SR_MD) | (sh4r.fpscr & (FPSCR_SZ|FPSCR_PR));
     MMU_load_state( f );
@@ -420,6 +425,56 @@ gboolean sh4_get_profile_blocks( )
     return sh4_profile_blocks;
 }
 
+void sh4_set_background_translate( gboolean flag )
+{
+#ifdef SH4_TRANSLATOR
+    sh4_translate_set_background( flag );
+#endif
+}
+
+void sh4_set_write_protect( gboolean flag )
+{
+    xlat_set_write_protect( flag );
+}
+
+void sh4_configure_translation_cache( gboolean generational, uint32_t new_size, uint32_t new_max_size,
+                                      uint32_t temp_size, uint32_t old_size )
+{
+    xlat_configure_cache( generational, new_size, new_max_size, temp_size, old_size );
+}
+
+gboolean sh4_set_translation_cache( const gchar *filename )
+{
+#ifdef SH4_TRANSLATOR
+    return sh4_translate_set_persistent_cache( filename );
+#else
+    return FALSE;
+#endif
+}
+
+gboolean sh4_set_perf_output( const gchar *format )
+{
+#ifdef SH4_TRANSLATOR
+    if( format == NULL ) {
+        return xlat_perf_open( XLAT_PERF_NONE );
+    } else if( g_ascii_strcasecmp( format, "map" ) == 0 ) {
+        return xlat_perf_open( XLAT_PERF_MAP );
+    } else if( g_ascii_strcasecmp( format, "jitdump" ) == 0 ) {
+        return xlat_perf_open( XLAT_PERF_JITDUMP );
+    }
+#endif
+    return FALSE;
+}
+
+gboolean sh4_set_fastmem( void )
+{
+#ifdef SH4_TRANSLATOR
+    return sh4_fastmem_init();
+#else
+    return FALSE;
+#endif
+}
+
 /**
  * Dump all SH4 core information for crash-dump purposes
  */
@@ -586,21 +641,6 @@ void FASTCALL sh4_accept_interrupt( void )
     sh4r.in_delay_slot = 0;
 }
 
-void FASTCALL signsat48( void )
-{
-    if( ((int64_t)sh4r.mac) < (int64_t)0xFFFF800000000000LL )
-        sh4r.mac = 0xFFFF800000000000LL;
-    else if( ((int64_t)sh4r.mac) > (int64_t)0x00007FFFFFFFFFFFLL )
-        sh4r.mac = 0x00007FFFFFFFFFFFLL;
-}
-
-void FASTCALL sh4_fsca( uint32_t anglei, float *fr )
-{
-    float angle = (((float)(anglei&0xFFFF))/65536.0) * 2 * M_PI;
-    *fr++ = cosf(angle);
-    *fr = sinf(angle);
-}
-
 /**
  * Enter sleep mode (eg by executing a SLEEP instruction).
  * Sets sh4_state appropriately and ensures any stopping peripheral modules
@@ -668,24 +708,6 @@ uint32_t sh4_sleep_run_slice( uint32_t nanosecs )
     return sh4r.slice_cycle;
 }
 
-
-/**
- * Compute the matrix tranform of fv given the matrix xf.
- * Both fv and xf are word-swapped as per the sh4r.fr banks
- */
-void FASTCALL sh4_ftrv( float *target )
-{
-    float fv[4] = { target[1], target[0], target[3], target[2] };
-    target[1] = sh4r.fr[1][1] * fv[0] + sh4r.fr[1][5]*fv[1] +
-    sh4r.fr[1][9]*fv[2] + sh4r.fr[1][13]*fv[3];
-    target[0] = sh4r.fr[1][0] * fv[0] + sh4r.fr[1][4]*fv[1] +
-    sh4r.fr[1][8]*fv[2] + sh4r.fr[1][12]*fv[3];
-    target[3] = sh4r.fr[1][3] * fv[0] + sh4r.fr[1][7]*fv[1] +
-    sh4r.fr[1][11]*fv[2] + sh4r.fr[1][15]*fv[3];
-    target[2] = sh4r.fr[1][2] * fv[0] + sh4r.fr[1][6]*fv[1] +
-    sh4r.fr[1][10]*fv[2] + sh4r.fr[1][14]*fv[3];
-}
-
 gboolean sh4_has_page( sh4vma_t vma )
 {
     sh4addr_t addr = mmu_vma_to_phys_disasm(vma);
@@ -707,12 +729,26 @@ void sh4_handle_pending_events() {
  */
 size_t sh4_debug_read_phys( unsigned char *buf, uint32_t addr, size_t length )
 {
-    /* Quick and very dirty */
-    unsigned char *region = mem_get_region(addr);
-    if( region == NULL ) {
-        memset( buf, 0, length );
-    } else {
-        memcpy( buf, region, length );
+    size_t read_len = 0;
+    while( read_len < length ) {
+        size_t next_len = 0x1000 - (addr&0xFFF);
+        if( next_len > length - read_len ) {
+            next_len = length - read_len;
+        }
+        unsigned char *region = mem_get_direct_ptr(addr, next_len);
+        if( region == NULL ) {
+            /* Read any other memory's backing store without going through the
+             * region (and its side effects). MMIO reads as 0 */
+            region = mem_get_region(addr);
+        }
+        if( region == NULL ) {
+            memset( buf, 0, next_len );
+        } else {
+            memcpy( buf, region, next_len );
+        }
+        buf += next_len;
+        addr += next_len;
+        read_len += next_len;
     }
     return length;
 }
@@ -741,7 +777,7 @@ size_t sh4_debug_read_vma( unsigned char *buf, uint32_t addr, size_t length )
             if( next_len >= length ) {
                 next_len = length;
             }
-            sh4_debug_read_phys( buf, phys, length );
+            sh4_debug_read_phys( buf, phys, next_len );
             buf += next_len;
             addr += next_len;
             read_len += next_len; 
@@ -91,6 +91,7 @@ struct sh4_registers {
     
     /* Not saved */
     int xlat_sh4_mode; /* Collection of execution mode flags (derived) from fpscr, sr, etc */
+    uint32_t xlat_context; /* Address space tag of the current ASID (see mmu.c) */
 };
 
 extern struct sh4_registers sh4r;
@@ -161,6 +162,53 @@ void sh4_set_profile_blocks( gboolean flag );
  */
 gboolean sh4_get_profile_blocks();
 
+/**
+ * Enable/disable re-translation of hot blocks on a background thread (Note 
+ * only supported by translation cores)
+ */
+void sh4_set_background_translate( gboolean flag );
+
+/**
+ * Enable/disable detection of self-modifying code by write-protecting RAM
+ * pages containing translated code, rather than checking every RAM write
+ * (Note only supported by translation cores)
+ */
+void sh4_set_write_protect( gboolean flag );
+
+/**
+ * Configure the translation cache: select between the single-space cache and
+ * the generational (new/temp/old) cache, and set the initial and maximum size
+ * of the new space, and the size of the temp and old spaces. Sizes are in 
+ * bytes, where 0 selects the default size. Any existing translations are
+ * discarded.
+ */
+void sh4_configure_translation_cache( gboolean generational, uint32_t new_size, uint32_t new_max_size,
+                                      uint32_t temp_size, uint32_t old_size );
+
+/**
+ * Set the file used to save translated code between runs, or NULL to disable
+ * the persistent translation cache (Note only supported by translation cores)
+ * @return FALSE if the cache couldn't be enabled
+ */
+gboolean sh4_set_translation_cache( const gchar *filename );
+
+/**
+ * Describe translated code to the Linux perf profiler, in the given format 
+ * ("map" for /tmp/perf-<pid>.map, "jitdump" for /tmp/jit-<pid>.dump), or stop
+ * if format is NULL. (Note only supported by translation cores)
+ * @return FALSE if the format is unknown or the output couldn't be created
+ */
+gboolean sh4_set_perf_output( const gchar *format );
+
+/**
+ * Enable translated code to access main RAM directly through a host memory
+ * window (see sh4/fastmem.h). Must be called while the SH4 is stopped, and
+ * can't be turned off again. (Note only supported by the translator on 64-bit
+ * hosts)
+ * @return FALSE if fastmem couldn't be enabled
+ */
+gboolean sh4_set_fastmem( void );
+
 struct sh4_symbol {
 	const char *name;
 	sh4addr_t address;
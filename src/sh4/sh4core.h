@@ -189,6 +189,23 @@ void FASTCALL sh4_write_sr(uint32_t val);
 void FASTCALL sh4_write_fpscr(uint32_t val);
 void FASTCALL sh4_switch_fr_banks(void);
 void FASTCALL signsat48(void);
+
+/**
+ * Runtime support for instruction sequences that the translator replaces
+ * with a single operation (see sh4_translate_match_idiom). The operands are
+ * packed into one word, with registers in 4-bit fields from bit 0. The copy
+ * and MAC functions return FALSE without changing anything if the sequence
+ * can't be performed directly (eg it touches memory other than main RAM),
+ * in which case the caller must execute it normally.
+ */
+#define IDIOM_REG(args,n)      (((args)>>((n)*4))&0x0F)
+#define IDIOM_SIZE(args)       (((args)>>16)&0x03) /* log2 of the element size */
+#define IDIOM_COPY_LOAD        0x00040000 /* Copy from Rs (otherwise fill with Rv) */
+#define IDIOM_COPY_ADD_FIRST   0x00080000 /* Rd is incremented before the store */
+#define IDIOM_COUNT(args)      ((args)>>24) /* Instructions per iteration (copy), or MAC count */
+void FASTCALL sh4_idiom_udiv( uint32_t args );
+gboolean FASTCALL sh4_idiom_copy( uint32_t args );
+gboolean FASTCALL sh4_idiom_mac( uint32_t args );
 gboolean sh4_has_page( sh4vma_t vma );
 
 /* SH4 Memory */
@@ -268,6 +285,17 @@ void FASTCALL sh4_reraise_exception( sh4addr_t exception_pc );
  */  
 void sh4_finalize_instruction( void );
 
+/**
+ * Set up the interpreter's cache of predecoded instructions
+ */
+void sh4_decode_cache_init( void );
+
+/**
+ * Discard all predecoded instructions, eg when the contents of memory have
+ * been replaced by loading a saved state.
+ */
+void sh4_decode_cache_flush( void );
+
 /* Status Register (SR) bits */
 #define SR_MD    0x40000000 /* Processor mode ( User=0, Privileged=1 ) */ 
 #define SR_RB    0x20000000 /* Register bank (priviledged mode only) */
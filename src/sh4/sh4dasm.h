@@ -31,6 +31,14 @@ uint32_t sh4_disasm_instruction( uint32_t pc, char *buf, int len, char * );
 void sh4_disasm_region( FILE *f, int from, int to );
 const char *sh4_disasm_get_symbol( sh4addr_t addr );
 
+/**
+ * Find the symbol containing addr (or the nearest preceding one, if its size
+ * is unknown).
+ * @param offset set to the offset of addr from the start of the symbol
+ * @return the symbol name, or NULL if there's no such symbol.
+ */
+const char *sh4_disasm_find_symbol( sh4addr_t addr, uint32_t *offset );
+
 #ifdef __cplusplus
 }
 #endif
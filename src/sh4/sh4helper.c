@@ -0,0 +1,221 @@
+/**
+ * $Id$
+ *
+ * Out-of-line SH4 operations called from translated code. These only depend
+ * on the SH4 registers and main RAM, and are kept apart from sh4.c so that
+ * testsh4x86 can check the translator against them.
+ *
+ * Copyright (c) 2026 agent.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "lxdream.h"
+#include "dreamcast.h"
+#include "mem.h"
+#include "clock.h"
+#include "sh4/sh4core.h"
+#include "sh4/mmu.h"
+#include "xlat/xltcache.h"
+
+#ifndef M_PI
+#define M_PI        3.14159265358979323846264338327950288
+#endif
+
+extern struct mem_region_fn mem_region_sdram;
+
+/**
+ * @return a pointer to size bytes of main RAM at vma, provided that every page
+ * of it is mapped straight to RAM in the current address space (ie not via the
+ * TLB, and not through any other region), otherwise NULL.
+ */
+static unsigned char *sh4_idiom_ram_ptr( sh4vma_t vma, uint32_t size )
+{
+    struct mem_region_fn **space = (sh4r.sr & SR_MD) ? sh4_address_space : sh4_user_address_space;
+    uint32_t page;
+
+    if( size == 0 || (vma & 0x00FFFFFF) + size > 0x01000000 ) {
+        return NULL;
+    }
+    for( page = vma >> 12; page <= (vma + size - 1) >> 12; page++ ) {
+        if( space[page] != &mem_region_sdram ) {
+            return NULL;
+        }
+    }
+    return dc_main_ram + (vma & 0x00FFFFFF);
+}
+
+/**
+ * DIV0U followed by 32 x (ROTCL Rq; DIV1 Rd, Rr). The translator handles the
+ * common case (Rr < Rd) itself with a single division, so this is just the
+ * exact step-by-step version for everything else.
+ */
+void FASTCALL sh4_idiom_udiv( uint32_t args )
+{
+    uint32_t *rq = &sh4r.r[IDIOM_REG(args,0)];
+    uint32_t *rr = &sh4r.r[IDIOM_REG(args,1)];
+    uint32_t d = sh4r.r[IDIOM_REG(args,2)];
+    uint32_t tmp0, tmp1, dir;
+    int i;
+
+    sh4r.m = sh4r.q = sh4r.t = 0;
+    for( i=0; i<32; i++ ) {
+        tmp0 = *rq >> 31;
+        *rq = (*rq << 1) | sh4r.t;
+        sh4r.t = tmp0;
+
+        dir = sh4r.q;
+        sh4r.q = *rr >> 31;
+        tmp0 = (*rr << 1) | sh4r.t;
+        if( dir ) {
+            *rr = tmp0 + d;
+            tmp1 = (*rr < tmp0 ? 1 : 0);
+        } else {
+            *rr = tmp0 - d;
+            tmp1 = (*rr > tmp0 ? 1 : 0);
+        }
+        sh4r.q ^= tmp1;
+        sh4r.t = (sh4r.q == 0 ? 1 : 0);
+    }
+}
+
+/**
+ * Copy or fill loop, ie Rc iterations of (optionally) MOV.x @Rs+, Rv, then
+ * MOV.x Rv, @Rd; ADD #size, Rd; DT Rc; BF loop. The whole loop runs at once,
+ * so it's declined if it would run past the next event.
+ */
+gboolean FASTCALL sh4_idiom_copy( uint32_t args )
+{
+    int rd = IDIOM_REG(args,0), rs = IDIOM_REG(args,1), rv = IDIOM_REG(args,2), rc = IDIOM_REG(args,3);
+    int shift = IDIOM_SIZE(args);
+    uint32_t count = sh4r.r[rc];
+    uint32_t bytes = count << shift;
+    sh4vma_t dest = sh4r.r[rd] + ((args & IDIOM_COPY_ADD_FIRST) ? (1<<shift) : 0);
+    uint64_t cycles = ((uint64_t)count - 1) * IDIOM_COUNT(args) * sh4_cpu_period;
+    unsigned char *dst, *src = NULL;
+    uint32_t i;
+
+    if( count == 0 || count > (0x01000000 >> shift) ||
+            ((dest | ((args & IDIOM_COPY_LOAD) ? sh4r.r[rs] : 0)) & ((1<<shift)-1)) != 0 ||
+            sh4r.slice_cycle + cycles >= sh4r.event_pending ||
+            (dst = sh4_idiom_ram_ptr( dest, bytes )) == NULL ) {
+        return FALSE;
+    }
+    if( args & IDIOM_COPY_LOAD ) {
+        /* Copying forwards one element at a time only matches memmove if the
+         * destination doesn't start within the source */
+        if( (src = sh4_idiom_ram_ptr( sh4r.r[rs], bytes )) == NULL ||
+                (dst > src && dst < src + bytes) ) {
+            return FALSE;
+        }
+    }
+
+    xlat_invalidate_block( dest, bytes );
+    if( src != NULL ) {
+        memmove( dst, src, bytes );
+        sh4r.r[rs] += bytes;
+        switch( shift ) {
+        case 0: sh4r.r[rv] = SIGNEXT8(dst[bytes-1]); break;
+        case 1: sh4r.r[rv] = SIGNEXT16(((uint16_t *)dst)[count-1]); break;
+        default: sh4r.r[rv] = ((uint32_t *)dst)[count-1]; break;
+        }
+    } else {
+        switch( shift ) {
+        case 0:
+            memset( dst, sh4r.r[rv], bytes );
+            break;
+        case 1:
+            for( i=0; i<count; i++ ) {
+                ((uint16_t *)dst)[i] = (uint16_t)sh4r.r[rv];
+            }
+            break;
+        default:
+            for( i=0; i<count; i++ ) {
+                ((uint32_t *)dst)[i] = sh4r.r[rv];
+            }
+            break;
+        }
+    }
+    sh4r.r[rd] += bytes;
+    sh4r.r[rc] = 0;
+    sh4r.t = 1;
+    sh4r.slice_cycle += cycles;
+    return TRUE;
+}
+
+/**
+ * A run of identical MAC.W @Rm+, @Rn+ (or MAC.L) instructions, with Rm != Rn.
+ * Only handled without saturation, where the order of the additions doesn't
+ * matter.
+ */
+gboolean FASTCALL sh4_idiom_mac( uint32_t args )
+{
+    int rm = IDIOM_REG(args,0), rn = IDIOM_REG(args,1);
+    int shift = IDIOM_SIZE(args);
+    uint32_t count = IDIOM_COUNT(args);
+    uint32_t bytes = count << shift;
+    unsigned char *m, *n;
+    int64_t sum = 0;
+    uint32_t i;
+
+    if( sh4r.s || ((sh4r.r[rm] | sh4r.r[rn]) & ((1<<shift)-1)) != 0 ||
+            (m = sh4_idiom_ram_ptr( sh4r.r[rm], bytes )) == NULL ||
+            (n = sh4_idiom_ram_ptr( sh4r.r[rn], bytes )) == NULL ) {
+        return FALSE;
+    }
+    if( shift == 2 ) {
+        for( i=0; i<count; i++ ) {
+            sum += ((int64_t)((int32_t *)m)[i]) * ((int32_t *)n)[i];
+        }
+    } else {
+        for( i=0; i<count; i++ ) {
+            sum += ((int32_t)((int16_t *)m)[i]) * ((int16_t *)n)[i];
+        }
+    }
+    sh4r.mac += sum;
+    sh4r.r[rm] += bytes;
+    sh4r.r[rn] += bytes;
+    return TRUE;
+}
+
+void FASTCALL signsat48( void )
+{
+    if( ((int64_t)sh4r.mac) < (int64_t)0xFFFF800000000000LL )
+        sh4r.mac = 0xFFFF800000000000LL;
+    else if( ((int64_t)sh4r.mac) > (int64_t)0x00007FFFFFFFFFFFLL )
+        sh4r.mac = 0x00007FFFFFFFFFFFLL;
+}
+
+void FASTCALL sh4_fsca( uint32_t anglei, float *fr )
+{
+    float angle = (((float)(anglei&0xFFFF))/65536.0) * 2 * M_PI;
+    *fr++ = cosf(angle);
+    *fr = sinf(angle);
+}
+
+/**
+ * Compute the matrix tranform of fv given the matrix xf.
+ * Both fv and xf are word-swapped as per the sh4r.fr banks
+ */
+void FASTCALL sh4_ftrv( float *target )
+{
+    float fv[4] = { target[1], target[0], target[3], target[2] };
+    target[1] = sh4r.fr[1][1] * fv[0] + sh4r.fr[1][5]*fv[1] +
+    sh4r.fr[1][9]*fv[2] + sh4r.fr[1][13]*fv[3];
+    target[0] = sh4r.fr[1][0] * fv[0] + sh4r.fr[1][4]*fv[1] +
+    sh4r.fr[1][8]*fv[2] + sh4r.fr[1][12]*fv[3];
+    target[3] = sh4r.fr[1][3] * fv[0] + sh4r.fr[1][7]*fv[1] +
+    sh4r.fr[1][11]*fv[2] + sh4r.fr[1][15]*fv[3];
+    target[2] = sh4r.fr[1][2] * fv[0] + sh4r.fr[1][6]*fv[1] +
+    sh4r.fr[1][10]*fv[2] + sh4r.fr[1][14]*fv[3];
+}
@@ -0,0 +1,98 @@
+/**
+ * $Id$
+ *
+ * SH4 instruction-level IR, used by the translator to analyse a block before
+ * (and while) emitting code for it.
+ *
+ * Copyright (c) 2026 agent.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_sh4ir_H
+#define lxdream_sh4ir_H 1
+
+#include <stdint.h>
+#include "lxdream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Pseudo-registers, as bits in the reads/writes masks. R0..R15 are bits 0..15,
+ * and refer to the current bank.
+ */
+#define SH4_IR_REG(r)   (1<<(r))
+#define SH4_IR_REGS     0x0000FFFF
+#define SH4_IR_T        0x00010000
+#define SH4_IR_SQM      0x00020000 /* SR.S, SR.Q, SR.M */
+#define SH4_IR_MACH     0x00040000
+#define SH4_IR_MACL     0x00080000
+#define SH4_IR_GBR      0x00100000
+#define SH4_IR_PR       0x00200000
+#define SH4_IR_FPUL     0x00400000
+#define SH4_IR_FPSCR    0x00800000
+#define SH4_IR_FR       0x01000000 /* Any FR/XF register */
+#define SH4_IR_SYS      0x02000000 /* Other SR bits, and the other control registers */
+#define SH4_IR_ALL      0x03FFFFFF
+
+/** Instruction flags */
+#define SH4_IR_BRANCH   0x01 /* PC-relative branch (may be delayed) */
+#define SH4_IR_JUMP     0x02 /* Any other change in control flow (including RTE and TRAPA) */
+#define SH4_IR_DELAYED  0x04 /* Has a delay slot */
+#define SH4_IR_LOAD     0x08 /* Reads memory */
+#define SH4_IR_STORE    0x10 /* Writes memory */
+#define SH4_IR_EXCEPT   0x20 /* May raise an exception, or otherwise exits the block */
+#define SH4_IR_ADDR     0x40 /* Load address is given by addr (integer loads only) */
+
+/** Simple operations that the optimiser knows how to evaluate */
+typedef enum {
+    SH4_IR_OTHER,
+    SH4_IR_MOVI,   /* Rn = imm */
+    SH4_IR_MOV,    /* Rn = Rm */
+    SH4_IR_ADDI,   /* Rn = Rn + imm */
+    SH4_IR_ADD,    /* Rn = Rn + Rm */
+    SH4_IR_MOVA    /* R0 = PC + imm (imm includes the PC adjustment) */
+} sh4_ir_op_t;
+
+/**
+ * A memory address, as disp plus the values of the base and index 
+ * pseudo-registers (each a single SH4_IR_* bit, or 0 if unused). 
+ * PC-relative addresses have neither, and disp is the absolute address.
+ */
+struct sh4_ir_addr {
+    uint32_t base;
+    uint32_t index;
+    int32_t disp;
+};
+
+struct sh4_ir_inst {
+    sh4_ir_op_t op;
+    uint32_t flags;
+    int rn, rm;
+    int32_t imm;
+    uint32_t reads;
+    uint32_t writes;
+    struct sh4_ir_addr addr;
+};
+
+/**
+ * Decode a single instruction into its IR form
+ * @param pc the address of the instruction (used for PC-relative operands)
+ */
+void sh4_ir_decode( sh4vma_t pc, uint16_t ir, struct sh4_ir_inst *inst );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_sh4ir_H */
@@ -37,7 +37,22 @@
  * into the same memory block
  */
 void mem_copy_from_sh4( sh4ptr_t dest, sh4addr_t srcaddr, size_t count ) {
-    if( srcaddr >= 0x04000000 && srcaddr < 0x05000000 ) {
+    /* Plain memory a page at a time, up to the first page that isn't */
+    while( count > 0 ) {
+        size_t len = 0x1000 - (srcaddr&0xFFF);
+        if( len > count )
+            len = count;
+        sh4ptr_t src = mem_get_direct_ptr(srcaddr, len);
+        if( src == NULL )
+            break;
+        memcpy( dest, src, len );
+        dest += len;
+        srcaddr += len;
+        count -= len;
+    }
+    if( count == 0 ) {
+        return;
+    } else if( srcaddr >= 0x04000000 && srcaddr < 0x05000000 ) {
         pvr2_vram64_read( dest, srcaddr, count );
     } else {
         sh4ptr_t src = mem_get_region(srcaddr);
@@ -50,7 +65,22 @@ void mem_copy_from_sh4( sh4ptr_t dest, sh4addr_t srcaddr, size_t count ) {
 }
 
 void mem_copy_to_sh4( sh4addr_t destaddr, sh4ptr_t src, size_t count ) {
-    if( destaddr >= 0x10000000 && destaddr < 0x14000000 ) {
+    while( count > 0 ) {
+        size_t len = 0x1000 - (destaddr&0xFFF);
+        if( len > count )
+            len = count;
+        sh4ptr_t dest = mem_get_direct_ptr(destaddr, len);
+        if( dest == NULL )
+            break;
+        xlat_invalidate_block( destaddr, len );
+        memcpy( dest, src, len );
+        destaddr += len;
+        src += len;
+        count -= len;
+    }
+    if( count == 0 ) {
+        return;
+    } else if( destaddr >= 0x10000000 && destaddr < 0x14000000 ) {
         pvr2_dma_write( destaddr, src, count );
         return;
     } else if( (destaddr & 0x1F800000) == 0x05000000 ) {
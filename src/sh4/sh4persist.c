@@ -0,0 +1,623 @@
+/**
+ * $Id$
+ *
+ * Persistent translation cache. Translated blocks are saved to disk so that
+ * code that runs on every boot (the BIOS, the game's main executable) can be
+ * loaded rather than re-translated next time.
+ *
+ * Blocks are keyed by a hash of the source memory they were translated from
+ * together with everything else that determines how they were translated
+ * (entry address, SH4 mode and translator settings). The absolute pointers
+ * in each block are recorded as it's translated (see sh4_translate_add_reloc)
+ * and classified by what they point to when the block is saved, so that they
+ * can be relocated for the current process when the block is loaded.
+ *
+ * Copyright (c) 2026 agent.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* For dladdr */
+#endif
+#define MODULE sh4_module
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "lxdream.h"
+#include "dream.h"
+#include "sh4/sh4core.h"
+#include "sh4/sh4trans.h"
+#include "sh4/mmu.h"
+#include "sh4/fastmem.h"
+#include "xlat/xltcache.h"
+#include "xlat/xltperf.h"
+
+#ifdef HAVE_DLADDR
+#include <dlfcn.h>
+#endif
+
+#define XLAT_PERSIST_MAGIC "%!-lxDream!XlatCache"
+#define XLAT_PERSIST_MAGIC_SIZE 24
+#define XLAT_PERSIST_VERSION 0x00010003
+/** Maximum total size of the records in the cache */
+#define XLAT_PERSIST_MAX_SIZE (64*1024*1024)
+
+#define XLAT_PERSIST_OPTIMISED 0x01 /* Tier 2 translation */
+#define XLAT_PERSIST_TLB_ON    0x02
+
+/* Relocation types, by what the pointer refers to */
+#define XLAT_RELOC_BLOCK      1 /* The block itself - value is offset from the code */
+#define XLAT_RELOC_IMAGE      2 /* The lxdream executable - value is offset from the image base */
+#define XLAT_RELOC_SOURCE     3 /* The source page in SH4 memory - value is offset from the page */
+#define XLAT_RELOC_LUT        4 /* An xlat_lut entry - value is the SH4 physical address */
+#define XLAT_RELOC_PRIV_SPACE 5 /* sh4_address_space */
+#define XLAT_RELOC_USER_SPACE 6 /* sh4_user_address_space */
+#define XLAT_RELOC_FASTMEM_PRIV 7 /* sh4_fastmem_priv_base */
+#define XLAT_RELOC_FASTMEM_USER 8 /* sh4_fastmem_user_base */
+
+struct xlat_persist_header {
+    char magic[XLAT_PERSIST_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t build; /* Signature of the executable the blocks were saved from */
+    uint32_t record_count;
+    uint32_t reserved;
+};
+
+/* All fields are compared, so there must be no implicit padding */
+struct xlat_persist_key {
+    uint64_t page_hash;
+    sh4vma_t pc;
+    sh4addr_t ppa;
+    uint32_t xlat_sh4_mode;
+    uint32_t flags;
+    uint32_t config; /* sh4_translate_get_config() */
+    uint32_t reserved;
+};
+
+struct xlat_persist_reloc {
+    uint32_t offset; /* Of the pointer, from the start of the code */
+    uint32_t type;
+    int64_t value;
+};
+
+/**
+ * A saved block, which has the same layout in memory and on disk:
+ *   struct xlat_block_range ranges[range_count];
+ *   struct xlat_persist_reloc relocs[reloc_count];
+ *   unsigned char code[code_size]; (including the recovery and fixup tables)
+ */
+struct xlat_persist_record {
+    struct xlat_persist_key key;
+    uint32_t checksum; /* Of the remainder of the record */
+    uint32_t code_size;
+    uint32_t recover_table_offset;
+    uint32_t recover_table_size;
+    uint32_t range_count;
+    uint32_t reloc_count;
+    unsigned char data[0];
+};
+
+#define RECORD_RANGES(rec) ((struct xlat_block_range *)(rec)->data)
+#define RECORD_RELOCS(rec) ((struct xlat_persist_reloc *)(RECORD_RANGES(rec) + (rec)->range_count))
+#define RECORD_CODE(rec) ((unsigned char *)(RECORD_RELOCS(rec) + (rec)->reloc_count))
+#define RECORD_SIZE(rec) ((RECORD_CODE(rec) + (rec)->code_size) - (unsigned char *)(rec))
+#define RECORD_CHECKSUM_START offsetof(struct xlat_persist_record, code_size)
+
+static gchar *xlat_persist_filename = NULL;
+static GHashTable *xlat_persist_table = NULL;
+static uint32_t xlat_persist_size = 0;
+static gboolean xlat_persist_dirty = FALSE;
+static uintptr_t xlat_persist_image_base;
+/* Pointers already confirmed to be in the executable image */
+static GHashTable *xlat_persist_image_ptrs = NULL;
+
+/* Blocks may be added from the background translation thread */
+static pthread_mutex_t xlat_persist_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t xlat_persist_checksum( const void *data, size_t length, uint32_t hash )
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+    for( i=0; i<length; i++ ) {
+        hash = (hash ^ p[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+static uint64_t xlat_persist_hash_page( const unsigned char *page, uint32_t size )
+{
+    const uint32_t *p = (const uint32_t *)page;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint32_t i;
+    for( i=0; i<size/4; i++ ) {
+        hash = (hash ^ p[i]) * 0x100000001B3ULL;
+    }
+    if( size & 2 ) {
+        hash = (hash ^ *(const uint16_t *)(page + (size & ~3))) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static guint xlat_persist_key_hash( gconstpointer p )
+{
+    const struct xlat_persist_key *key = (const struct xlat_persist_key *)p;
+    return (guint)(key->page_hash ^ (key->page_hash >> 32)) ^ key->pc ^ (key->xlat_sh4_mode << 16);
+}
+
+static gboolean xlat_persist_key_equal( gconstpointer a, gconstpointer b )
+{
+    return memcmp( a, b, sizeof(struct xlat_persist_key) ) == 0;
+}
+
+/**
+ * Fill in the key for a block at start, from xlat_source. The memory hashed
+ * is everything the translator may read for the block: the source window 
+ * (see XLAT_SOURCE_SIZE), plus the delay slot of a branch at the end of the
+ * window if the icache extends that far.
+ */
+static void xlat_persist_init_key( struct xlat_persist_key *key, sh4vma_t start, gboolean optimise )
+{
+    sh4vma_t window = XLAT_SOURCE_START(start);
+    uint32_t size = XLAT_SOURCE_SIZE(start);
+    if( XLAT_IS_IN_ICACHE(window + size) ) {
+        size += 2;
+    }
+    key->page_hash = xlat_persist_hash_page( XLAT_ICACHE_PTR(window), size );
+    key->pc = start;
+    key->ppa = XLAT_ICACHE_PHYS(start);
+    key->xlat_sh4_mode = xlat_source.xlat_sh4_mode;
+    key->flags = (optimise ? XLAT_PERSIST_OPTIMISED : 0) |
+        (xlat_source.tlb_on ? XLAT_PERSIST_TLB_ON : 0);
+    key->config = sh4_translate_get_config();
+    key->reserved = 0;
+}
+
+/******************************* Image pointers *******************************/
+
+static gboolean xlat_persist_init_image( void )
+{
+#ifdef HAVE_DLADDR
+    Dl_info info;
+    if( dladdr( &sh4r, &info ) != 0 ) {
+        xlat_persist_image_base = (uintptr_t)info.dli_fbase;
+        return TRUE;
+    }
+#endif
+    return FALSE;
+}
+
+/**
+ * @return TRUE if ptr is in the same executable image as sh4r (dladdr is
+ * relatively slow, so positive results are remembered)
+ */
+static gboolean xlat_persist_is_image_ptr( uintptr_t ptr )
+{
+#ifdef HAVE_DLADDR
+    Dl_info info;
+    if( g_hash_table_lookup( xlat_persist_image_ptrs, (gpointer)ptr ) != NULL ) {
+        return TRUE;
+    }
+    if( dladdr( (void *)ptr, &info ) != 0 && (uintptr_t)info.dli_fbase == xlat_persist_image_base ) {
+        g_hash_table_insert( xlat_persist_image_ptrs, (gpointer)ptr, (gpointer)ptr );
+        return TRUE;
+    }
+#endif
+    return FALSE;
+}
+
+/**
+ * Compute a signature for the executable, such that blocks saved from any
+ * other build are rejected.
+ */
+static uint32_t xlat_persist_build_signature( void )
+{
+    uintptr_t offsets[] = { (uintptr_t)&sh4r, (uintptr_t)&xlat_target_cache,
+            (uintptr_t)sh4_translate_basic_block, (uintptr_t)sh4_raise_exception,
+            (uintptr_t)xlat_get_code };
+    uint32_t hash = 0x811C9DC5;
+    unsigned i;
+    for( i=0; i<sizeof(offsets)/sizeof(offsets[0]); i++ ) {
+        offsets[i] -= xlat_persist_image_base;
+    }
+    hash = xlat_persist_checksum( offsets, sizeof(offsets), hash );
+    return xlat_persist_checksum( lxdream_full_version, strlen(lxdream_full_version), hash );
+}
+
+/******************************** Relocation **********************************/
+
+/**
+ * Classify the pointer at reloc->offset in the just-translated block.
+ * @return FALSE if the pointer can't be relocated.
+ */
+static gboolean xlat_persist_classify_reloc( struct xlat_persist_reloc *reloc, sh4vma_t start,
+                                             xlat_cache_block_t block, uint32_t code_size )
+{
+    uint32_t page_size = XLAT_SOURCE_SIZE(start);
+    uintptr_t code = (uintptr_t)block->code;
+    uintptr_t ptr = *((uintptr_t *)(block->code + reloc->offset));
+    uintptr_t page = (uintptr_t)XLAT_ICACHE_LIVE_PTR(XLAT_SOURCE_START(start));
+    sh4addr_t page_ppa = XLAT_ICACHE_PHYS(XLAT_SOURCE_START(start));
+    uintptr_t lut = (uintptr_t)xlat_get_lut_entry(page_ppa);
+
+    if( ptr >= (uintptr_t)block && ptr < code + code_size ) {
+        reloc->type = XLAT_RELOC_BLOCK;
+        reloc->value = (intptr_t)(ptr - code);
+    } else if( ptr >= page && ptr < page + page_size ) {
+        reloc->type = XLAT_RELOC_SOURCE;
+        reloc->value = ptr - page;
+    } else if( ptr >= lut && ptr < lut + (page_size/2)*sizeof(void *) &&
+            (ptr - lut) % sizeof(void *) == 0 &&
+            (uintptr_t)xlat_get_lut_entry(page_ppa + ((ptr - lut)/sizeof(void *))*2) == ptr ) {
+        reloc->type = XLAT_RELOC_LUT;
+        reloc->value = page_ppa + ((ptr - lut)/sizeof(void *))*2;
+    } else if( ptr == (uintptr_t)sh4_address_space ) {
+        reloc->type = XLAT_RELOC_PRIV_SPACE;
+        reloc->value = 0;
+    } else if( ptr == (uintptr_t)sh4_user_address_space ) {
+        reloc->type = XLAT_RELOC_USER_SPACE;
+        reloc->value = 0;
+    } else if( sh4_fastmem_priv_base != NULL && ptr == (uintptr_t)sh4_fastmem_priv_base ) {
+        reloc->type = XLAT_RELOC_FASTMEM_PRIV;
+        reloc->value = 0;
+    } else if( sh4_fastmem_user_base != NULL && ptr == (uintptr_t)sh4_fastmem_user_base ) {
+        reloc->type = XLAT_RELOC_FASTMEM_USER;
+        reloc->value = 0;
+    } else if( xlat_persist_is_image_ptr( ptr ) ) {
+        reloc->type = XLAT_RELOC_IMAGE;
+        reloc->value = (intptr_t)(ptr - xlat_persist_image_base);
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Compute the current value of a relocated pointer in a block being loaded
+ */
+static uintptr_t xlat_persist_resolve_reloc( struct xlat_persist_reloc *reloc, sh4vma_t start,
+                                             void *code )
+{
+    switch( reloc->type ) {
+    case XLAT_RELOC_BLOCK:
+        return (uintptr_t)code + reloc->value;
+    case XLAT_RELOC_IMAGE:
+        return xlat_persist_image_base + reloc->value;
+    case XLAT_RELOC_SOURCE:
+        return (uintptr_t)XLAT_ICACHE_LIVE_PTR(XLAT_SOURCE_START(start)) + reloc->value;
+    case XLAT_RELOC_LUT:
+        return (uintptr_t)xlat_get_lut_entry( (sh4addr_t)reloc->value );
+    case XLAT_RELOC_PRIV_SPACE:
+        return (uintptr_t)sh4_address_space;
+    case XLAT_RELOC_USER_SPACE:
+        return (uintptr_t)sh4_user_address_space;
+    case XLAT_RELOC_FASTMEM_PRIV:
+        return (uintptr_t)sh4_fastmem_priv_base;
+    case XLAT_RELOC_FASTMEM_USER:
+        return (uintptr_t)sh4_fastmem_user_base;
+    default:
+        assert(0);
+        return 0;
+    }
+}
+
+/**
+ * Check that a record read from the file is internally consistent (the key
+ * is checked against the SH4 memory when the block is looked up)
+ * @param length number of bytes available for the record
+ * @return the size of the record, or 0 if it's invalid.
+ */
+static size_t xlat_persist_validate_record( struct xlat_persist_record *rec, size_t length )
+{
+    struct xlat_block_range *ranges;
+    struct xlat_persist_reloc *relocs;
+    sh4addr_t page = rec->key.ppa & 0xFFFFF000;
+    uint32_t *fixups;
+    size_t size;
+    uint32_t i;
+
+    if( length < sizeof(struct xlat_persist_record) ||
+            rec->range_count == 0 || rec->range_count > MAX_TRACE_SEGMENTS ||
+            rec->reloc_count > MAX_RELOC_SIZE || rec->code_size > XLAT_PERSIST_MAX_SIZE ) {
+        return 0;
+    }
+    size = RECORD_SIZE(rec);
+    if( size > length ||
+            rec->checksum != xlat_persist_checksum( ((unsigned char *)rec) + RECORD_CHECKSUM_START,
+                    size - RECORD_CHECKSUM_START, 0x811C9DC5 ) ||
+            rec->recover_table_size == 0 || rec->recover_table_size > MAX_RECOVERY_SIZE ||
+            rec->recover_table_offset + rec->recover_table_size*sizeof(struct xlat_recovery_record)
+                + sizeof(uint32_t) > rec->code_size ) {
+        return 0;
+    }
+
+    fixups = (uint32_t *)(RECORD_CODE(rec) + rec->recover_table_offset +
+            rec->recover_table_size*sizeof(struct xlat_recovery_record));
+    if( fixups[0] != XLAT_FIXUP_OVERFLOW ) {
+        if( fixups[0] > MAX_FIXUP_SIZE ||
+                ((unsigned char *)&fixups[fixups[0]+1]) > RECORD_CODE(rec) + rec->code_size ) {
+            return 0;
+        }
+        for( i=1; i<=fixups[0]; i++ ) {
+            if( (fixups[i] & ~XLAT_FIXUP_LINK) >= rec->recover_table_offset ) {
+                return 0;
+            }
+        }
+    }
+
+    ranges = RECORD_RANGES(rec);
+    if( ranges[0].start != rec->key.ppa ) {
+        return 0;
+    }
+    for( i=0; i<rec->range_count; i++ ) {
+        /* A delay slot may extend past the end of the source window */
+        if( ranges[i].start < page || ranges[i].start >= page + XLAT_MAX_SOURCE_SIZE ||
+                ranges[i].end <= ranges[i].start || ranges[i].end > page + XLAT_MAX_SOURCE_SIZE + 2 ) {
+            return 0;
+        }
+    }
+
+    relocs = RECORD_RELOCS(rec);
+    for( i=0; i<rec->reloc_count; i++ ) {
+        if( relocs[i].offset + sizeof(void *) > rec->recover_table_offset ||
+                relocs[i].type < XLAT_RELOC_BLOCK || relocs[i].type > XLAT_RELOC_FASTMEM_USER ) {
+            return 0;
+        }
+        if( relocs[i].type == XLAT_RELOC_BLOCK &&
+                (relocs[i].value < -(int64_t)sizeof(struct xlat_cache_block) ||
+                 relocs[i].value >= rec->code_size) ) {
+            return 0;
+        }
+    }
+    return size;
+}
+
+/********************************* Interface **********************************/
+
+void sh4_translate_persist_block( sh4vma_t start, xlat_cache_block_t block, uint32_t code_size,
+                                  struct xlat_block_range *ranges, int range_count )
+{
+    struct xlat_persist_key key;
+    struct xlat_persist_record *rec;
+    struct xlat_persist_reloc *relocs;
+    uint32_t i;
+
+    if( xlat_persist_table == NULL || sh4_breakpoint_count != 0 ||
+            xlat_reloc_posn > MAX_RELOC_SIZE ) {
+        return;
+    }
+
+    pthread_mutex_lock( &xlat_persist_lock );
+    xlat_persist_init_key( &key, start, xlat_optimise );
+    if( xlat_persist_size + code_size > XLAT_PERSIST_MAX_SIZE ||
+            g_hash_table_lookup( xlat_persist_table, &key ) != NULL ) {
+        pthread_mutex_unlock( &xlat_persist_lock );
+        return;
+    }
+
+    rec = g_malloc( sizeof(struct xlat_persist_record) +
+            range_count*sizeof(struct xlat_block_range) +
+            xlat_reloc_posn*sizeof(struct xlat_persist_reloc) + code_size );
+    rec->key = key;
+    rec->code_size = code_size;
+    rec->recover_table_offset = block->recover_table_offset;
+    rec->recover_table_size = block->recover_table_size;
+    rec->range_count = range_count;
+    rec->reloc_count = xlat_reloc_posn;
+    memcpy( RECORD_RANGES(rec), ranges, range_count*sizeof(struct xlat_block_range) );
+    relocs = RECORD_RELOCS(rec);
+    for( i=0; i<rec->reloc_count; i++ ) {
+        relocs[i].offset = xlat_reloc[i];
+        if( !xlat_persist_classify_reloc( &relocs[i], start, block, code_size ) ) {
+            g_free( rec );
+            pthread_mutex_unlock( &xlat_persist_lock );
+            return;
+        }
+    }
+    memcpy( RECORD_CODE(rec), block->code, code_size );
+    rec->checksum = xlat_persist_checksum( ((unsigned char *)rec) + RECORD_CHECKSUM_START,
+            RECORD_SIZE(rec) - RECORD_CHECKSUM_START, 0x811C9DC5 );
+
+    g_hash_table_insert( xlat_persist_table, &rec->key, rec );
+    xlat_persist_size += RECORD_SIZE(rec);
+    xlat_persist_dirty = TRUE;
+    pthread_mutex_unlock( &xlat_persist_lock );
+}
+
+void *sh4_translate_load_persistent_block( sh4vma_t start, gboolean optimise )
+{
+    struct xlat_persist_key key;
+    struct xlat_persist_record *rec;
+    struct xlat_block_range *ranges;
+    struct xlat_persist_reloc *relocs;
+    uint32_t i;
+
+    if( xlat_persist_table == NULL || sh4_breakpoint_count != 0 ) {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &xlat_persist_lock );
+    /* Go straight to tier 2 if we can - it costs no more to load */
+    xlat_persist_init_key( &key, start, TRUE );
+    rec = g_hash_table_lookup( xlat_persist_table, &key );
+    if( rec == NULL && !optimise ) {
+        key.flags &= ~XLAT_PERSIST_OPTIMISED;
+        rec = g_hash_table_lookup( xlat_persist_table, &key );
+    }
+    if( rec == NULL ) {
+        pthread_mutex_unlock( &xlat_persist_lock );
+        return NULL;
+    }
+
+    xlat_current_block = xlat_start_block( key.ppa );
+    if( xlat_current_block->size < rec->code_size ) {
+        xlat_current_block = xlat_extend_block( rec->code_size );
+    }
+    memcpy( xlat_current_block->code, RECORD_CODE(rec), rec->code_size );
+    relocs = RECORD_RELOCS(rec);
+    for( i=0; i<rec->reloc_count; i++ ) {
+        *((uintptr_t *)(xlat_current_block->code + relocs[i].offset)) =
+            xlat_persist_resolve_reloc( &relocs[i], start, xlat_current_block->code );
+    }
+    xlat_current_block->recover_table_offset = rec->recover_table_offset;
+    xlat_current_block->recover_table_size = rec->recover_table_size;
+    xlat_current_block->xlat_sh4_mode = key.xlat_sh4_mode;
+    xlat_current_block->hot_count = (key.flags & XLAT_PERSIST_OPTIMISED) ? -1 : xlat_hot_threshold;
+
+    ranges = RECORD_RANGES(rec);
+    for( i=1; i<rec->range_count; i++ ) {
+        xlat_add_block_range( ranges[i].start, ranges[i].end );
+    }
+    xlat_commit_block( rec->code_size, ranges[0].start, ranges[0].end );
+    if( XLAT_PERF_ENABLED() ) {
+        sh4_translate_perf_load_block( start, xlat_current_block, ranges );
+    }
+    pthread_mutex_unlock( &xlat_persist_lock );
+    return xlat_current_block->code;
+}
+
+static void sh4_translate_load_persistent_cache( const char *filename )
+{
+    struct xlat_persist_header *header;
+    gchar *data;
+    gsize length, posn;
+    uint32_t i;
+
+    if( !g_file_get_contents( filename, &data, &length, NULL ) ) {
+        return; /* Nothing saved yet */
+    }
+    header = (struct xlat_persist_header *)data;
+    if( length < sizeof(struct xlat_persist_header) ||
+            strncmp( header->magic, XLAT_PERSIST_MAGIC, XLAT_PERSIST_MAGIC_SIZE ) != 0 ||
+            header->version != XLAT_PERSIST_VERSION ) {
+        WARN( "%s is not a valid translation cache, ignoring", filename );
+        g_free( data );
+        return;
+    }
+    if( header->build != xlat_persist_build_signature() ) {
+        INFO( "Translation cache %s is from a different build, ignoring", filename );
+        g_free( data );
+        xlat_persist_dirty = TRUE; /* Replace it */
+        return;
+    }
+
+    posn = sizeof(struct xlat_persist_header);
+    for( i=0; i<header->record_count; i++ ) {
+        struct xlat_persist_record *rec = (struct xlat_persist_record *)(data + posn);
+        size_t size = xlat_persist_validate_record( rec, length - posn );
+        if( size == 0 ) {
+            WARN( "Translation cache %s is corrupt after %d blocks", filename, i );
+            xlat_persist_dirty = TRUE;
+            break;
+        }
+        if( xlat_persist_size + size <= XLAT_PERSIST_MAX_SIZE &&
+                g_hash_table_lookup( xlat_persist_table, &rec->key ) == NULL ) {
+            rec = g_memdup( rec, size );
+            g_hash_table_insert( xlat_persist_table, &rec->key, rec );
+            xlat_persist_size += size;
+        }
+        posn += (size + 7) & (~7);
+    }
+    g_free( data );
+    INFO( "Loaded %d translated blocks from %s", g_hash_table_size(xlat_persist_table), filename );
+}
+
+/**
+ * Write the cache back to its file. Must be called with xlat_persist_lock held
+ */
+static void sh4_translate_write_persistent_cache( void )
+{
+    struct xlat_persist_header header;
+    static const char padding[8] = {0};
+    GHashTableIter iter;
+    gpointer rec;
+    gchar *tmpname;
+    FILE *f;
+    gboolean ok;
+
+    /* Write to a temporary file and rename it into place, so that a failed
+     * write doesn't lose the existing cache */
+    tmpname = g_strdup_printf( "%s.tmp", xlat_persist_filename );
+    f = fopen( tmpname, "w" );
+    if( f == NULL ) {
+        WARN( "Unable to write translation cache %s", tmpname );
+        g_free( tmpname );
+        return;
+    }
+    memset( &header, 0, sizeof(header) );
+    strcpy( header.magic, XLAT_PERSIST_MAGIC );
+    header.version = XLAT_PERSIST_VERSION;
+    header.build = xlat_persist_build_signature();
+    header.record_count = g_hash_table_size( xlat_persist_table );
+    ok = fwrite( &header, sizeof(header), 1, f ) == 1;
+
+    /* Records are padded to keep the relocations aligned */
+    g_hash_table_iter_init( &iter, xlat_persist_table );
+    while( ok && g_hash_table_iter_next( &iter, NULL, &rec ) ) {
+        size_t size = RECORD_SIZE((struct xlat_persist_record *)rec);
+        ok = fwrite( rec, size, 1, f ) == 1 &&
+            ((size&7) == 0 || fwrite( padding, 8 - (size&7), 1, f ) == 1);
+    }
+    if( fclose( f ) != 0 ) {
+        ok = FALSE;
+    }
+    if( ok && rename( tmpname, xlat_persist_filename ) == 0 ) {
+        INFO( "Saved %d translated blocks to %s", header.record_count, xlat_persist_filename );
+        xlat_persist_dirty = FALSE;
+    } else {
+        WARN( "Unable to write translation cache %s", xlat_persist_filename );
+        remove( tmpname );
+    }
+    g_free( tmpname );
+}
+
+void sh4_translate_save_persistent_cache( void )
+{
+    pthread_mutex_lock( &xlat_persist_lock );
+    if( xlat_persist_table != NULL && xlat_persist_dirty ) {
+        sh4_translate_write_persistent_cache();
+    }
+    pthread_mutex_unlock( &xlat_persist_lock );
+}
+
+gboolean sh4_translate_set_persistent_cache( const char *filename )
+{
+    pthread_mutex_lock( &xlat_persist_lock );
+    if( xlat_persist_table != NULL ) {
+        if( xlat_persist_dirty ) {
+            sh4_translate_write_persistent_cache();
+        }
+        g_hash_table_destroy( xlat_persist_table );
+        g_hash_table_destroy( xlat_persist_image_ptrs );
+        g_free( xlat_persist_filename );
+        xlat_persist_table = NULL;
+        xlat_persist_image_ptrs = NULL;
+        xlat_persist_filename = NULL;
+        xlat_persist_size = 0;
+        xlat_persist_dirty = FALSE;
+    }
+    if( filename != NULL ) {
+        if( !xlat_persist_init_image() ) {
+            WARN( "Translation cache is not supported on this platform" );
+            pthread_mutex_unlock( &xlat_persist_lock );
+            return FALSE;
+        }
+        xlat_persist_table = g_hash_table_new_full( xlat_persist_key_hash, xlat_persist_key_equal, NULL, g_free );
+        xlat_persist_image_ptrs = g_hash_table_new( g_direct_hash, g_direct_equal );
+        xlat_persist_filename = g_strdup( filename );
+        sh4_translate_load_persistent_cache( filename );
+    }
+    pthread_mutex_unlock( &xlat_persist_lock );
+    return TRUE;
+}
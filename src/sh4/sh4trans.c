@@ -17,16 +17,19 @@
  * GNU General Public License for more details.
  */
 #include <assert.h>
+#include <pthread.h>
 #include "eventq.h"
 #include "syscall.h"
 #include "clock.h"
 #include "dreamcast.h"
 #include "sh4/sh4core.h"
 #include "sh4/sh4trans.h"
+#include "sh4/sh4ir.h"
 #include "sh4/sh4mmio.h"
 #include "sh4/sh4dasm.h"
 #include "sh4/mmu.h"
 #include "xlat/xltcache.h"
+#include "xlat/xltperf.h"
 #include "xlat/xlatdasm.h"
 
 //#define SINGLESTEP 1
@@ -40,8 +43,10 @@ uint32_t sh4_translate_run_slice( uint32_t nanosecs )
     for(;;) {
         if( sh4r.event_pending <= sh4r.slice_cycle ) {
             sh4_handle_pending_events();
-            if( sh4r.slice_cycle >= nanosecs )
+            if( sh4r.slice_cycle >= nanosecs ) {
+                sh4_translate_publish_background();
                 return nanosecs;
+            }
         }
 
         if( IS_SYSCALL(sh4r.pc) ) {
@@ -60,6 +65,10 @@ uint32_t sh4_translate_run_slice( uint32_t nanosecs )
                     break;
                 }
             }
+            XLAT_BLOCK_MARK_USED(code);
+            if( XLAT_BLOCK_FOR_CODE(code)->hot_count == 0 ) {
+                code = sh4_translate_hot_block( code );
+            }
         } else {
             code = sh4_translate_basic_block( sh4r.pc );
         }
@@ -71,50 +80,559 @@ uint8_t *xlat_output;
 xlat_cache_block_t xlat_current_block;
 struct xlat_recovery_record xlat_recovery[MAX_RECOVERY_SIZE];
 uint32_t xlat_recovery_posn;
+uint32_t xlat_reloc[MAX_RELOC_SIZE];
+uint32_t xlat_reloc_posn;
+uint32_t xlat_fixup[MAX_FIXUP_SIZE];
+uint32_t xlat_fixup_posn;
+int32_t xlat_trace_icount_adjust;
+gboolean xlat_optimise = FALSE;
+uint32_t xlat_hot_threshold = DEFAULT_HOT_THRESHOLD;
+
+/**
+ * Trace state - the set of source ranges translated so far in the current
+ * block, and the pending continuation address (if any) requested by the 
+ * code generator.
+ */
+static gboolean xlat_trace_enabled = TRUE;
+static struct xlat_trace_segment {
+    sh4addr_t start;
+    sh4addr_t end; /* Only valid for closed segments */
+} xlat_trace_segments[MAX_TRACE_SEGMENTS];
+static int xlat_trace_segment_count;
+static sh4addr_t xlat_trace_block_start;
+static sh4addr_t xlat_trace_lastpc;
+static gboolean xlat_trace_pending;
+static sh4addr_t xlat_trace_endpc;
+static sh4addr_t xlat_trace_target;
+static int32_t xlat_trace_pending_adjust;
 
-void sh4_translate_add_recovery( uint32_t icount )
+void sh4_translate_set_trace( gboolean flag )
+{
+    xlat_trace_enabled = flag;
+}
+
+void sh4_translate_set_hot_threshold( uint32_t count )
+{
+    xlat_hot_threshold = count;
+}
+
+void sh4_translate_add_recovery( uint32_t icount, int32_t pc_offset )
 {
     xlat_recovery[xlat_recovery_posn].xlat_offset = 
         ((uintptr_t)xlat_output) - ((uintptr_t)xlat_current_block->code);
     xlat_recovery[xlat_recovery_posn].sh4_icount = icount;
+    xlat_recovery[xlat_recovery_posn].sh4_pc_offset = pc_offset;
     xlat_recovery_posn++;
 }
 
+void sh4_translate_add_reloc( void )
+{
+    /* Also called while generating the entry stub, outside of any block, and
+     * when unlinking other blocks in the middle of a translation */
+    if( xlat_current_block == NULL || xlat_output < xlat_current_block->code ||
+            xlat_output >= xlat_current_block->code + xlat_current_block->size ) {
+        return;
+    }
+    if( xlat_reloc_posn < MAX_RELOC_SIZE ) {
+        xlat_reloc[xlat_reloc_posn] = 
+            ((uintptr_t)xlat_output) - ((uintptr_t)xlat_current_block->code);
+    }
+    xlat_reloc_posn++;
+}
+
+void sh4_translate_add_fixup( uint32_t fixup )
+{
+    if( xlat_fixup_posn < MAX_FIXUP_SIZE ) {
+        xlat_fixup[xlat_fixup_posn] = fixup;
+    }
+    xlat_fixup_posn++;
+}
+
+/**
+ * @return TRUE if the given pc is the start of a range already translated
+ * in the current trace (other than the current one).
+ */
+static gboolean sh4_translate_trace_is_segment_start( sh4addr_t pc )
+{
+    int i;
+    for( i=0; i<xlat_trace_segment_count-1; i++ ) {
+        if( xlat_trace_segments[i].start == pc ) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+gboolean sh4_translate_trace_branch( sh4vma_t endpc, sh4vma_t target )
+{
+    int i;
+    struct xlat_trace_segment *current = &xlat_trace_segments[xlat_trace_segment_count-1];
+
+    if( !xlat_trace_enabled || !xlat_optimise || target >= xlat_trace_lastpc ||
+        target < XLAT_SOURCE_START(xlat_trace_block_start) || !XLAT_IS_IN_ICACHE(target) ) {
+        return FALSE;
+    }
+    if( target != endpc ) {
+        /* Don't revisit anything already in the trace (including the current
+         * range, which covers loops back to the block start) */
+        if( xlat_trace_segment_count == MAX_TRACE_SEGMENTS ||
+            (target >= current->start && target < endpc) ) {
+            return FALSE;
+        }
+        for( i=0; i<xlat_trace_segment_count-1; i++ ) {
+            if( target >= xlat_trace_segments[i].start && target < xlat_trace_segments[i].end ) {
+                return FALSE;
+            }
+        }
+        /* Instructions on the trace prior to target */
+        xlat_trace_pending_adjust = XLAT_TRACE_ICOUNT(xlat_trace_block_start, endpc) -
+            (((int32_t)(target - xlat_trace_block_start))>>1);
+    } else {
+        xlat_trace_pending_adjust = xlat_trace_icount_adjust;
+    }
+    xlat_trace_pending = TRUE;
+    xlat_trace_endpc = endpc;
+    xlat_trace_target = target;
+    return TRUE;
+}
+
+/**
+ * Continue the trace at the pending target address, following the completion
+ * of the branch instruction.
+ * @return the address of the next instruction to translate
+ */
+static sh4addr_t sh4_translate_trace_continue( )
+{
+    xlat_trace_pending = FALSE;
+    if( xlat_trace_target != xlat_trace_endpc ) {
+        xlat_trace_segments[xlat_trace_segment_count-1].end = xlat_trace_endpc;
+        xlat_trace_segments[xlat_trace_segment_count].start = xlat_trace_target;
+        xlat_trace_segment_count++;
+        xlat_trace_icount_adjust = xlat_trace_pending_adjust;
+    }
+    return xlat_trace_target;
+}
+
+static gboolean xlat_idle_skip_enabled = TRUE;
+
+void sh4_translate_set_idle_skip( gboolean flag )
+{
+    xlat_idle_skip_enabled = flag;
+}
+
+static gboolean xlat_idioms_enabled = TRUE;
+
+void sh4_translate_set_idioms( gboolean flag )
+{
+    xlat_idioms_enabled = flag;
+}
+
+uint32_t sh4_translate_get_config( void )
+{
+    return (sh4_cpu_period << 8) | (xlat_trace_enabled ? 0x01 : 0) |
+        (xlat_idle_skip_enabled ? 0x02 : 0) | (xlat_idioms_enabled ? 0x04 : 0) |
+        (sh4_translate_get_target_config() << 3);
+}
+
+/**
+ * Instructions that may appear in an idle loop: those which only read memory
+ * and write general registers or T (eg loads without address update, 
+ * register moves and ALU ops, compares), plus PC-relative branches. Loads
+ * must have a known address form so that the caller can check what they
+ * read.
+ */
+#define IDLE_WRITES (SH4_IR_REGS|SH4_IR_T)
+
+static gboolean sh4_translate_idle_instruction( sh4vma_t pc, struct sh4_ir_inst *inst )
+{
+    sh4_ir_decode( pc, *(uint16_t *)XLAT_ICACHE_PTR(pc), inst );
+    if( (inst->flags & (SH4_IR_JUMP|SH4_IR_STORE)) || (inst->writes & ~IDLE_WRITES) ) {
+        return FALSE;
+    }
+    if( inst->flags & SH4_IR_LOAD ) {
+        /* Memory faults are fine, they leave the loop */
+        return (inst->flags & SH4_IR_ADDR) != 0;
+    }
+    return (inst->flags & SH4_IR_EXCEPT) == 0;
+}
+
+/**
+ * A loop is idle if it consists solely of the above instructions, and no
+ * register value is carried from one iteration to the next (ie every register
+ * written in the loop is written before it's read). Each iteration then 
+ * repeats exactly until the memory being polled changes. 
+ *
+ * That only happens at an event if the memory is RAM, which depends on the
+ * load addresses. These must be computed from registers that aren't written
+ * in the loop (or from the PC), so they're the same on every iteration and
+ * can still be found in sh4r when the loop exits. PC-relative loads read 
+ * from the code's literal pool, which is never MMIO.
+ */
+gboolean sh4_translate_is_idle_loop( sh4vma_t endpc, struct sh4_ir_addr *loads, int *load_count )
+{
+    sh4vma_t pc;
+    struct sh4_ir_inst inst;
+    uint32_t live_in = 0, written = 0;
+    int count = 0;
+
+    if( !xlat_idle_skip_enabled || xlat_trace_segment_count != 1 ) {
+        return FALSE;
+    }
+    for( pc = xlat_trace_block_start; pc < endpc; pc += 2 ) {
+        if( !sh4_translate_idle_instruction( pc, &inst ) ) {
+            return FALSE;
+        }
+        if( (inst.flags & SH4_IR_LOAD) && (inst.addr.base|inst.addr.index) != 0 ) {
+            if( ((inst.addr.base|inst.addr.index) & written) != 0 || count == MAX_IDLE_LOADS ) {
+                return FALSE;
+            }
+            loads[count++] = inst.addr;
+        }
+        live_in |= (inst.reads & ~written);
+        written |= inst.writes;
+    }
+    *load_count = count;
+    return (live_in & written) == 0;
+}
+
+/**
+ * Look ahead along the straight-line path following pc for a write to all of
+ * regs that occurs before any of them is read. The path ends at anything that
+ * can leave the block (branches and exceptions, including memory accesses),
+ * since the SH4 state must be exact at that point, and at the end of the
+ * block.
+ */
+gboolean sh4_translate_is_dead( sh4vma_t pc, uint32_t regs )
+{
+#ifdef SINGLESTEP
+    return FALSE;
+#else
+    struct sh4_ir_inst inst;
+    int i;
+
+    if( !xlat_optimise ) {
+        return FALSE;
+    }
+    for( pc += 2; pc < xlat_trace_lastpc && !sh4_translate_trace_is_segment_start(pc); pc += 2 ) {
+        for( i=0; i<sh4_breakpoint_count; i++ ) {
+            if( sh4_breakpoints[i].address == pc ) {
+                return FALSE;
+            }
+        }
+        sh4_ir_decode( pc, *(uint16_t *)XLAT_ICACHE_PTR(pc), &inst );
+        if( (inst.reads & regs) || (inst.flags & (SH4_IR_BRANCH|SH4_IR_JUMP|SH4_IR_EXCEPT)) ) {
+            return FALSE;
+        }
+        regs &= ~inst.writes;
+        if( regs == 0 ) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+#endif
+}
+
+#define IDIOM_FETCH(pc) (*(uint16_t *)XLAT_ICACHE_PTR(pc))
+#define IDIOM_UDIV_LENGTH 130 /* DIV0U + 32 x (ROTCL; DIV1) */
+#define IDIOM_MAX_COPY_BODY 4 /* Instructions in a copy loop, other than the branch */
+#define IDIOM_MAX_MAC_COUNT 255
+
+/**
+ * DIV0U; 32 x (ROTCL Rq; DIV1 Rd, Rr), ie the unsigned division of Rr:Rq by
+ * Rd (leaving the quotient in Rq and the remainder in Rr, in the odd form
+ * produced by DIV1).
+ */
+static gboolean sh4_translate_match_udiv( sh4vma_t pc, sh4vma_t end, struct xlat_idiom *idiom )
+{
+    uint16_t rotcl, div1;
+    int rq, rr, rd, i;
+
+    if( end - pc < IDIOM_UDIV_LENGTH || IDIOM_FETCH(pc) != 0x0019 ) {
+        return FALSE;
+    }
+    rotcl = IDIOM_FETCH(pc+2);
+    div1 = IDIOM_FETCH(pc+4);
+    if( (rotcl & 0xF0FF) != 0x4024 || (div1 & 0xF00F) != 0x3004 ) {
+        return FALSE;
+    }
+    rq = (rotcl>>8)&0x0F;
+    rr = (div1>>8)&0x0F;
+    rd = (div1>>4)&0x0F;
+    if( rq == rr || rq == rd || rr == rd ) {
+        return FALSE;
+    }
+    for( i=1; i<32; i++ ) {
+        if( IDIOM_FETCH(pc+2+i*4) != rotcl || IDIOM_FETCH(pc+4+i*4) != div1 ) {
+            return FALSE;
+        }
+    }
+    idiom->type = XLAT_IDIOM_UDIV;
+    idiom->length = IDIOM_UDIV_LENGTH;
+    idiom->args = rq | (rr<<4) | (rd<<8);
+    idiom->writes = SH4_IR_REG(rq) | SH4_IR_REG(rr);
+    return TRUE;
+}
+
+/**
+ * A loop at pc of the form
+ *    [MOV.x @Rs+, Rv]; MOV.x Rv, @Rd; ADD #size, Rd; DT Rc; BF pc
+ * in any order that keeps the load before the store, and optionally with the
+ * last instruction in the delay slot of a BF/S instead. 
+ */
+static gboolean sh4_translate_match_copy( sh4vma_t pc, sh4vma_t end, struct xlat_idiom *idiom )
+{
+    uint16_t body[IDIOM_MAX_COPY_BODY+1], ir;
+    int count, i, load = -1, store = -1, add = -1, dt = -1;
+    int rd = -1, rs = 0, rv = -1, rc = -1, size = 0, load_size = 0;
+    int32_t imm = 0;
+    sh4vma_t branch;
+
+    for( count = 0; ; count++ ) {
+        branch = pc + count*2;
+        if( branch + 2 > end ) {
+            return FALSE;
+        }
+        ir = IDIOM_FETCH(branch);
+        if( (ir & 0xFB00) == 0x8B00 ) { /* BF or BF/S */
+            break;
+        } else if( count == IDIOM_MAX_COPY_BODY ) {
+            return FALSE;
+        }
+        body[count] = ir;
+    }
+    if( branch + 4 + ((int8_t)(ir&0xFF))*2 != pc ) {
+        return FALSE;
+    }
+    idiom->length = branch + 2 - pc;
+    if( ir & 0x0400 ) { /* BF/S - the delay slot runs last */
+        if( count == IDIOM_MAX_COPY_BODY || branch + 4 > end ) {
+            return FALSE;
+        }
+        body[count++] = IDIOM_FETCH(branch+2);
+        idiom->length += 2;
+    }
+
+    for( i=0; i<count; i++ ) {
+        ir = body[i];
+        if( (ir & 0xF00C) == 0x2000 && (ir & 0x03) != 0x03 && store == -1 ) {
+            store = i;
+            rd = (ir>>8)&0x0F;
+            rv = (ir>>4)&0x0F;
+            size = ir & 0x03;
+        } else if( (ir & 0xF00C) == 0x6004 && (ir & 0x03) != 0x03 && load == -1 ) {
+            load = i;
+            rs = (ir>>4)&0x0F;
+            load_size = ir & 0x03;
+        } else if( (ir & 0xF000) == 0x7000 && add == -1 ) {
+            add = i;
+            imm = (int8_t)(ir&0xFF);
+        } else if( (ir & 0xF0FF) == 0x4010 && dt == -1 ) {
+            dt = i;
+            rc = (ir>>8)&0x0F;
+        } else {
+            return FALSE;
+        }
+    }
+    /* DT can't be in the delay slot, as the branch must test its result */
+    if( store == -1 || add == -1 || dt == -1 || (dt == count-1 && (IDIOM_FETCH(branch) & 0x0400)) ||
+        ((body[add]>>8)&0x0F) != rd || imm != (1<<size) || rd == rv || rd == rc || rv == rc ) {
+        return FALSE;
+    }
+    if( load != -1 && (load > store || load_size != size || ((body[load]>>8)&0x0F) != rv ||
+                       rs == rd || rs == rv || rs == rc) ) {
+        return FALSE;
+    }
+
+    idiom->type = XLAT_IDIOM_COPY;
+    idiom->args = rd | (rs<<4) | (rv<<8) | (rc<<12) | (size<<16) |
+        (load != -1 ? IDIOM_COPY_LOAD : 0) | (add < store ? IDIOM_COPY_ADD_FIRST : 0) |
+        ((idiom->length>>1)<<24);
+    idiom->writes = SH4_IR_REG(rd) | SH4_IR_REG(rc) | (load != -1 ? SH4_IR_REG(rs)|SH4_IR_REG(rv) : 0);
+    return TRUE;
+}
+
+/**
+ * A run of identical MAC.W @Rm+, @Rn+ or MAC.L @Rm+, @Rn+ instructions
+ */
+static gboolean sh4_translate_match_mac( sh4vma_t pc, sh4vma_t end, struct xlat_idiom *idiom )
+{
+    uint16_t ir = IDIOM_FETCH(pc);
+    int rm = (ir>>4)&0x0F, rn = (ir>>8)&0x0F;
+    uint32_t count;
+
+    if( ((ir & 0xF00F) != 0x400F && (ir & 0xF00F) != 0x000F) || rm == rn ) {
+        return FALSE;
+    }
+    for( count = 1; count < IDIOM_MAX_MAC_COUNT && pc + count*2 + 2 <= end &&
+             IDIOM_FETCH(pc + count*2) == ir; count++ );
+    if( count < 2 ) {
+        return FALSE;
+    }
+    idiom->type = XLAT_IDIOM_MAC;
+    idiom->length = count*2;
+    idiom->args = rm | (rn<<4) | ((ir & 0x4000) ? (1<<16) : (2<<16)) | (count<<24);
+    idiom->writes = SH4_IR_REG(rm) | SH4_IR_REG(rn);
+    return TRUE;
+}
+
+/**
+ * Check for a known instruction sequence starting at pc, which can be
+ * translated as a single operation (tier 2 only). The sequence must lie 
+ * within the current trace segment, and can't contain a breakpoint. Copy
+ * loops and MAC runs are not matched at the start of the block, as they fall
+ * back to exiting the block to pc when the operation can't be done directly,
+ * and the block at pc must then translate them normally.
+ */
+static gboolean sh4_translate_match_idiom( sh4vma_t pc, struct xlat_idiom *idiom )
+{
+#ifdef SINGLESTEP
+    return FALSE;
+#else
+    sh4vma_t end = pc + IDIOM_UDIV_LENGTH, p;
+    int i;
+
+    if( !xlat_optimise || !xlat_idioms_enabled ) {
+        return FALSE;
+    }
+    if( end > xlat_trace_lastpc ) {
+        end = xlat_trace_lastpc;
+    }
+    for( p = pc+2; p < end; p += 2 ) {
+        if( sh4_translate_trace_is_segment_start(p) ) {
+            end = p;
+            break;
+        }
+    }
+    for( i=0; i<sh4_breakpoint_count; i++ ) {
+        if( sh4_breakpoints[i].address >= pc && sh4_breakpoints[i].address < end ) {
+            end = sh4_breakpoints[i].address;
+        }
+    }
+    if( end - pc < 4 ) {
+        return FALSE;
+    }
+    if( sh4_translate_match_udiv( pc, end, idiom ) ) {
+        return TRUE;
+    }
+    return pc != xlat_trace_block_start && 
+        (sh4_translate_match_copy( pc, end, idiom ) || sh4_translate_match_mac( pc, end, idiom ));
+#endif
+}
+
+/**
+ * A hot block queued for re-translation by the background thread. The source
+ * page is copied at the time of the request, and the result is only published
+ * if the copy still matches the SH4 memory (and no blocks have been flushed in
+ * the meantime).
+ */
+struct xlat_bg_request {
+    unsigned char page[XLAT_MAX_SOURCE_SIZE]; /* Private copy of the source window */
+    sh4vma_t pc;
+    struct xlat_source source; /* Refers to page, rather than SH4 memory */
+    sh4ptr_t live_page;        /* The source page in SH4 memory */
+    uint32_t generation;
+    /* Result, filled in by the background thread */
+    void *code;                /* NULL if the arena was full */
+    int range_count;
+    struct xlat_block_range ranges[MAX_TRACE_SEGMENTS];
+};
+
+#define XLAT_BG_QUEUE_LENGTH 16
+#define XLAT_BG_QUEUED_HOT_COUNT 0x7FFFFFFF /* Larger than any threshold */
+
+struct xlat_source xlat_source;
+
+/* Held while translating a block (in either thread), as the translator state
+ * and cache allocation aren't otherwise thread-safe */
+static pthread_mutex_t xlat_translate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Background request queue. Requests [head,work) have been translated and are
+ * waiting to be published, and [work,tail) are waiting to be translated. The 
+ * emulation thread owns head and tail, the background thread owns work. */
+static pthread_mutex_t xlat_bg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t xlat_bg_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t xlat_bg_thread;
+static gboolean xlat_bg_running = FALSE;
+static gboolean xlat_bg_arena_full = FALSE;
+static struct xlat_bg_request xlat_bg_queue[XLAT_BG_QUEUE_LENGTH];
+static unsigned xlat_bg_head = 0, xlat_bg_work = 0, xlat_bg_tail = 0;
+
+static void sh4_translate_capture_source( struct xlat_source *source )
+{
+    source->icache = sh4_icache;
+    source->live_page = sh4_icache.page;
+    source->xlat_sh4_mode = sh4r.xlat_sh4_mode;
+    source->fpscr = sh4r.fpscr;
+    source->tlb_on = IS_TLB_ENABLED() ? TRUE : FALSE;
+}
+
 /**
  * Translate a linear basic block, ie all instructions from the start address
- * (inclusive) until the next branch/jump instruction or the end of the page
- * is reached.
- * @param start VMA of the block start (which must already be in the icache)
- * @return the address of the translated block
- * eg due to lack of buffer space.
+ * (inclusive) until the next branch/jump instruction or the end of the source
+ * window (which may extend into the following page, see XLAT_SOURCE_SIZE) is
+ * reached. If traces are enabled, the block may continue past branches within
+ * the window (see sh4_translate_trace_branch).
+ *
+ * Must be called with xlat_translate_lock held, and xlat_source set up.
+ * @param start VMA of the block start (which must be in xlat_source.icache)
+ * @param optimise TRUE to translate with full optimisation (tier 2)
+ * @param bg the background request to translate into the arena, or NULL to
+ *    translate into the new cache and add it to the LUT.
+ * @return the address of the translated block, or NULL if there was 
+ * insufficient space in the arena (background translation only).
  */
-void * sh4_translate_basic_block( sh4addr_t start )
+static void *sh4_translate_block( sh4addr_t start, gboolean optimise, struct xlat_bg_request *bg )
 {
     sh4addr_t pc = start;
-    sh4addr_t lastpc = (pc&0xFFFFF000)+0x1000;
-    int done;
-    xlat_current_block = xlat_start_block( GET_ICACHE_PHYS(start) );
+    sh4addr_t lastpc = XLAT_SOURCE_START(pc) + XLAT_SOURCE_SIZE(pc);
+    struct xlat_block_range ranges[MAX_TRACE_SEGMENTS];
+    struct xlat_idiom idiom;
+    int done, i;
+    if( bg == NULL ) {
+        xlat_current_block = xlat_start_block( XLAT_ICACHE_PHYS(start) );
+    } else if( (xlat_current_block = xlat_start_arena_block( XLAT_ICACHE_PHYS(start) )) == NULL ) {
+        return NULL;
+    }
     xlat_output = (uint8_t *)xlat_current_block->code;
     xlat_recovery_posn = 0;
+    xlat_reloc_posn = 0;
+    xlat_fixup_posn = 0;
+    xlat_optimise = optimise;
     uint8_t *eob = xlat_output + xlat_current_block->size;
 
-    if( GET_ICACHE_END() < lastpc ) {
-        lastpc = GET_ICACHE_END();
-    }
+    xlat_trace_block_start = start;
+    xlat_trace_lastpc = lastpc;
+    xlat_trace_segments[0].start = start;
+    xlat_trace_segment_count = 1;
+    xlat_trace_icount_adjust = 0;
+    xlat_trace_pending = FALSE;
 
     sh4_translate_begin_block(pc);
 
     do {
         if( eob - xlat_output < MAX_INSTRUCTION_SIZE ) {
+            if( bg != NULL ) {
+                /* Arena blocks already have all the remaining space */
+                return NULL;
+            }
             uint8_t *oldstart = xlat_current_block->code;
             xlat_current_block = xlat_extend_block( xlat_output - oldstart + MAX_INSTRUCTION_SIZE );
             xlat_output = xlat_current_block->code + (xlat_output - oldstart);
             eob = xlat_current_block->code + xlat_current_block->size;
         }
-        done = sh4_translate_instruction( pc ); 
+        if( sh4_translate_match_idiom( pc, &idiom ) ) {
+            sh4_translate_idiom( pc, &idiom );
+            pc += idiom.length;
+            done = 0;
+        } else {
+            done = sh4_translate_instruction( pc ); 
+            pc += 2;
+        }
         assert( xlat_output <= eob );
-        pc += 2;
-        if ( pc >= lastpc && done == 0 ) {
+        if( xlat_trace_pending ) {
+            pc = sh4_translate_trace_continue();
+        }
+        if ( (pc >= lastpc || sh4_translate_trace_is_segment_start(pc)) && done == 0 ) {
             done = 2;
         }
 #ifdef SINGLESTEP
@@ -124,28 +642,306 @@ void * sh4_translate_basic_block( sh4addr_t start )
     pc += (done - 2);
 
     // Add end-of-block recovery for post-instruction checks
-    sh4_translate_add_recovery( (pc - start)>>1 ); 
+    sh4_translate_add_recovery( XLAT_TRACE_ICOUNT(start, pc), pc - start ); 
 
     int epilogue_size = sh4_translate_end_block_size();
     uint32_t recovery_size = sizeof(struct xlat_recovery_record)*xlat_recovery_posn;
-    uint32_t finalsize = (xlat_output - xlat_current_block->code) + epilogue_size + recovery_size;
+    /* The epilogue may add one more link fixup, plus the fixup count itself */
+    uint32_t fixup_size = sizeof(uint32_t)*((xlat_fixup_posn < MAX_FIXUP_SIZE ? xlat_fixup_posn : MAX_FIXUP_SIZE) + 2);
+    uint32_t finalsize = (xlat_output - xlat_current_block->code) + epilogue_size + 
+        recovery_size + fixup_size;
     if( xlat_current_block->size < finalsize ) {
+        if( bg != NULL ) {
+            return NULL;
+        }
         uint8_t *oldstart = xlat_current_block->code;
         xlat_current_block = xlat_extend_block( finalsize );
         xlat_output = xlat_current_block->code + (xlat_output - oldstart);
     }	
     sh4_translate_end_block(pc);
-    assert( xlat_output <= (xlat_current_block->code + xlat_current_block->size - recovery_size) );
+    assert( xlat_output <= (xlat_current_block->code + xlat_current_block->size - recovery_size - fixup_size) );
 
-    /* Write the recovery records onto the end of the code block */
+    /* Write the recovery records and fixups onto the end of the code block */
     memcpy( xlat_output, xlat_recovery, recovery_size);
     xlat_current_block->recover_table_offset = xlat_output - (uint8_t *)xlat_current_block->code;
     xlat_current_block->recover_table_size = xlat_recovery_posn;
-    xlat_current_block->xlat_sh4_mode = sh4r.xlat_sh4_mode;
-    xlat_commit_block( finalsize, start, pc );
+    uint32_t *fixups = XLAT_FIXUP_TABLE(xlat_current_block);
+    if( xlat_fixup_posn > MAX_FIXUP_SIZE ) {
+        fixups[0] = XLAT_FIXUP_OVERFLOW;
+    } else {
+        assert( sizeof(uint32_t)*(xlat_fixup_posn+1) <= fixup_size );
+        fixups[0] = xlat_fixup_posn;
+        memcpy( &fixups[1], xlat_fixup, sizeof(uint32_t)*xlat_fixup_posn );
+    }
+    xlat_current_block->xlat_sh4_mode = xlat_source.xlat_sh4_mode;
+    xlat_current_block->hot_count = xlat_optimise ? -1 : xlat_hot_threshold;
+
+    /* Collect the ranges covered by the trace */
+    xlat_trace_segments[xlat_trace_segment_count-1].end = pc;
+    for( i=0; i<xlat_trace_segment_count; i++ ) {
+        ranges[i].start = XLAT_ICACHE_PHYS(xlat_trace_segments[i].start);
+        ranges[i].end = XLAT_ICACHE_PHYS(xlat_trace_segments[i].end);
+    }
+
+    if( bg != NULL ) {
+        xlat_commit_arena_block( xlat_current_block, finalsize );
+        memcpy( bg->ranges, ranges, sizeof(struct xlat_block_range)*xlat_trace_segment_count );
+        bg->range_count = xlat_trace_segment_count;
+    } else {
+        for( i=1; i<xlat_trace_segment_count; i++ ) {
+            xlat_add_block_range( ranges[i].start, ranges[i].end );
+        }
+        xlat_commit_block( finalsize, ranges[0].start, ranges[0].end );
+        if( XLAT_PERF_ENABLED() ) {
+            sh4_translate_perf_load_block( start, xlat_current_block, ranges );
+        }
+    }
+    sh4_translate_persist_block( start, xlat_current_block, finalsize, ranges, xlat_trace_segment_count );
     return xlat_current_block->code;
 }
 
+void sh4_translate_perf_load_block( sh4vma_t start, xlat_cache_block_t block, 
+                                    const struct xlat_block_range *ranges )
+{
+    char name[128];
+    uint32_t offset;
+    sh4vma_t end = start + (ranges[0].end - ranges[0].start);
+    const char *sym = sh4_disasm_find_symbol( start, &offset );
+    int len = snprintf( name, sizeof(name), "sh4:%08X-%08X", start, end );
+    if( sym != NULL ) {
+        if( offset == 0 ) {
+            snprintf( name+len, sizeof(name)-len, " %s", sym );
+        } else {
+            snprintf( name+len, sizeof(name)-len, " %s+0x%x", sym, offset );
+        }
+    }
+    xlat_perf_load_block( block, name );
+}
+
+/**
+ * Translate a block on the emulation thread, from the current icache page and
+ * SH4 mode.
+ */
+static void *sh4_translate_foreground( sh4addr_t start, gboolean optimise )
+{
+    void *code;
+    pthread_mutex_lock( &xlat_translate_lock );
+    sh4_translate_capture_source( &xlat_source );
+    code = sh4_translate_load_persistent_block( start, optimise );
+    if( code == NULL ) {
+        code = sh4_translate_block( start, optimise, NULL );
+    }
+    pthread_mutex_unlock( &xlat_translate_lock );
+    return code;
+}
+
+void * sh4_translate_basic_block( sh4addr_t start )
+{
+    return sh4_translate_foreground( start, xlat_hot_threshold == 0 );
+}
+
+/**
+ * Delete any blocks made unreachable by the given (new) block, ie blocks 
+ * with the same mode that follow it in the LUT chain.
+ */
+static void sh4_translate_delete_shadowed( void *code )
+{
+    uint32_t mode = XLAT_BLOCK_MODE(code);
+    void *p = XLAT_BLOCK_CHAIN(code);
+    while( p != NULL ) {
+        void *next = XLAT_BLOCK_CHAIN(p);
+        if( XLAT_BLOCK_MODE(p) == mode ) {
+            xlat_delete_block( XLAT_BLOCK_FOR_CODE(p) );
+        }
+        p = next;
+    }
+}
+
+/**
+ * Queue a background re-translation of the block at the current pc 
+ * @return FALSE if the queue is full.
+ */
+static gboolean sh4_translate_bg_request( sh4vma_t pc )
+{
+    struct xlat_bg_request *req = &xlat_bg_queue[xlat_bg_tail];
+    unsigned next = (xlat_bg_tail + 1) % XLAT_BG_QUEUE_LENGTH;
+    sh4vma_t start;
+    uint32_t size;
+
+    if( next == xlat_bg_head ) {
+        return FALSE;
+    }
+    /* The translator only looks at the source window of the block, so that's
+     * all that needs to be copied. The size is always a power of 2 */
+    req->pc = pc;
+    sh4_translate_capture_source( &req->source );
+    start = xlat_source_start( &sh4_icache, pc );
+    size = xlat_source_size( &sh4_icache, pc );
+    req->source.icache.page_vma = start;
+    req->source.icache.page_ppa = GET_ICACHE_PHYS(start);
+    req->source.icache.page = req->page;
+    req->source.icache.mask = ~(size-1);
+    req->live_page = GET_ICACHE_PTR(start);
+    req->source.live_page = req->live_page;
+    memcpy( req->page, req->live_page, size );
+    req->generation = xlat_get_generation();
+    /* Every LUT entry the translation refers to is in the source window */
+    xlat_alloc_lut_range( req->source.icache.page_ppa, size );
+
+    pthread_mutex_lock( &xlat_bg_lock );
+    xlat_bg_tail = next;
+    pthread_cond_signal( &xlat_bg_cond );
+    pthread_mutex_unlock( &xlat_bg_lock );
+    return TRUE;
+}
+
+void *sh4_translate_hot_block( void *code )
+{
+    if( xlat_bg_running ) {
+        /* Keep running the tier 1 block until the new one is published */
+        if( sh4_translate_bg_request( sh4r.pc ) ) {
+            XLAT_BLOCK_FOR_CODE(code)->hot_count = XLAT_BG_QUEUED_HOT_COUNT;
+        } else {
+            XLAT_BLOCK_FOR_CODE(code)->hot_count = xlat_hot_threshold;
+        }
+        return code;
+    }
+
+    code = sh4_translate_foreground( sh4r.pc, TRUE );
+    sh4_translate_delete_shadowed( code );
+    return code;
+}
+
+static void *sh4_translate_bg_run( void *arg )
+{
+    pthread_mutex_lock( &xlat_bg_lock );
+    while( xlat_bg_running ) {
+        if( xlat_bg_work == xlat_bg_tail ) {
+            pthread_cond_wait( &xlat_bg_cond, &xlat_bg_lock );
+        } else {
+            struct xlat_bg_request *req = &xlat_bg_queue[xlat_bg_work];
+            pthread_mutex_unlock( &xlat_bg_lock );
+
+            pthread_mutex_lock( &xlat_translate_lock );
+            xlat_source = req->source;
+            req->code = sh4_translate_block( req->pc, TRUE, req );
+            pthread_mutex_unlock( &xlat_translate_lock );
+
+            pthread_mutex_lock( &xlat_bg_lock );
+            xlat_bg_work = (xlat_bg_work + 1) % XLAT_BG_QUEUE_LENGTH;
+        }
+    }
+    pthread_mutex_unlock( &xlat_bg_lock );
+    return NULL;
+}
+
+/**
+ * @return TRUE if the source ranges of the translation are unchanged in SH4 
+ * memory since the request was made.
+ */
+static gboolean sh4_translate_bg_source_unchanged( struct xlat_bg_request *req )
+{
+    int i;
+    for( i=0; i<req->range_count; i++ ) {
+        uint32_t offset = req->ranges[i].start - req->source.icache.page_ppa;
+        if( memcmp( req->live_page + offset, req->page + offset, 
+                req->ranges[i].end - req->ranges[i].start ) != 0 ) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Allow the tier 1 block for a request that failed to be re-queued once it
+ * has run another xlat_hot_threshold times.
+ */
+static void sh4_translate_bg_rearm( struct xlat_bg_request *req )
+{
+    void *code = xlat_get_code( req->source.icache.page_ppa + (req->pc - req->source.icache.page_vma) );
+    while( code != NULL ) {
+        xlat_cache_block_t block = XLAT_BLOCK_FOR_CODE(code);
+        if( block->xlat_sh4_mode == req->source.xlat_sh4_mode ) {
+            if( block->hot_count > (int32_t)xlat_hot_threshold ) {
+                block->hot_count = xlat_hot_threshold;
+            }
+            break;
+        }
+        code = block->chain;
+    }
+}
+
+void sh4_translate_publish_background( void )
+{
+    unsigned done;
+    int i;
+
+    if( xlat_bg_head == xlat_bg_tail && !xlat_bg_arena_full ) {
+        return;
+    }
+    if( pthread_mutex_trylock( &xlat_translate_lock ) != 0 ) {
+        return; /* Background thread is busy - try again next time */
+    }
+    pthread_mutex_lock( &xlat_bg_lock );
+    done = xlat_bg_work;
+    pthread_mutex_unlock( &xlat_bg_lock );
+
+    for( ; xlat_bg_head != done; xlat_bg_head = (xlat_bg_head + 1) % XLAT_BG_QUEUE_LENGTH ) {
+        struct xlat_bg_request *req = &xlat_bg_queue[xlat_bg_head];
+        if( req->code == NULL ) {
+            xlat_bg_arena_full = TRUE;
+            sh4_translate_bg_rearm( req );
+        } else if( req->generation != xlat_get_generation() || 
+                !sh4_translate_bg_source_unchanged( req ) ) {
+            sh4_translate_bg_rearm( req );
+        } else {
+            xlat_publish_block( XLAT_BLOCK_FOR_CODE(req->code), req->ranges[0].start, req->ranges[0].end );
+            if( XLAT_PERF_ENABLED() ) {
+                sh4_translate_perf_load_block( req->pc, XLAT_BLOCK_FOR_CODE(req->code), req->ranges );
+            }
+            for( i=1; i<req->range_count; i++ ) {
+                xlat_add_block_range( req->ranges[i].start, req->ranges[i].end );
+            }
+            sh4_translate_delete_shadowed( req->code );
+        }
+    }
+
+    /* With everything translated so far published, and the lock held, nothing
+     * else can be in the arena */
+    if( xlat_bg_arena_full ) {
+        xlat_reset_arena();
+        xlat_bg_arena_full = FALSE;
+    }
+    pthread_mutex_unlock( &xlat_translate_lock );
+}
+
+void sh4_translate_set_background( gboolean flag )
+{
+    if( flag == xlat_bg_running ) {
+        return;
+    }
+    if( flag ) {
+        xlat_bg_running = TRUE;
+        if( pthread_create( &xlat_bg_thread, NULL, sh4_translate_bg_run, NULL ) != 0 ) {
+            WARN( "Unable to start background translation thread" );
+            xlat_bg_running = FALSE;
+        }
+    } else {
+        pthread_mutex_lock( &xlat_bg_lock );
+        xlat_bg_running = FALSE;
+        pthread_cond_signal( &xlat_bg_cond );
+        pthread_mutex_unlock( &xlat_bg_lock );
+        pthread_join( xlat_bg_thread, NULL );
+
+        /* Publish anything that's already been translated, and drop the rest */
+        sh4_translate_publish_background();
+        for( ; xlat_bg_work != xlat_bg_tail; xlat_bg_work = (xlat_bg_work + 1) % XLAT_BG_QUEUE_LENGTH ) {
+            sh4_translate_bg_rearm( &xlat_bg_queue[xlat_bg_work] );
+        }
+        xlat_bg_head = xlat_bg_tail;
+    }
+}
+
 /**
  * "Execute" the supplied recovery record. Currently this only updates
  * sh4r.pc and sh4r.slice_cycle according to the currently executing
@@ -155,7 +951,7 @@ void * sh4_translate_basic_block( sh4addr_t start )
 void sh4_translate_run_recovery( xlat_recovery_record_t recovery )
 {
     sh4r.slice_cycle += (recovery->sh4_icount * sh4_cpu_period);
-    sh4r.pc += (recovery->sh4_icount<<1);
+    sh4r.pc += recovery->sh4_pc_offset;
 }
 
 /**
@@ -165,7 +961,7 @@ void sh4_translate_run_recovery( xlat_recovery_record_t recovery )
 void sh4_translate_run_exception_recovery( xlat_recovery_record_t recovery )
 {
     sh4r.slice_cycle += (recovery->sh4_icount * sh4_cpu_period);
-    sh4r.spc += (recovery->sh4_icount<<1);
+    sh4r.spc += recovery->sh4_pc_offset;
 }    
 
 void sh4_translate_exit_recover( )
@@ -239,6 +1035,24 @@ void * FASTCALL xlat_get_code_by_vma( sh4vma_t vma )
     return result;
 }
 
+void * FASTCALL sh4_translate_target_miss( sh4vma_t vma, uint32_t xlat_sh4_mode )
+{
+    void *code = xlat_get_code_by_vma( vma );
+    if( code == NULL || !IS_IN_ICACHE(vma) ) {
+        /* No code, or the lookup faulted (in which case the mode may have
+         * changed as well) - leave it to the main loop */
+        return NULL;
+    }
+    while( code != NULL && XLAT_BLOCK_MODE(code) != xlat_sh4_mode ) {
+        code = XLAT_BLOCK_CHAIN(code);
+    }
+    if( code != NULL ) {
+        XLAT_BLOCK_MARK_USED(code);
+        xlat_target_cache_insert( vma, xlat_sh4_mode, sh4r.xlat_context, code );
+    }
+    return code;
+}
+
 /**
  * Crashdump translation information.
  *
@@ -324,6 +1138,9 @@ static struct xlat_symbol xlat_symbol_table[] = {
     { "sh4_switch_fr_banks", sh4_switch_fr_banks },
     { "sh4_execute_instruction", sh4_execute_instruction },
     { "signsat48", signsat48 },
+    { "sh4_idiom_udiv", sh4_idiom_udiv },
+    { "sh4_idiom_copy", sh4_idiom_copy },
+    { "sh4_idiom_mac", sh4_idiom_mac },
     { "xlat_get_code_by_vma", xlat_get_code_by_vma },
     { "xlat_get_code", xlat_get_code }
 };
@@ -354,8 +1171,8 @@ void sh4_translate_disasm_block( FILE *out, void *code, sh4addr_t source_start,
         if( source_recov_table < source_recov_end &&
             target_pc >= (target_start + source_recov_table->xlat_offset) ) {
             source_recov_table++;
-            if( source_end < (source_start + (source_recov_table->sh4_icount)*2) )
-                source_end = source_start + (source_recov_table->sh4_icount)*2;
+            if( source_end < (source_start + source_recov_table->sh4_pc_offset) )
+                source_end = source_start + source_recov_table->sh4_pc_offset;
         }
 
         if( source_pc < source_end ) {
@@ -394,8 +1211,27 @@ void sh4_translate_disasm_block( FILE *out, void *code, sh4addr_t source_start,
 void sh4_translate_dump_cache_by_activity( unsigned int topN )
 {
     struct xlat_block_ref blocks[topN];
+    uint64_t target_hits, target_misses;
+    uint32_t return_hits, return_misses;
+    struct xlat_cache_stats cache_stats;
     topN = xlat_get_cache_blocks_by_activity(blocks, topN);
     unsigned int i;
+    xlat_get_target_cache_stats( &target_hits, &target_misses );
+    fprintf( stderr, "Indirect branch target cache: %llu hits, %llu misses\n",
+            (unsigned long long)target_hits, (unsigned long long)target_misses );
+    sh4_translate_get_return_stack_stats( &return_hits, &return_misses );
+    fprintf( stderr, "Return stack: %u hits, %u misses\n", return_hits, return_misses );
+    xlat_get_cache_stats( &cache_stats );
+    fprintf( stderr, "Translation cache: %u blocks (%llu bytes) new, %u (%llu) temp, %u (%llu) old\n",
+            cache_stats.live_blocks[XLAT_SPACE_NEW], (unsigned long long)cache_stats.live_bytes[XLAT_SPACE_NEW],
+            cache_stats.live_blocks[XLAT_SPACE_TEMP], (unsigned long long)cache_stats.live_bytes[XLAT_SPACE_TEMP],
+            cache_stats.live_blocks[XLAT_SPACE_OLD], (unsigned long long)cache_stats.live_bytes[XLAT_SPACE_OLD] );
+    fprintf( stderr, "    %llu promotions to temp, %llu to old, %llu evictions, %llu flushes\n",
+            (unsigned long long)cache_stats.temp_promotions, (unsigned long long)cache_stats.old_promotions,
+            (unsigned long long)cache_stats.evictions, (unsigned long long)cache_stats.flushes );
+    fprintf( stderr, "    new space %u bytes (grown %llu times), %llu used blocks kept\n",
+            cache_stats.new_space_size, (unsigned long long)cache_stats.grows,
+            (unsigned long long)cache_stats.aged );
     for( i=0; i<topN; i++ ) {
         fprintf( stderr, "0x%08X (%p): %d \n", blocks[i].pc, blocks[i].block->code, blocks[i].block->active);
         sh4_translate_disasm_block( stderr, blocks[i].block->code, blocks[i].pc, NULL );
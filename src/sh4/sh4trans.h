@@ -22,6 +22,8 @@
 #include "xlat/xltcache.h"
 #include "dream.h"
 #include "mem.h"
+#include "sh4/sh4core.h"
+#include "sh4/sh4ir.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,10 +38,25 @@ extern "C" {
  */
 #define EPILOGUE_SIZE 139
 
-/** Maximum number of recovery records for a translated block (2048 based on
- * 1 record per SH4 instruction in a 4K page).
+/** Maximum number of recovery records for a translated block (8192 based on
+ * 1 record per SH4 instruction in XLAT_MAX_SOURCE_SIZE, plus up to 1 extra
+ * record per instruction for trace side-exits).
  */
-#define MAX_RECOVERY_SIZE 2049
+#define MAX_RECOVERY_SIZE 8193
+
+/** Maximum number of discontiguous source ranges in a single trace */
+#define MAX_TRACE_SEGMENTS 16
+
+/** Default number of executions before a block is re-translated at tier 2 */
+#define DEFAULT_HOT_THRESHOLD 256
+
+/** Maximum number of absolute pointers in a translated block that can be
+ * relocated by the persistent cache (blocks with more are not saved) */
+#define MAX_RELOC_SIZE 4096
+
+/** Maximum number of fixups (see XLAT_FIXUP_TABLE) in a translated block.
+ * Every fixup is also a reloc, so this can't usefully exceed MAX_RELOC_SIZE */
+#define MAX_FIXUP_SIZE 4096
 
 typedef void (*xlat_block_begin_callback_t)();
 typedef void (*xlat_block_end_callback_t)();
@@ -62,9 +79,191 @@ void *sh4_translate_basic_block( sh4addr_t start );
 
 /**
  * Add a recovery record for the current code generation position, with the
- * specified instruction count
+ * specified instruction count and SH4 pc (as a byte offset from the start of
+ * the block). Outside of traces, pc_offset == icount*2.
+ */
+void sh4_translate_add_recovery( uint32_t icount, int32_t pc_offset );
+
+/**
+ * Record that the code generator is about to emit an absolute pointer at the
+ * current code generation position, so that the block can be relocated when
+ * it's loaded from the persistent cache.
+ */
+void sh4_translate_add_reloc( void );
+
+/**
+ * Record a location in the current block that needs to be updated if the 
+ * block is moved: either the offset of an absolute pointer into the block, or
+ * the offset of a block-linking branch flagged with XLAT_FIXUP_LINK.
+ */
+void sh4_translate_add_fixup( uint32_t fixup );
+
+/**
+ * Called by the code generator when translating a branch, to request that
+ * translation continue at the given target address (within the same block)
+ * rather than ending the block. The target is only accepted if traces are
+ * enabled, it lies within the current page, and it hasn't already been
+ * translated in this block. Translation resumes at target once the current
+ * instruction (including any delay slot) has been completed.
+ * @param endpc address of the instruction following the branch (and its 
+ *    delay slot, if any)
+ * @param target address to continue translation from.
+ * @return TRUE if the trace will continue at target, otherwise FALSE (in which
+ * case the caller must end the block as usual).
+ */
+gboolean sh4_translate_trace_branch( sh4vma_t endpc, sh4vma_t target );
+
+/**
+ * Enable/disable trace formation (following branches within a page when 
+ * translating a block)
+ */
+void sh4_translate_set_trace( gboolean flag );
+
+/** Maximum number of distinct loads in a loop that can be skipped as idle */
+#define MAX_IDLE_LOADS 4
+
+/**
+ * Called by the code generator for a branch back to the start of the block,
+ * to determine if the block is an idle loop, ie one which can't change any
+ * state other than by reading memory. Such a loop can be skipped forward to
+ * the next scheduled event, but only if everything it reads is plain RAM:
+ * MMIO registers may be time-derived (eg TMU counters, display status) or
+ * have side effects on read (eg FIFOs). The loop's load addresses are 
+ * returned so that the caller can check that at run time.
+ * @param endpc address of the instruction following the branch (and its 
+ *    delay slot, if any)
+ * @param loads filled with the address of each load in the loop, at most
+ *    MAX_IDLE_LOADS. The registers involved are loop invariant.
+ * @param load_count set to the number of entries in loads
+ */
+gboolean sh4_translate_is_idle_loop( sh4vma_t endpc, struct sh4_ir_addr *loads, int *load_count );
+
+/**
+ * Called by the code generator to determine if the value written to the
+ * given registers (SH4_IR_* pseudo-registers) by the instruction at pc is
+ * dead, ie is overwritten before it's read, or could be observed. Always
+ * FALSE unless translating with full optimisation.
+ */
+gboolean sh4_translate_is_dead( sh4vma_t pc, uint32_t regs );
+
+/**
+ * Enable/disable idle loop detection
  */
-void sh4_translate_add_recovery( uint32_t icount );
+void sh4_translate_set_idle_skip( gboolean flag );
+
+/**
+ * Enable/disable recognition of common instruction sequences (see 
+ * sh4_translate_match_idiom), which are then translated as a single operation.
+ * Only applies to fully optimised blocks.
+ */
+void sh4_translate_set_idioms( gboolean flag );
+
+#define XLAT_IDIOM_UDIV 1 /* DIV0U; 32 x (ROTCL Rq; DIV1 Rd, Rr) */
+#define XLAT_IDIOM_COPY 2 /* Copy/fill loop ending in DT Rc; BF */
+#define XLAT_IDIOM_MAC  3 /* Run of identical MAC.W/MAC.L */
+
+/**
+ * A recognised instruction sequence, starting at the current pc
+ */
+struct xlat_idiom {
+    int type;         /* XLAT_IDIOM_* */
+    uint32_t length;  /* Bytes of SH4 code covered */
+    uint32_t args;    /* Operands, in the form expected by sh4_idiom_* */
+    uint32_t writes;  /* General registers written (as SH4_IR_REG bits) */
+};
+
+/**
+ * Set the number of executions after which a block is re-translated with the
+ * full set of optimisations (register caching and trace formation). Blocks
+ * are initially translated without them, which keeps the translation of code
+ * that only runs a few times cheap. 0 disables tiering, ie all blocks are
+ * fully optimised on first translation.
+ */
+void sh4_translate_set_hot_threshold( uint32_t count );
+
+/**
+ * Re-translate the (tier 1) block at the current pc with full optimisation,
+ * replacing it in the cache.
+ * @param code the tier 1 block, whose hot_count has just reached 0
+ * @return the new block
+ */
+void *sh4_translate_hot_block( void *code );
+
+/**
+ * Enable/disable background translation. When enabled, hot blocks are
+ * re-translated by a worker thread rather than on the emulation thread, and
+ * the results are published at the end of the timeslice in which they 
+ * complete.
+ */
+void sh4_translate_set_background( gboolean flag );
+
+/**
+ * Publish completed background translations. This must only be called when
+ * no translated code is executing (ie from the dispatch loop).
+ */
+void sh4_translate_publish_background( void );
+
+/**
+ * Enable the persistent translation cache, backed by the given file, or 
+ * disable it if filename is NULL. Blocks are looked up in the cache (by the
+ * content of their source page and their SH4 mode) before being translated,
+ * and newly translated blocks are added to it. The file is loaded immediately
+ * (if it exists), and written back by sh4_translate_save_persistent_cache.
+ * @return FALSE if the cache couldn't be enabled.
+ */
+gboolean sh4_translate_set_persistent_cache( const char *filename );
+
+/**
+ * Write the persistent translation cache back to its file, if any blocks have
+ * been added to it since it was loaded.
+ */
+void sh4_translate_save_persistent_cache( void );
+
+/**
+ * Physical address range covered by a translated block (blocks formed from
+ * traces have one range per trace segment, the first being the entry point)
+ */
+struct xlat_block_range {
+    sh4addr_t start;
+    sh4addr_t end;
+};
+
+/**
+ * Add the just-translated block to the persistent cache, if enabled. Called
+ * by sh4_translate_block with the translation lock held.
+ * @param start VMA of the block entry point
+ * @param block the translated block, with code_size bytes of code and 
+ *    recovery table
+ */
+void sh4_translate_persist_block( sh4vma_t start, xlat_cache_block_t block, uint32_t code_size,
+                                  struct xlat_block_range *ranges, int range_count );
+
+/**
+ * Describe a newly committed block to the perf output (see xlat/xltperf.h), 
+ * naming it after its SH4 address range and the enclosing symbol, if known.
+ * Must only be called if XLAT_PERF_ENABLED().
+ * @param start VMA of the block entry point
+ * @param ranges the physical ranges covered by the block (only the first is used)
+ */
+void sh4_translate_perf_load_block( sh4vma_t start, xlat_cache_block_t block, 
+                                    const struct xlat_block_range *ranges );
+
+/**
+ * Load the block at start from the persistent cache into the translation
+ * cache (and LUT), if the cache has a valid translation for the current 
+ * content of the source page. Called with the translation lock held and 
+ * xlat_source set up.
+ * @param optimise TRUE if a tier 2 translation is required, otherwise either 
+ *    tier will do (tier 2 is preferred).
+ * @return the loaded block, or NULL if not found.
+ */
+void *sh4_translate_load_persistent_block( sh4vma_t start, gboolean optimise );
+
+/**
+ * @return a signature of the translator settings that affect the generated
+ * code (other than the SH4 mode), for validating persistent cache entries.
+ */
+uint32_t sh4_translate_get_config( void );
 
 /**
  * Enter the VM at the given translated entry point
@@ -86,6 +285,71 @@ extern uint8_t *xlat_output;
 extern struct xlat_recovery_record xlat_recovery[MAX_RECOVERY_SIZE];
 extern xlat_cache_block_t xlat_current_block;
 extern uint32_t xlat_recovery_posn;
+extern uint32_t xlat_reloc[MAX_RELOC_SIZE];
+extern uint32_t xlat_reloc_posn;
+extern uint32_t xlat_fixup[MAX_FIXUP_SIZE];
+extern uint32_t xlat_fixup_posn;
+extern int32_t xlat_trace_icount_adjust;
+
+/**
+ * The SH4 state that determines how a block is translated, captured when the
+ * translation is requested. The translator must only access the source code
+ * and mode through this (and never through sh4_icache or sh4r directly), as 
+ * background translations run concurrently with the emulation, from a 
+ * private copy of the source page.
+ */
+struct xlat_source {
+    struct sh4_icache_struct icache; /* Page containing the block */
+    sh4ptr_t live_page; /* icache.page in SH4 memory, for references from the generated code */
+    uint32_t xlat_sh4_mode;
+    uint32_t fpscr;
+    gboolean tlb_on;
+};
+extern struct xlat_source xlat_source;
+
+/* Note that this is a range check rather than a mask check, so that a
+ * background request can describe a window that isn't aligned to its size */
+#define XLAT_IS_IN_ICACHE(addr) (((uint32_t)((addr) - xlat_source.icache.page_vma)) <= ~xlat_source.icache.mask)
+#define XLAT_ICACHE_PTR(addr) (xlat_source.icache.page + ((addr)-xlat_source.icache.page_vma))
+#define XLAT_ICACHE_LIVE_PTR(addr) (xlat_source.live_page + ((addr)-xlat_source.icache.page_vma))
+#define XLAT_ICACHE_PHYS(addr) (xlat_source.icache.page_ppa + ((addr)-xlat_source.icache.page_vma))
+#define XLAT_ICACHE_END() (xlat_source.icache.page_vma + (~xlat_source.icache.mask) + 1)
+
+/**
+ * A block may run from the 4K page containing its start into the following
+ * page, provided the icache page (ie the ITLB entry, or the linear RAM/ROM
+ * mapping) covers both. The source window for a block is the range of SH4
+ * memory that the translator may read from for it - at most 2 pages, and
+ * only 1 (or a 1K ITLB page) if the icache ends at the first page boundary.
+ */
+#define XLAT_SOURCE_PAGE_SIZE 0x1000
+#define XLAT_MAX_SOURCE_SIZE (2*XLAT_SOURCE_PAGE_SIZE)
+
+static inline sh4vma_t xlat_source_start( const struct sh4_icache_struct *icache, sh4vma_t pc )
+{
+    return pc & (icache->mask | ~(XLAT_SOURCE_PAGE_SIZE-1));
+}
+
+static inline uint32_t xlat_source_size( const struct sh4_icache_struct *icache, sh4vma_t pc )
+{
+    uint32_t remaining = (~icache->mask) + 1 - (xlat_source_start(icache, pc) - icache->page_vma);
+    return remaining < XLAT_MAX_SOURCE_SIZE ? remaining : XLAT_MAX_SOURCE_SIZE;
+}
+
+#define XLAT_SOURCE_START(pc) xlat_source_start(&xlat_source.icache, pc)
+#define XLAT_SOURCE_SIZE(pc) xlat_source_size(&xlat_source.icache, pc)
+
+/** TRUE if the current block is being translated with full optimisation */
+extern gboolean xlat_optimise;
+/** Executions of a tier 1 block before it's re-translated (0 = no tiering) */
+extern uint32_t xlat_hot_threshold;
+
+/**
+ * Number of SH4 instructions executed along the current trace prior to the
+ * instruction at pc. This differs from the linear (pc-start)>>1 once the 
+ * trace has followed a branch.
+ */
+#define XLAT_TRACE_ICOUNT(start,pc) ((((int32_t)((pc)-(start)))>>1) + xlat_trace_icount_adjust)
 
 /******************************************************************************
  * Code generation - these methods must be provided by the
@@ -99,6 +363,26 @@ uint32_t sh4_translate_instruction( sh4addr_t pc );
 void sh4_translate_end_block( sh4addr_t pc );
 uint32_t sh4_translate_end_block_size();
 void sh4_translate_emit_breakpoint( sh4vma_t pc );
+void sh4_translate_idiom( sh4vma_t pc, struct xlat_idiom *idiom );
+
+/**
+ * Retrieve the number of returns that were correctly/incorrectly predicted by
+ * the translator's shadow return stack.
+ */
+void sh4_translate_get_return_stack_stats( uint32_t *hits, uint32_t *misses );
+
+/**
+ * Discard all predictions from the shadow return stack. Called by the MMU when
+ * the vma => code mappings cached under the current context tags are no longer
+ * valid.
+ */
+void sh4_translate_flush_return_stack( void );
+
+/**
+ * @return a signature of the code generator settings that affect the 
+ * generated code (see sh4_translate_get_config)
+ */
+uint32_t sh4_translate_get_target_config( void );
 void sh4_translate_crashdump();
 
 typedef void (*unwind_thunk_t)(void);
@@ -113,6 +397,19 @@ void sh4_translate_set_callbacks( xlat_block_begin_callback_t begin, xlat_block_
  */
 void sh4_translate_set_fastmem( gboolean flag );
 
+/**
+ * Enable/disable the SSE3 code paths (where the host supports them). Takes
+ * effect for blocks translated afterwards.
+ */
+void sh4_translate_set_sse3( gboolean flag );
+
+/**
+ * Patch the fastmem access at native_pc (which faulted) to take the normal
+ * memory path instead - called from the fault handler.
+ * @return FALSE if native_pc isn't a fastmem access
+ */
+gboolean sh4_translate_fastmem_patch( void *native_pc );
+
 /**
  * Set the address spaces for the translated code.
  */
@@ -183,6 +480,15 @@ void sh4_translate_dump_cache_by_activity( unsigned int topN );
  */
 void FASTCALL sh4_translate_link_block( uint32_t pc );
 
+/**
+ * Target cache miss handler for translated code running with address
+ * translation enabled - resolves the vma through the TLB, and adds the result
+ * to the target cache under the current context tag (sh4r.xlat_context).
+ * @return the code for the vma with the given mode, or NULL if there isn't
+ * any (or the lookup raised an exception).
+ */
+void * FASTCALL sh4_translate_target_miss( sh4vma_t vma, uint32_t xlat_sh4_mode );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,503 @@
+/**
+ * $Id$
+ *
+ * Micro-benchmarks for the SH4 cores. Generates a synthetic loop for each
+ * class of SH4 instruction (ALU, RAM load/store, single and double precision
+ * FPU, branches, and memory access with the MMU enabled), runs it for a
+ * fixed amount of emulated time under both the interpreter and the
+ * translator, and reports the execution rate of each, plus the size and
+ * translation time of the translated code.
+ *
+ * Copyright (c) 2026 agent.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "dream.h"
+#include "dreamcast.h"
+#include "display.h"
+#include "mem.h"
+#include "sh4/sh4.h"
+#include "sh4/sh4core.h"
+#include "sh4/sh4trans.h"
+#include "sh4/sh4mmio.h"
+#include "sh4/mmu.h"
+#include "xlat/xltcache.h"
+
+/* The real display drivers live in the main program, not the core library */
+#ifdef HAVE_GTK
+struct display_driver display_gtk_driver = { "gtk", "Not available in benchsh4x86" };
+#endif
+#ifdef HAVE_COCOA
+struct display_driver display_osx_driver = { "osx", "Not available in benchsh4x86" };
+#endif
+
+#define BENCH_CODE_VMA    0x8C010000 /* Start of the loop */
+#define BENCH_CODE_PHYS   0x0C010000
+#define BENCH_DATA_VMA    0x8C100000 /* Data accessed by the memory classes */
+#define BENCH_DATA_TLB    0x00100000 /* Same, through the UTLB */
+#define BENCH_DATA_PHYS   0x0C100000
+#define BENCH_SLICE_NANOS 1000000
+#define MAX_BODY_LENGTH   1024
+#define MAX_STREAM_LENGTH (MAX_BODY_LENGTH+64)
+#define MAX_FIXUPS        MAX_STREAM_LENGTH
+
+/* Instruction encodings used by the generators */
+#define OP_NOP            0x0009
+#define OP_RTS            0x000B
+#define OP_ADD(m,n)       (0x300C|((n)<<8)|((m)<<4))
+#define OP_ADDI(imm,n)    (0x7000|((n)<<8)|((imm)&0xFF))
+#define OP_ADDC(m,n)      (0x300E|((n)<<8)|((m)<<4))
+#define OP_SUB(m,n)       (0x3008|((n)<<8)|((m)<<4))
+#define OP_AND(m,n)       (0x2009|((n)<<8)|((m)<<4))
+#define OP_OR(m,n)        (0x200B|((n)<<8)|((m)<<4))
+#define OP_XOR(m,n)       (0x200A|((n)<<8)|((m)<<4))
+#define OP_MOV(m,n)       (0x6003|((n)<<8)|((m)<<4))
+#define OP_NEG(m,n)       (0x600B|((n)<<8)|((m)<<4))
+#define OP_EXTUB(m,n)     (0x600C|((n)<<8)|((m)<<4))
+#define OP_MULL(m,n)      (0x0007|((n)<<8)|((m)<<4))
+#define OP_SHLL(n)        (0x4000|((n)<<8))
+#define OP_SHLR(n)        (0x4001|((n)<<8))
+#define OP_CMPEQ(m,n)     (0x3000|((n)<<8)|((m)<<4))
+#define OP_CMPGT(m,n)     (0x3007|((n)<<8)|((m)<<4))
+#define OP_MOVB_LD(m,n)   (0x6000|((n)<<8)|((m)<<4))
+#define OP_MOVW_LD(m,n)   (0x6001|((n)<<8)|((m)<<4))
+#define OP_MOVL_LD(m,n)   (0x6002|((n)<<8)|((m)<<4))
+#define OP_MOVL_LDINC(m,n) (0x6006|((n)<<8)|((m)<<4))
+#define OP_MOVL_LDDISP(d,m,n) (0x5000|((n)<<8)|((m)<<4)|(d))
+#define OP_MOVB_ST(m,n)   (0x2000|((n)<<8)|((m)<<4))
+#define OP_MOVW_ST(m,n)   (0x2001|((n)<<8)|((m)<<4))
+#define OP_MOVL_ST(m,n)   (0x2002|((n)<<8)|((m)<<4))
+#define OP_MOVL_STDEC(m,n) (0x2006|((n)<<8)|((m)<<4))
+#define OP_MOVL_STDISP(m,d,n) (0x1000|((n)<<8)|((m)<<4)|(d))
+#define OP_BT(disp)       (0x8900|((disp)&0xFF))
+#define OP_BF(disp)       (0x8B00|((disp)&0xFF))
+#define OP_BRA(disp)      (0xA000|((disp)&0xFFF))
+#define OP_BSR(disp)      (0xB000|((disp)&0xFFF))
+#define OP_JSR(m)         (0x400B|((m)<<8))
+#define OP_FADD(m,n)      (0xF000|((n)<<8)|((m)<<4))
+#define OP_FSUB(m,n)      (0xF001|((n)<<8)|((m)<<4))
+#define OP_FMUL(m,n)      (0xF002|((n)<<8)|((m)<<4))
+#define OP_FDIV(m,n)      (0xF003|((n)<<8)|((m)<<4))
+#define OP_FCMPGT(m,n)    (0xF005|((n)<<8)|((m)<<4))
+#define OP_FMOV(m,n)      (0xF00C|((n)<<8)|((m)<<4))
+#define OP_FMAC(m,n)      (0xF00E|((n)<<8)|((m)<<4))
+#define OP_FNEG(n)        (0xF04D|((n)<<8))
+#define OP_FABS(n)        (0xF05D|((n)<<8))
+#define OP_FSQRT(n)       (0xF06D|((n)<<8))
+
+#define REG_COUNTER 14 /* Incremented once per iteration */
+#define REG_DATA    8  /* Pointer to the data area */
+#define REG_DATA2   9  /* Second pointer into the data area */
+#define REG_SUB     5  /* Address of the subroutine (branch class) */
+
+/**
+ * A generated SH4 loop: a counter increment, the body, and a branch back to
+ * the start, followed by a subroutine (RTS) that the body may call.
+ */
+struct bench_stream {
+    uint16_t code[MAX_STREAM_LENGTH];
+    uint32_t length;         /* Instructions emitted */
+    uint32_t executed;       /* Instructions executed per iteration */
+    uint32_t bsr_fixup[MAX_FIXUPS]; /* Indexes of BSR instructions to the subroutine */
+    uint32_t bsr_count;
+    sh4addr_t sub_vma;
+};
+
+/**
+ * Emit one instance of a class's instruction pattern.
+ * @return the number of instructions executed by the pattern.
+ */
+typedef uint32_t (*bench_emit_fn_t)( struct bench_stream *s );
+
+struct bench_class {
+    const char *name;
+    const char *description;
+    bench_emit_fn_t emit;
+    uint32_t fpscr;
+    gboolean mmu;
+};
+
+struct bench_result {
+    double interp_mips;
+    double xlat_mips;
+    double xlat_bytes_per_insn[2]; /* Baseline, optimised */
+    double xlat_ns_per_insn[2];
+    uint32_t blocks;
+};
+
+char *option_list = "c:n:t:r:h";
+struct option longopts[1] = { { NULL, 0, 0, 0 } };
+
+static uint32_t body_length = 64;
+static uint32_t run_millis = 200;
+static uint32_t xlat_repeats = 200;
+
+static inline void bench_emit( struct bench_stream *s, uint16_t op )
+{
+    s->code[s->length++] = op;
+}
+
+static uint32_t bench_emit_alu( struct bench_stream *s )
+{
+    bench_emit( s, OP_ADD(1,0) );
+    bench_emit( s, OP_SUB(2,3) );
+    bench_emit( s, OP_AND(4,5) );
+    bench_emit( s, OP_OR(6,7) );
+    bench_emit( s, OP_XOR(0,1) );
+    bench_emit( s, OP_SHLL(2) );
+    bench_emit( s, OP_SHLR(4) );
+    bench_emit( s, OP_ADDI(5,6) );
+    bench_emit( s, OP_MOV(0,2) );
+    bench_emit( s, OP_CMPGT(3,4) );
+    bench_emit( s, OP_ADDC(5,6) );
+    bench_emit( s, OP_EXTUB(7,4) );
+    bench_emit( s, OP_NEG(1,5) );
+    bench_emit( s, OP_MULL(3,7) );
+    return 14;
+}
+
+/**
+ * Loads and stores of each size through REG_DATA and REG_DATA2. The post-
+ * increment load is undone by the pre-decrement store, so the pointers are
+ * the same at the end of each pattern.
+ */
+static uint32_t bench_emit_mem( struct bench_stream *s )
+{
+    bench_emit( s, OP_MOVL_LD(REG_DATA,0) );
+    bench_emit( s, OP_MOVL_STDISP(0,1,REG_DATA) );
+    bench_emit( s, OP_MOVW_LD(REG_DATA,1) );
+    bench_emit( s, OP_MOVW_ST(1,REG_DATA2) );
+    bench_emit( s, OP_MOVB_LD(REG_DATA2,2) );
+    bench_emit( s, OP_MOVB_ST(2,REG_DATA) );
+    bench_emit( s, OP_MOVL_LDDISP(1,REG_DATA,3) );
+    bench_emit( s, OP_MOVL_LDINC(REG_DATA2,4) );
+    bench_emit( s, OP_MOVL_STDEC(4,REG_DATA2) );
+    return 9;
+}
+
+/**
+ * Single precision arithmetic. All registers start at 1.0, so that the
+ * multiplies, divides and square roots are stable and nothing overflows.
+ */
+static uint32_t bench_emit_fpu_single( struct bench_stream *s )
+{
+    bench_emit( s, OP_FADD(1,0) );
+    bench_emit( s, OP_FMUL(2,3) );
+    bench_emit( s, OP_FMAC(4,5) );
+    bench_emit( s, OP_FSUB(6,7) );
+    bench_emit( s, OP_FMOV(0,8) );
+    bench_emit( s, OP_FCMPGT(1,2) );
+    bench_emit( s, OP_FNEG(9) );
+    bench_emit( s, OP_FABS(9) );
+    bench_emit( s, OP_FDIV(2,10) );
+    bench_emit( s, OP_FSQRT(11) );
+    return 10;
+}
+
+/**
+ * Double precision arithmetic (FPSCR.PR = 1), on even register pairs.
+ */
+static uint32_t bench_emit_fpu_double( struct bench_stream *s )
+{
+    bench_emit( s, OP_FADD(2,0) );
+    bench_emit( s, OP_FMUL(4,6) );
+    bench_emit( s, OP_FSUB(8,10) );
+    bench_emit( s, OP_FCMPGT(2,4) );
+    bench_emit( s, OP_FNEG(8) );
+    bench_emit( s, OP_FABS(8) );
+    bench_emit( s, OP_FDIV(4,12) );
+    bench_emit( s, OP_FSQRT(14) );
+    return 8;
+}
+
+/**
+ * A not-taken and a taken conditional branch, an unconditional branch, and
+ * a direct and an indirect call to the subroutine at the end of the stream.
+ */
+static uint32_t bench_emit_branch( struct bench_stream *s )
+{
+    bench_emit( s, OP_CMPEQ(1,2) ); /* R1 != R2, so T = 0 */
+    bench_emit( s, OP_BT(0) );
+    bench_emit( s, OP_ADDI(1,3) );
+    bench_emit( s, OP_BF(0) );
+    bench_emit( s, OP_ADDI(1,4) );  /* Skipped */
+    bench_emit( s, OP_BRA(0) );
+    bench_emit( s, OP_NOP );
+    s->bsr_fixup[s->bsr_count++] = s->length;
+    bench_emit( s, OP_BSR(0) );
+    bench_emit( s, OP_NOP );
+    bench_emit( s, OP_JSR(REG_SUB) );
+    bench_emit( s, OP_NOP );
+    return 10 + 2*2; /* Including the RTS + delay slot, twice */
+}
+
+static struct bench_class bench_classes[] = {
+    { "alu", "Integer arithmetic and logic", bench_emit_alu, 0x00040001, FALSE },
+    { "mem", "RAM loads and stores", bench_emit_mem, 0x00040001, FALSE },
+    { "fpu-single", "Single precision FPU", bench_emit_fpu_single, 0x00040001, FALSE },
+    { "fpu-double", "Double precision FPU", bench_emit_fpu_double, 0x00040001|FPSCR_PR, FALSE },
+    { "branch", "Conditional, unconditional and subroutine branches", bench_emit_branch, 0x00040001, FALSE },
+    { "mem-mmu", "RAM loads and stores through the UTLB", bench_emit_mem, 0x00040001, TRUE },
+    { NULL, NULL, NULL, 0, FALSE } };
+
+/**
+ * Generate the loop for the given class, with at least body_length
+ * instructions in the body.
+ */
+static void bench_generate( struct bench_class *cls, struct bench_stream *s )
+{
+    uint32_t i;
+    s->length = 0;
+    s->bsr_count = 0;
+    bench_emit( s, OP_ADDI(1,REG_COUNTER) );
+    s->executed = 1;
+    while( s->length < body_length + 1 ) {
+        s->executed += cls->emit(s);
+    }
+    bench_emit( s, OP_BRA(-(int)(s->length+2)) );
+    bench_emit( s, OP_NOP );
+    s->executed += 2;
+
+    s->sub_vma = BENCH_CODE_VMA + (s->length<<1);
+    bench_emit( s, OP_RTS );
+    bench_emit( s, OP_NOP );
+    for( i=0; i<s->bsr_count; i++ ) {
+        uint32_t posn = s->bsr_fixup[i];
+        int32_t disp = (int32_t)(s->sub_vma - (BENCH_CODE_VMA + (posn<<1) + 4)) >> 1;
+        s->code[posn] = OP_BSR(disp);
+    }
+}
+
+static uint64_t bench_time_usecs( void )
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return ((uint64_t)tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/**
+ * Reset the SH4 and load the stream, setting up the registers, FPSCR and
+ * (optionally) a UTLB mapping for the data area.
+ */
+static void bench_setup( struct bench_class *cls, struct bench_stream *s )
+{
+    int i;
+
+    eventq_module.reset();
+    sh4_module.reset();
+    mem_copy_to_sh4( BENCH_CODE_PHYS, (sh4ptr_t)s->code, s->length<<1 );
+    memset( mem_get_region(BENCH_DATA_PHYS), 0x5A, 4096 );
+
+    sh4_set_pc( BENCH_CODE_VMA );
+    sh4_write_fpscr( cls->fpscr );
+    for( i=0; i<16; i++ ) {
+        sh4r.r[i] = i+1;
+        FR(i) = 1.0;
+    }
+    if( cls->fpscr & FPSCR_PR ) {
+        for( i=0; i<8; i++ ) {
+            DRF(i) = 1.0;
+        }
+    }
+    sh4r.r[REG_COUNTER] = 0;
+    sh4r.r[REG_SUB] = s->sub_vma;
+    sh4r.r[REG_DATA] = cls->mmu ? BENCH_DATA_TLB : BENCH_DATA_VMA;
+    sh4r.r[REG_DATA2] = sh4r.r[REG_DATA] + 0x100;
+
+    if( cls->mmu ) {
+        mmio_region_MMU_write( PTEH, BENCH_DATA_TLB );
+        mmio_region_MMU_write( PTEL, BENCH_DATA_PHYS | TLB_VALID | TLB_SIZE_64K |
+                TLB_WRITABLE | TLB_CACHEABLE | TLB_DIRTY );
+        MMU_ldtlb();
+        mmio_region_MMU_write( MMUCR, MMUCR_AT );
+    }
+}
+
+/**
+ * Run the loop for run_millis of SH4 time on the current core.
+ * @return the execution rate, in millions of SH4 instructions per second.
+ */
+static double bench_execute( struct bench_stream *s )
+{
+    uint64_t nanos = ((uint64_t)run_millis) * 1000000;
+    uint64_t start, end;
+
+    sh4_module.start();
+    start = bench_time_usecs();
+    while( nanos > 0 ) {
+        uint32_t slice = nanos < BENCH_SLICE_NANOS ? (uint32_t)nanos : BENCH_SLICE_NANOS;
+        sh4_module.run_time_slice( slice );
+        eventq_module.run_time_slice( slice );
+        nanos -= slice;
+    }
+    end = bench_time_usecs();
+    sh4_module.stop();
+
+    if( end == start ) {
+        end++;
+    }
+    return ((double)sh4r.r[REG_COUNTER]) * s->executed / (end - start);
+}
+
+/**
+ * Re-translate every block that the translated run created, xlat_repeats
+ * times, with the baseline (tier 1) translator and with full optimisation
+ * (tier 2). The instruction count of each block comes from its end-of-block
+ * recovery record, so it follows any trace the block took.
+ */
+static void bench_translate( struct bench_stream *s, struct bench_result *result )
+{
+    sh4addr_t entries[MAX_STREAM_LENGTH];
+    uint32_t entry_count = 0, i, rep;
+    uint32_t saved_threshold = xlat_hot_threshold;
+    int tier;
+
+    for( i=0; i<s->length; i++ ) {
+        if( xlat_get_code_by_vma( BENCH_CODE_VMA + (i<<1) ) != NULL ) {
+            entries[entry_count++] = BENCH_CODE_VMA + (i<<1);
+        }
+    }
+    result->blocks = entry_count;
+
+    for( tier=0; tier<2; tier++ ) {
+        uint64_t bytes = 0, icount = 0, usecs = 0;
+        sh4_translate_set_hot_threshold( tier == 0 && saved_threshold != 0 ? saved_threshold : 0 );
+        for( rep=0; rep < xlat_repeats; rep++ ) {
+            xlat_flush_cache();
+            uint64_t start = bench_time_usecs();
+            for( i=0; i<entry_count; i++ ) {
+                mmu_update_icache( entries[i] );
+                void *code = sh4_translate_basic_block( entries[i] );
+                if( rep == 0 ) {
+                    xlat_recovery_record_t recovery = XLAT_RECOVERY_TABLE(code);
+                    uint32_t j, count = 0;
+                    for( j=0; j<XLAT_BLOCK_FOR_CODE(code)->recover_table_size; j++ ) {
+                        if( recovery[j].sh4_icount > count ) {
+                            count = recovery[j].sh4_icount;
+                        }
+                    }
+                    bytes += xlat_get_code_size( code );
+                    icount += count;
+                }
+            }
+            usecs += bench_time_usecs() - start;
+        }
+        if( icount != 0 ) {
+            result->xlat_bytes_per_insn[tier] = ((double)bytes) / icount;
+            result->xlat_ns_per_insn[tier] = ((double)usecs) * 1000 / (icount * xlat_repeats);
+        }
+    }
+    sh4_translate_set_hot_threshold( saved_threshold );
+    xlat_flush_cache();
+}
+
+static void bench_run_class( struct bench_class *cls, struct bench_result *result )
+{
+    struct bench_stream s;
+
+    memset( result, 0, sizeof(struct bench_result) );
+    bench_generate( cls, &s );
+
+    sh4_set_core( SH4_INTERPRET );
+    bench_setup( cls, &s );
+    result->interp_mips = bench_execute( &s );
+
+    sh4_set_core( SH4_TRANSLATE );
+    bench_setup( cls, &s );
+    result->xlat_mips = bench_execute( &s );
+    bench_translate( &s, result );
+}
+
+void usage()
+{
+    int i;
+    fprintf( stderr, "Usage: benchsh4x86 [options]\n");
+    fprintf( stderr, "Options:\n");
+    fprintf( stderr, "  -c <class>     Run only the given instruction class [all]\n" );
+    fprintf( stderr, "  -h             Display this help message\n" );
+    fprintf( stderr, "  -n <count>     Minimum instructions in each loop body [64]\n" );
+    fprintf( stderr, "  -r <count>     Repetitions of each translation [200]\n" );
+    fprintf( stderr, "  -t <msecs>     SH4 time to run each loop for [200]\n" );
+    fprintf( stderr, "Classes:\n" );
+    for( i=0; bench_classes[i].name != NULL; i++ ) {
+        fprintf( stderr, "  %-14s %s\n", bench_classes[i].name, bench_classes[i].description );
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    char *class_name = NULL;
+    struct bench_result result;
+    int opt, i, found = 0;
+
+    while( (opt = getopt_long( argc, argv, option_list, longopts, NULL )) != -1 ) {
+	switch( opt ) {
+	case 'c':
+	    class_name = optarg;
+	    break;
+	case 'n':
+	    body_length = strtoul(optarg, NULL, 0);
+	    if( body_length == 0 || body_length > MAX_BODY_LENGTH ) {
+		fprintf( stderr, "Loop body must be between 1 and %d instructions\n", MAX_BODY_LENGTH );
+		exit(1);
+	    }
+	    break;
+	case 'r':
+	    xlat_repeats = strtoul(optarg, NULL, 0);
+	    if( xlat_repeats == 0 ) {
+		xlat_repeats = 1;
+	    }
+	    break;
+	case 't':
+	    run_millis = strtoul(optarg, NULL, 0);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    dreamcast_init( FALSE );
+    display_set_driver( &display_null_driver );
+
+    printf( "%-12s %12s %12s %8s %14s %14s %8s\n", "Class", "Interp MIPS", "Xlat MIPS",
+            "Speedup", "Bytes/insn", "Xlat ns/insn", "Blocks" );
+    printf( "%-12s %12s %12s %8s %14s %14s %8s\n", "", "", "", "", "(base/opt)", "(base/opt)", "" );
+    for( i=0; bench_classes[i].name != NULL; i++ ) {
+        if( class_name != NULL && strcmp( class_name, bench_classes[i].name ) != 0 ) {
+            continue;
+        }
+        found++;
+        bench_run_class( &bench_classes[i], &result );
+        printf( "%-12s %12.1f %12.1f %8.2f %6.1f /%6.1f %6.1f /%6.1f %8u\n", bench_classes[i].name,
+                result.interp_mips, result.xlat_mips,
+                result.interp_mips > 0 ? result.xlat_mips / result.interp_mips : 0.0,
+                result.xlat_bytes_per_insn[0], result.xlat_bytes_per_insn[1],
+                result.xlat_ns_per_insn[0], result.xlat_ns_per_insn[1], result.blocks );
+        fflush( stdout );
+    }
+    if( found == 0 ) {
+        fprintf( stderr, "Unknown instruction class '%s'\n", class_name );
+        usage();
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+/**
+ * $Id$
+ *
+ * Checks that the decision tree, flat table and two-level table decoders
+ * that gendec generates from sh4.def (see testgendec.in) all decode every
+ * 16-bit instruction to the same rule.
+ *
+ * Copyright (c) 2026 agent.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+
+#define GENDEC_TEST_UNDEF -1 /* No rule matched */
+#define GENDEC_TEST_UNIMP -2 /* Rule without an action */
+#define GENDEC_TEST_NONE -3  /* Decoder didn't run an action at all */
+
+#define GENDEC_TEST_DECODE gendec_test_decode_tree
+#include "test/testgendec-tree.c"
+#undef GENDEC_TEST_DECODE
+#define GENDEC_TEST_DECODE gendec_test_decode_flat
+#include "test/testgendec-flat.c"
+#undef GENDEC_TEST_DECODE
+#define GENDEC_TEST_DECODE gendec_test_decode_split
+#include "test/testgendec-split.c"
+#undef GENDEC_TEST_DECODE
+
+int main()
+{
+    int failures = 0, decoded = 0;
+    uint32_t ir;
+
+    for( ir=0; ir<65536; ir++ ) {
+        int tree = gendec_test_decode_tree( ir );
+        int flat = gendec_test_decode_flat( ir );
+        int split = gendec_test_decode_split( ir );
+        if( tree != flat || tree != split || tree < GENDEC_TEST_UNDEF ) {
+            if( failures < 20 ) {
+                fprintf( stderr, "%04X: tree %d, flat %d, two-level %d\n", ir, tree, flat, split );
+            }
+            failures++;
+        } else if( tree != GENDEC_TEST_UNDEF ) {
+            decoded++;
+        }
+    }
+    if( failures != 0 ) {
+        fprintf( stderr, "%d instructions decoded differently\n", failures );
+        return 1;
+    }
+    printf( "All decoders agree (%d instructions defined)\n", decoded );
+    return 0;
+}
@@ -4,6 +4,8 @@
  * Test cases for the SH4 => x86 translator core. Takes as
  * input a binary SH4 object (and VMA), generates the
  * corresponding x86 code, and outputs the disassembly.
+ * Alternatively (-t), runs a set of small SH4 programs through
+ * the translator and checks the results.
  *
  * Copyright (c) 2005 Nathan Keynes.
  *
@@ -20,6 +22,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <assert.h>
 #include <getopt.h>
 #include <sys/stat.h>
 #include <string.h>
@@ -42,16 +45,19 @@ gboolean sh4_profile_blocks = FALSE;
 
 struct mem_region_fn **sh4_address_space = (void *)0x12345432;
 struct mem_region_fn **sh4_user_address_space = (void *)0x12345678;
-char *option_list = "s:o:d:h";
+unsigned char *sh4_fastmem_priv_base = NULL;
+unsigned char *sh4_fastmem_user_base = NULL;
+char *option_list = "s:o:d:th";
 struct option longopts[1] = { { NULL, 0, 0, 0 } };
 
 char *input_file = NULL;
 char *diff_file = NULL;
 char *output_file = NULL;
+gboolean run_tests = FALSE;
 gboolean sh4_starting;
 uint32_t start_addr = 0x8C010000;
 uint32_t sh4_cpu_period = 5;
-unsigned char dc_main_ram[4096];
+unsigned char dc_main_ram[16*1024*1024];
 unsigned char dc_boot_rom[4096];
 FILE *in;
 
@@ -71,6 +77,9 @@ struct xlat_symbol local_symbols[] = {
     { "sh4_switch_fr_banks", sh4_switch_fr_banks },
     { "sh4_execute_instruction", sh4_execute_instruction },
     { "signsat48", signsat48 },
+    { "sh4_idiom_udiv", sh4_idiom_udiv },
+    { "sh4_idiom_copy", sh4_idiom_copy },
+    { "sh4_idiom_mac", sh4_idiom_mac },
     { "xlat_get_code_by_vma", xlat_get_code_by_vma },
     { "xlat_get_code", xlat_get_code }
 };
@@ -93,10 +102,7 @@ void SCIF_run_slice( uint32_t nanos ) {}
 void FASTCALL sh4_write_fpscr( uint32_t val ) { }
 void FASTCALL sh4_write_sr( uint32_t val ) { }
 uint32_t FASTCALL sh4_read_sr( void ) { return 0; }
-void FASTCALL sh4_sleep() { }
-void FASTCALL sh4_fsca( uint32_t angle, float *fr ) { }
-void FASTCALL sh4_ftrv( float *fv ) { }
-void FASTCALL signsat48(void) { }
+void FASTCALL sh4_sleep() { sh4r.event_pending = 0; } /* Stops the test programs */
 void sh4_switch_fr_banks() { }
 void mem_copy_to_sh4( sh4addr_t addr, sh4ptr_t src, size_t size ) { }
 gboolean sh4_has_page( sh4vma_t vma ) { return TRUE; }
@@ -131,6 +137,7 @@ void usage()
     fprintf( stderr, "  -h             Display this help message\n" );
     fprintf( stderr, "  -o <filename>  Output disassembly to file [stdout]\n" );
     fprintf( stderr, "  -s <addr>      Specify start address of binary [8C010000]\n" );
+    fprintf( stderr, "  -t             Run the translator self-tests instead\n" );
 }
 
 void emit( void *ptr, int level, const gchar *source, const char *msg, ... )
@@ -143,7 +150,662 @@ void emit( void *ptr, int level, const gchar *source, const char *msg, ... )
 }
 
 
-struct sh4_registers sh4r;
+struct sh4_registers sh4r __attribute__((aligned(16)));
+
+/*
+ * Self-tests. Each one assembles a small SH4 program at TEST_CODE_VMA, which
+ * is translated with full optimisation and run until it reaches the SLEEP
+ * at its end, and checks the registers and memory against the interpreter's
+ * definition of the same instructions.
+ */
+#define TEST_CODE_VMA 0x8C010000
+#define TEST_CODE_PHYS 0x0C010000
+#define TEST_DATA_VMA 0x8C100000 /* Main RAM */
+#define TEST_DATA_SIZE 0x4000
+#define TEST_IO_VMA 0xA4000000 /* One page of test_io_region, ie not main RAM */
+#define TEST_EVENT_NEVER 0xFFFFFFFF
+#define TEST_UDIV_COUNT 4000
+#define TEST_FPU_COUNT 100000
+
+#define OP_NOP             0x0009
+#define OP_SLEEP           0x001B
+#define OP_DIV0U           0x0019
+#define OP_ROTCL(n)        (0x4024|((n)<<8))
+#define OP_DIV1(m,n)       (0x3004|((n)<<8)|((m)<<4))
+#define OP_DT(n)           (0x4010|((n)<<8))
+#define OP_ADDI(imm,n)     (0x7000|((n)<<8)|((imm)&0xFF))
+#define OP_BF(disp)        (0x8B00|((disp)&0xFF))
+#define OP_BT(disp)        (0x8900|((disp)&0xFF))
+#define OP_TST(m,n)        (0x2008|((n)<<8)|((m)<<4))
+#define OP_MOV_LD(sz,m,n)  (0x6000|((n)<<8)|((m)<<4)|(sz))
+#define OP_MOV_LDINC(sz,m,n) (0x6004|((n)<<8)|((m)<<4)|(sz)) /* sz = log2 of the size */
+#define OP_MOV_ST(sz,m,n)  (0x2000|((n)<<8)|((m)<<4)|(sz))
+#define OP_MACW(m,n)       (0x400F|((n)<<8)|((m)<<4))
+#define OP_MACL(m,n)       (0x000F|((n)<<8)|((m)<<4))
+#define OP_LDS_FPUL(m)     (0x405A|((m)<<8))
+#define OP_FIPR(m,n)       (0xF0ED|((n)<<10)|((m)<<8)) /* FVm, FVn */
+#define OP_FTRV(n)         (0xF1FD|((n)<<10)) /* XMTRX, FVn */
+#define OP_FSCA(n)         (0xF0FD|((n)<<8)) /* FPUL, FRn (n even) */
+
+extern struct mem_region_fn mem_region_sdram;
+static struct mem_region_fn *test_address_space[1<<20];
+static uint16_t test_code[2048];
+static uint32_t test_code_length;
+static uint32_t test_seed = 0x2F6B3C19;
+static int test_failures = 0;
+
+/* Reference copies of the data area and test_io, updated by the reference
+ * implementations */
+static unsigned char test_ref_data[TEST_DATA_SIZE];
+static unsigned char test_io[4096];
+static unsigned char test_ref_io[4096];
+
+static int32_t FASTCALL test_io_read_long( sh4addr_t addr )
+{
+    return *((int32_t *)(test_io + (addr&0xFFF)));
+}
+static int32_t FASTCALL test_io_read_word( sh4addr_t addr )
+{
+    return SIGNEXT16(*((int16_t *)(test_io + (addr&0xFFF))));
+}
+static int32_t FASTCALL test_io_read_byte( sh4addr_t addr )
+{
+    return SIGNEXT8(test_io[addr&0xFFF]);
+}
+static void FASTCALL test_io_write_long( sh4addr_t addr, uint32_t val )
+{
+    *((uint32_t *)(test_io + (addr&0xFFF))) = val;
+}
+static void FASTCALL test_io_write_word( sh4addr_t addr, uint32_t val )
+{
+    *((uint16_t *)(test_io + (addr&0xFFF))) = (uint16_t)val;
+}
+static void FASTCALL test_io_write_byte( sh4addr_t addr, uint32_t val )
+{
+    test_io[addr&0xFFF] = (uint8_t)val;
+}
+
+static struct mem_region_fn test_io_region = { test_io_read_long, test_io_write_long,
+        test_io_read_word, test_io_write_word, test_io_read_byte, test_io_write_byte,
+        NULL, NULL, NULL, test_io_read_byte };
+
+/**
+ * xorshift32, so that any failures are reproducible
+ */
+static uint32_t test_random( void )
+{
+    test_seed ^= test_seed << 13;
+    test_seed ^= test_seed >> 17;
+    test_seed ^= test_seed << 5;
+    return test_seed;
+}
+
+static void test_fail( const char *name, int iteration, const char *msg, ... )
+{
+    va_list ap;
+    va_start( ap, msg );
+    fprintf( stderr, "FAIL %s #%d: ", name, iteration );
+    vfprintf( stderr, msg, ap );
+    fprintf( stderr, "\n" );
+    va_end( ap );
+    test_failures++;
+}
+
+/**
+ * Start a new test program, discarding the translations of the last one
+ */
+static void test_begin( void )
+{
+    test_code_length = 0;
+    memset( test_code, 0, sizeof(test_code) );
+    xlat_flush_cache();
+}
+
+static void test_emit( uint16_t op )
+{
+    assert( test_code_length < sizeof(test_code)/sizeof(uint16_t) );
+    test_code[test_code_length++] = op;
+}
+
+/**
+ * Reset the registers to privileged mode, single precision, with random
+ * general registers
+ */
+static void test_reset_registers( void )
+{
+    int i;
+    memset( &sh4r, 0, sizeof(sh4r) );
+    sh4r.sr = SR_MD;
+    sh4r.xlat_sh4_mode = SR_MD;
+    for( i=0; i<16; i++ ) {
+        sh4r.r[i] = test_random();
+    }
+}
+
+/**
+ * Fill the data area and test_io with random bytes (and the reference
+ * copies with the same)
+ */
+static void test_reset_memory( void )
+{
+    uint32_t i;
+    for( i=0; i<TEST_DATA_SIZE; i++ ) {
+        test_ref_data[i] = dc_main_ram[(TEST_DATA_VMA&0x00FFFFFF) + i] = (unsigned char)test_random();
+    }
+    for( i=0; i<sizeof(test_io); i++ ) {
+        test_ref_io[i] = test_io[i] = (unsigned char)test_random();
+    }
+}
+
+/**
+ * Run the translated program from pc until it sleeps, or until the end of 
+ * a block at or after event_pending.
+ */
+static void test_execute( sh4vma_t pc, uint32_t event_pending )
+{
+    void *code;
+    sh4r.pc = pc;
+    sh4r.slice_cycle = 0;
+    sh4r.event_pending = event_pending;
+    code = xlat_get_code_by_vma( pc );
+    if( code == NULL ) {
+        code = sh4_translate_basic_block( pc );
+    }
+    sh4_translate_enter( code );
+}
+
+static void test_check_registers( const char *name, int iteration, struct sh4_registers *expect )
+{
+    int i;
+    for( i=0; i<16; i++ ) {
+        if( sh4r.r[i] != expect->r[i] ) {
+            test_fail( name, iteration, "R%d = %08X, expected %08X", i, sh4r.r[i], expect->r[i] );
+        }
+    }
+    if( sh4r.t != expect->t || sh4r.q != expect->q || sh4r.m != expect->m ) {
+        test_fail( name, iteration, "T/Q/M = %d/%d/%d, expected %d/%d/%d", sh4r.t, sh4r.q, sh4r.m,
+                   expect->t, expect->q, expect->m );
+    }
+    if( sh4r.mac != expect->mac ) {
+        test_fail( name, iteration, "MAC = %016llX, expected %016llX", (unsigned long long)sh4r.mac,
+                   (unsigned long long)expect->mac );
+    }
+}
+
+static void test_check_memory( const char *name, int iteration )
+{
+    if( memcmp( dc_main_ram + (TEST_DATA_VMA&0x00FFFFFF), test_ref_data, TEST_DATA_SIZE ) != 0 ) {
+        test_fail( name, iteration, "RAM contents differ" );
+    }
+    if( memcmp( test_io, test_ref_io, sizeof(test_io) ) != 0 ) {
+        test_fail( name, iteration, "I/O region contents differ" );
+    }
+}
+
+/**
+ * Check whether the loop starting at pc fell back to normal execution, ie
+ * the block at pc had to be translated
+ */
+static void test_check_fallback( const char *name, sh4vma_t pc, gboolean expect )
+{
+    gboolean fallback = xlat_get_code_by_vma( pc ) != NULL;
+    if( fallback != expect ) {
+        test_fail( name, 0, expect ? "expected to fall back to normal execution" :
+                   "fell back to normal execution" );
+    }
+}
+
+static unsigned char *test_ref_ptr( sh4addr_t addr )
+{
+    if( addr >= TEST_IO_VMA && addr < TEST_IO_VMA + sizeof(test_ref_io) ) {
+        return test_ref_io + (addr - TEST_IO_VMA);
+    }
+    assert( addr >= TEST_DATA_VMA && addr < TEST_DATA_VMA + TEST_DATA_SIZE );
+    return test_ref_data + (addr - TEST_DATA_VMA);
+}
+
+static int32_t test_ref_read( sh4addr_t addr, int size )
+{
+    unsigned char *p = test_ref_ptr(addr);
+    switch( size ) {
+    case 0: return SIGNEXT8(*p);
+    case 1: return SIGNEXT16(*((int16_t *)p));
+    default: return *((int32_t *)p);
+    }
+}
+
+static void test_ref_write( sh4addr_t addr, int size, uint32_t val )
+{
+    unsigned char *p = test_ref_ptr(addr);
+    switch( size ) {
+    case 0: *p = (uint8_t)val; break;
+    case 1: *((uint16_t *)p) = (uint16_t)val; break;
+    default: *((uint32_t *)p) = val; break;
+    }
+}
+
+/**
+ * DIV0U; 32 x (ROTCL Rq; DIV1 Rd, Rr), as per sh4core.in
+ */
+static void test_udiv_reference( struct sh4_registers *r, int rq, int rr, int rd )
+{
+    uint32_t tmp0, tmp1, tmp2, dir;
+    int i;
+
+    r->m = r->q = r->t = 0;
+    for( i=0; i<32; i++ ) {
+        tmp0 = r->r[rq] >> 31;
+        r->r[rq] = (r->r[rq] << 1) | r->t;
+        r->t = tmp0;
+
+        dir = r->q ^ r->m;
+        r->q = (r->r[rr] >> 31);
+        tmp2 = r->r[rd];
+        r->r[rr] = (r->r[rr] << 1) | r->t;
+        tmp0 = r->r[rr];
+        if( dir ) {
+            r->r[rr] += tmp2;
+            tmp1 = (r->r[rr]<tmp0 ? 1 : 0 );
+        } else {
+            r->r[rr] -= tmp2;
+            tmp1 = (r->r[rr]>tmp0 ? 1 : 0 );
+        }
+        r->q ^= r->m ^ tmp1;
+        r->t = ( r->q == r->m ? 1 : 0 );
+    }
+}
+
+/**
+ * Unsigned division by DIV1, both where the quotient fits in 32 bits (done 
+ * inline) and where it doesn't or the divisor is 0 (done by sh4_idiom_udiv)
+ */
+static void test_udiv( void )
+{
+    struct sh4_registers expect;
+    int i;
+
+    test_begin();
+    test_emit( OP_DIV0U );
+    for( i=0; i<32; i++ ) {
+        test_emit( OP_ROTCL(0) );
+        test_emit( OP_DIV1(2,1) );
+    }
+    test_emit( OP_SLEEP );
+
+    for( i=0; i<TEST_UDIV_COUNT; i++ ) {
+        test_reset_registers();
+        sh4r.t = test_random() & 1;
+        sh4r.q = test_random() & 1;
+        sh4r.m = test_random() & 1;
+        switch( i & 3 ) {
+        case 0: /* Fast path, R1 < R2 */
+            if( sh4r.r[2] == 0 ) {
+                sh4r.r[2] = 1;
+            }
+            sh4r.r[1] %= sh4r.r[2];
+            break;
+        case 1: /* Fast path with a small divisor */
+            sh4r.r[2] = (sh4r.r[2] & 0xFF) + 1;
+            sh4r.r[1] %= sh4r.r[2];
+            break;
+        case 2: /* Slow path, R1 >= R2 */
+            sh4r.r[1] = sh4r.r[2] + (uint32_t)(sh4r.r[1] % (0x100000000ULL - sh4r.r[2]));
+            break;
+        case 3: /* Slow path, division by 0 */
+            sh4r.r[2] = 0;
+            break;
+        }
+        expect = sh4r;
+        test_udiv_reference( &expect, 0, 1, 2 );
+        test_execute( TEST_CODE_VMA, TEST_EVENT_NEVER );
+        test_check_registers( "div1", i, &expect );
+    }
+}
+
+/**
+ * Copy/fill loops, of the form
+ *    [MOV.x @R1+, R2]; [ADD #size, R0]; MOV.x R2, @R0; [ADD #size, R0]; DT R3; BF
+ */
+struct test_copy_case {
+    const char *name;
+    int size;           /* log2 of the element size */
+    gboolean load;      /* Copy from @R1+, otherwise fill with R2 */
+    gboolean add_first; /* ADD before the store */
+    sh4addr_t dest;     /* Address of the first store */
+    sh4addr_t src;
+    uint32_t count;
+    uint32_t event_pending;
+    gboolean fallback;  /* TRUE if sh4_idiom_copy should decline it */
+};
+
+static struct test_copy_case test_copy_cases[] = {
+    { "copy.l", 2, TRUE, FALSE, TEST_DATA_VMA+0x1000, TEST_DATA_VMA, 64, TEST_EVENT_NEVER, FALSE },
+    { "copy.w overlapping downwards", 1, TRUE, FALSE, TEST_DATA_VMA, TEST_DATA_VMA+6, 100, TEST_EVENT_NEVER, FALSE },
+    { "copy.l overlapping upwards", 2, TRUE, FALSE, TEST_DATA_VMA+8, TEST_DATA_VMA, 64, TEST_EVENT_NEVER, TRUE },
+    { "copy.b to non-RAM", 0, TRUE, FALSE, TEST_IO_VMA+3, TEST_DATA_VMA+0x101, 200, TEST_EVENT_NEVER, TRUE },
+    { "fill.b", 0, FALSE, TRUE, TEST_DATA_VMA+0x2001, 0, 301, TEST_EVENT_NEVER, FALSE },
+    { "fill.l to non-RAM", 2, FALSE, FALSE, TEST_IO_VMA+0x100, 0, 32, TEST_EVENT_NEVER, TRUE },
+    { "copy.l with an event pending", 2, TRUE, FALSE, TEST_DATA_VMA+0x1000, TEST_DATA_VMA, 64, 1, TRUE },
+    { NULL, 0, FALSE, FALSE, 0, 0, 0, 0, FALSE } };
+
+static void test_copy_reference( struct sh4_registers *r, struct test_copy_case *c )
+{
+    do {
+        if( c->load ) {
+            r->r[2] = test_ref_read( r->r[1], c->size );
+            r->r[1] += (1<<c->size);
+        }
+        if( c->add_first ) {
+            r->r[0] += (1<<c->size);
+        }
+        test_ref_write( r->r[0], c->size, r->r[2] );
+        if( !c->add_first ) {
+            r->r[0] += (1<<c->size);
+        }
+        r->r[3]--;
+        r->t = (r->r[3] == 0 ? 1 : 0);
+    } while( !r->t );
+}
+
+static void test_copy( struct test_copy_case *c )
+{
+    struct sh4_registers expect;
+    uint32_t branch;
+
+    test_begin();
+    test_emit( OP_NOP ); /* Copy loops aren't matched at the start of a block */
+    if( c->load ) {
+        test_emit( OP_MOV_LDINC(c->size, 1, 2) );
+    }
+    if( c->add_first ) {
+        test_emit( OP_ADDI(1<<c->size, 0) );
+    }
+    test_emit( OP_MOV_ST(c->size, 2, 0) );
+    if( !c->add_first ) {
+        test_emit( OP_ADDI(1<<c->size, 0) );
+    }
+    test_emit( OP_DT(3) );
+    branch = test_code_length;
+    test_emit( OP_BF(-1 - (int)branch) ); /* Back to the instruction after the NOP */
+    test_emit( OP_SLEEP );
+
+    test_reset_registers();
+    test_reset_memory();
+    sh4r.r[0] = c->dest - (c->add_first ? (1<<c->size) : 0);
+    sh4r.r[1] = c->src;
+    sh4r.r[3] = c->count;
+    expect = sh4r;
+    test_copy_reference( &expect, c );
+
+    test_execute( TEST_CODE_VMA, c->event_pending );
+    if( c->event_pending != TEST_EVENT_NEVER ) {
+        /* Should have stopped before the loop, without changing anything */
+        if( sh4r.pc != TEST_CODE_VMA + 2 ) {
+            test_fail( c->name, 0, "stopped at %08X, expected %08X", sh4r.pc, TEST_CODE_VMA + 2 );
+        }
+        if( sh4r.r[0] != c->dest - (c->add_first ? (1<<c->size) : 0) ||
+                sh4r.r[1] != c->src || sh4r.r[3] != c->count ) {
+            test_fail( c->name, 0, "registers changed before the event" );
+        }
+        test_execute( sh4r.pc, TEST_EVENT_NEVER );
+    }
+    test_check_registers( c->name, 0, &expect );
+    test_check_memory( c->name, 0 );
+    test_check_fallback( c->name, TEST_CODE_VMA + 2, c->fallback );
+}
+
+/**
+ * Idle polling loops (MOV.L @R0, R1; TST R1, R1; BT loop). When polling main
+ * RAM, the loop should skip straight to the next event; otherwise it should
+ * keep looping within the block until the event (rather than leaving the
+ * block after each iteration).
+ */
+struct test_idle_case {
+    const char *name;
+    sh4addr_t addr;     /* Polled address */
+    gboolean skip;      /* TRUE if the loop should skip to the event */
+};
+
+static struct test_idle_case test_idle_cases[] = {
+    { "idle loop on RAM", TEST_DATA_VMA+0x10, TRUE },
+    { "idle loop on non-RAM", TEST_IO_VMA+0x10, FALSE },
+    { NULL, 0, FALSE } };
+
+static void test_idle( struct test_idle_case *c )
+{
+    uint32_t event_pending = 1001;
+
+    test_begin();
+    test_emit( OP_MOV_LD(2, 0, 1) );
+    test_emit( OP_TST(1, 1) );
+    test_emit( OP_BT(-4) );
+    test_emit( OP_SLEEP );
+
+    test_reset_registers();
+    test_reset_memory();
+    test_ref_write( c->addr, 2, 0 );
+    memcpy( dc_main_ram + (TEST_DATA_VMA&0x00FFFFFF), test_ref_data, TEST_DATA_SIZE );
+    memcpy( test_io, test_ref_io, sizeof(test_io) );
+    sh4r.r[0] = c->addr;
+
+    test_execute( TEST_CODE_VMA, event_pending );
+    if( sh4r.pc != TEST_CODE_VMA || sh4r.r[1] != 0 || sh4r.t != 1 ) {
+        test_fail( c->name, 0, "stopped at %08X with R1 = %08X, T = %d", sh4r.pc, sh4r.r[1], sh4r.t );
+    }
+    if( c->skip ? sh4r.slice_cycle != event_pending : sh4r.slice_cycle < event_pending ) {
+        test_fail( c->name, 0, "stopped at cycle %d, event at %d", sh4r.slice_cycle, event_pending );
+    }
+}
+
+/**
+ * Runs of MAC.W/MAC.L @R1+, @R0+
+ */
+struct test_mac_case {
+    const char *name;
+    gboolean mac_long;
+    uint32_t count;
+    gboolean saturate;  /* S bit */
+    sh4addr_t m, n;     /* Initial R1, R0 */
+    gboolean fallback;  /* TRUE if sh4_idiom_mac should decline it */
+};
+
+static struct test_mac_case test_mac_cases[] = {
+    { "mac.w", FALSE, 16, FALSE, TEST_DATA_VMA, TEST_DATA_VMA+0x802, FALSE },
+    { "mac.l", TRUE, 12, FALSE, TEST_DATA_VMA+0x100, TEST_DATA_VMA+0x400, FALSE },
+    { "mac.w saturating", FALSE, 16, TRUE, TEST_DATA_VMA, TEST_DATA_VMA+0x802, TRUE },
+    { "mac.l saturating", TRUE, 12, TRUE, TEST_DATA_VMA+0x100, TEST_DATA_VMA+0x400, TRUE },
+    { "mac.w from non-RAM", FALSE, 8, FALSE, TEST_IO_VMA+0x10, TEST_DATA_VMA, TRUE },
+    { NULL, FALSE, 0, FALSE, 0, 0, FALSE } };
+
+/**
+ * MAC.W/MAC.L @Rm+, @Rn+ with Rm != Rn, as per sh4core.in 
+ */
+static void test_mac_reference( struct sh4_registers *r, struct test_mac_case *c )
+{
+    int32_t stmp;
+    int64_t tmpl;
+    uint32_t i;
+
+    for( i=0; i<c->count; i++ ) {
+        if( c->mac_long ) {
+            tmpl = ((int64_t)test_ref_read( r->r[0], 2 )) * test_ref_read( r->r[1], 2 ) + r->mac;
+            r->r[0] += 4;
+            r->r[1] += 4;
+            if( r->s ) {
+                if( tmpl < (int64_t)0xFFFF800000000000LL )
+                    tmpl = 0xFFFF800000000000LL;
+                else if( tmpl > (int64_t)0x00007FFFFFFFFFFFLL )
+                    tmpl = 0x00007FFFFFFFFFFFLL;
+            }
+            r->mac = tmpl;
+        } else {
+            stmp = test_ref_read( r->r[0], 1 ) * test_ref_read( r->r[1], 1 );
+            r->r[0] += 2;
+            r->r[1] += 2;
+            if( r->s ) {
+                tmpl = (int64_t)((int32_t)r->mac) + (int64_t)stmp;
+                if( tmpl > (int64_t)0x000000007FFFFFFFLL ) {
+                    r->mac = 0x000000017FFFFFFFLL;
+                } else if( tmpl < (int64_t)0xFFFFFFFF80000000LL ) {
+                    r->mac = 0x0000000180000000LL;
+                } else {
+                    r->mac = (r->mac & 0xFFFFFFFF00000000LL) | ((uint32_t)(r->mac + stmp));
+                }
+            } else {
+                r->mac += SIGNEXT32(stmp);
+            }
+        }
+    }
+}
+
+static void test_mac( struct test_mac_case *c )
+{
+    struct sh4_registers expect;
+    uint32_t i;
+
+    test_begin();
+    test_emit( OP_NOP ); /* MAC runs aren't matched at the start of a block */
+    for( i=0; i<c->count; i++ ) {
+        test_emit( c->mac_long ? OP_MACL(1,0) : OP_MACW(1,0) );
+    }
+    test_emit( OP_SLEEP );
+
+    test_reset_registers();
+    test_reset_memory();
+    sh4r.r[0] = c->n;
+    sh4r.r[1] = c->m;
+    sh4r.s = c->saturate ? 1 : 0;
+    sh4r.sr |= c->saturate ? SR_S : 0;
+    sh4r.mac = (((uint64_t)test_random()) << 32) | test_random();
+    if( c->saturate ) {
+        /* Start in range, so that it saturates on the way */
+        if( c->mac_long ) {
+            sh4r.mac = ((int64_t)(sh4r.mac << 17)) >> 17;
+        } else {
+            sh4r.mac &= 0xFFFFFFFF7FFFFFFFULL;
+        }
+    }
+    expect = sh4r;
+    test_mac_reference( &expect, c );
+
+    test_execute( TEST_CODE_VMA, TEST_EVENT_NEVER );
+    test_check_registers( c->name, 0, &expect );
+    test_check_fallback( c->name, TEST_CODE_VMA + 2, c->fallback );
+}
+
+/**
+ * @return a random finite float, mostly of moderate magnitude but
+ * occasionally from the whole range (including denormals)
+ */
+static float test_random_float( void )
+{
+    union { uint32_t i; float f; } u;
+    uint32_t r = test_random();
+    if( (r & 3) == 0 ) {
+        u.i = test_random();
+        if( (u.i & 0x7F800000) == 0x7F800000 ) {
+            u.i &= 0xBFFFFFFF; /* Not Inf/NaN */
+        }
+    } else {
+        u.i = (test_random() & 0x807FFFFF) | (((r >> 2) % 41 + 107) << 23);
+    }
+    return u.f;
+}
+
+/**
+ * FTRV XMTRX, FV0; FIPR FV4, FV8; FSCA FPUL, FR12 on random inputs, which must
+ * give bit-identical results to sh4_ftrv, the interpreter's FIPR and 
+ * sh4_fsca. The FTRV is run with and without the SSE3 code path.
+ */
+static void test_fpu( gboolean sse3 )
+{
+    const char *name = sse3 ? "fpu (sse3)" : "fpu (sse)";
+    struct sh4_registers expect;
+    int i, j;
+
+    sh4_translate_set_sse3( sse3 );
+    test_begin();
+    test_emit( OP_FTRV(0) );
+    test_emit( OP_FIPR(1,2) );
+    test_emit( OP_LDS_FPUL(0) );
+    test_emit( OP_FSCA(12) );
+    test_emit( OP_SLEEP );
+
+    for( i=0; i<TEST_FPU_COUNT; i++ ) {
+        test_reset_registers();
+        for( j=0; j<16; j++ ) {
+            sh4r.fr[0][j] = test_random_float();
+            sh4r.fr[1][j] = test_random_float();
+        }
+        expect = sh4r;
+        sh4_ftrv( &expect.fr[0][0] ); /* Reads the matrix from sh4r */
+        expect.fr[0][11^1] = expect.fr[0][4^1]*expect.fr[0][8^1] +
+            expect.fr[0][5^1]*expect.fr[0][9^1] +
+            expect.fr[0][6^1]*expect.fr[0][10^1] +
+            expect.fr[0][7^1]*expect.fr[0][11^1];
+        expect.fpul.i = expect.r[0];
+        sh4_fsca( expect.fpul.i, &expect.fr[0][12] );
+
+        test_execute( TEST_CODE_VMA, TEST_EVENT_NEVER );
+        for( j=0; j<16; j++ ) {
+            if( memcmp( &sh4r.fr[0][j^1], &expect.fr[0][j^1], sizeof(float) ) != 0 ) {
+                test_fail( name, i, "FR%d = %08X, expected %08X", j, *((uint32_t *)&sh4r.fr[0][j^1]),
+                           *((uint32_t *)&expect.fr[0][j^1]) );
+            }
+        }
+        if( sh4r.fpul.i != expect.fpul.i ) {
+            test_fail( name, i, "FPUL = %08X, expected %08X", sh4r.fpul.i, expect.fpul.i );
+        }
+    }
+    sh4_translate_set_sse3( TRUE );
+}
+
+/**
+ * Set up main RAM and test_io_region in the address space, and run all the 
+ * tests.
+ * @return the number of failures
+ */
+static int test_run_all( void )
+{
+    uint32_t page;
+    int i;
+
+    for( page=0; page < (1<<20); page++ ) {
+        test_address_space[page] = &mem_region_unmapped;
+    }
+    for( page = 0x8C000; page < 0x8D000; page++ ) {
+        test_address_space[page] = &mem_region_sdram;
+    }
+    test_address_space[TEST_IO_VMA>>12] = &test_io_region;
+    sh4_address_space = sh4_user_address_space = test_address_space;
+
+    sh4_icache.mask = 0xFFFFF000;
+    sh4_icache.page_vma = TEST_CODE_VMA;
+    sh4_icache.page = (unsigned char *)test_code;
+    sh4_icache.page_ppa = TEST_CODE_PHYS;
+
+    xlat_cache_init();
+    sh4_translate_init();
+    sh4_translate_set_hot_threshold( 0 );
+
+    test_udiv();
+    for( i=0; test_copy_cases[i].name != NULL; i++ ) {
+        test_copy( &test_copy_cases[i] );
+    }
+    for( i=0; test_mac_cases[i].name != NULL; i++ ) {
+        test_mac( &test_mac_cases[i] );
+    }
+    for( i=0; test_idle_cases[i].name != NULL; i++ ) {
+        test_idle( &test_idle_cases[i] );
+    }
+    test_fpu( TRUE );
+    test_fpu( FALSE );
+
+    if( test_failures == 0 ) {
+        fprintf( stdout, "All translator self-tests passed\n" );
+    }
+    return test_failures;
+}
 
 
 int main( int argc, char *argv[] )
@@ -161,6 +823,9 @@ int main( int argc, char *argv[] )
 	case 's':
 	    start_addr = strtoul(optarg, NULL, 0);
 	    break;
+	case 't':
+	    run_tests = TRUE;
+	    break;
 	case 'h':
 	    usage();
 	    exit(0);
@@ -168,7 +833,7 @@ int main( int argc, char *argv[] )
     }
     if( optind < argc ) {
 	input_file = argv[optind++];
-    } else {
+    } else if( !run_tests ) {
 	usage();
 	exit(1);
     }
@@ -176,6 +841,10 @@ int main( int argc, char *argv[] )
     mmio_region_MMU.mem = malloc(4096);
     memset( mmio_region_MMU.mem, 0, 4096 );
 
+    if( run_tests ) {
+	return test_run_all() == 0 ? 0 : 1;
+    }
+
     ((uint32_t *)mmio_region_MMU.mem)[4] = 1;
 
     in = fopen( input_file, "ro" );
@@ -18,15 +18,33 @@
 
 #include <assert.h>
 #include "xlat/xltcache.h"
+#include "xlat/xltperf.h"
 #include "dreamcast.h"
 
 extern xlat_cache_block_t xlat_new_cache;
 extern xlat_cache_block_t xlat_new_cache_ptr;
+extern xlat_cache_block_t xlat_temp_cache;
+extern xlat_cache_block_t xlat_old_cache;
 
 void sh4_translate_unlink_block( void *use_list )
 {
 }
 
+xlat_perf_format_t xlat_perf_format = XLAT_PERF_NONE;
+void xlat_perf_move_block( xlat_cache_block_t block, xlat_cache_block_t dest ) { }
+void xlat_perf_unload_block( xlat_cache_block_t block ) { }
+void xlat_perf_unload_all( void ) { }
+
+unsigned char dc_main_ram[4096];
+
+void mem_protect( void *ptr, uint32_t size )
+{
+}
+
+void mem_unprotect( void *ptr, uint32_t size )
+{
+}
+
 /**
  * Test initial allocations from the new cache
  */
@@ -79,11 +97,217 @@ void test_initial()
     assert( addr == &block3a->code );
 }
 
+/**
+ * Test the indirect branch target cache fill and invalidation
+ */
+void test_target_cache()
+{
+    uint64_t hits, misses, hits0, misses0;
+    xlat_get_target_cache_stats( &hits0, &misses0 );
+
+    xlat_cache_block_t block = xlat_start_block( 0x0C010000 );
+    block->xlat_sh4_mode = 0;
+    memset( block->code, 0x90, 256 );
+    xlat_commit_block( 256, 0x0C010000, 0x0C010010 );
+
+    assert( xlat_target_cache_miss( 0x8C010000, 1 ) == NULL );
+    assert( xlat_target_cache_miss( 0x8C010000, 0 ) == &block->code );
+    xlat_target_cache_entry_t ent = &xlat_target_cache[XLAT_TARGET_CACHE_INDEX(0x8C010000)];
+    assert( ent->vma == 0x8C010000 );
+    assert( ent->code == &block->code );
+    ent->hits = 5;
+
+    xlat_delete_block( block );
+    assert( ent->vma == XLAT_TARGET_CACHE_EMPTY );
+    assert( ent->code == NULL );
+    xlat_get_target_cache_stats( &hits, &misses );
+    assert( hits == hits0 + 5 );
+    assert( misses == misses0 + 2 );
+}
+
+/**
+ * Test replacing a block with a new translation for the same address (as
+ * done when re-translating a hot block)
+ */
+void test_replace_block()
+{
+    xlat_cache_block_t block = xlat_start_block( 0x0C020000 );
+    memset( block->code, 0x90, 256 );
+    xlat_commit_block( 256, 0x0C020000, 0x0C020010 );
+    xlat_cache_block_t block2 = xlat_start_block( 0x0C020000 );
+    memset( block2->code, 0x90, 256 );
+    xlat_commit_block( 256, 0x0C020000, 0x0C020010 );
+    assert( block2->chain == &block->code );
+
+    xlat_delete_block( block );
+    assert( xlat_get_code( 0x0C020000 ) == &block2->code );
+    assert( block2->chain == NULL );
+    xlat_delete_block( block2 );
+    assert( xlat_get_code( 0x0C020000 ) == NULL );
+}
+
+/**
+ * Test invalidating a block that runs on into the next LUT page, through
+ * writes to the second page
+ */
+void test_spanning_block()
+{
+    xlat_cache_block_t block = xlat_start_block( 0x0C05F000 );
+    memset( block->code, 0x90, 256 );
+    xlat_commit_block( 256, 0x0C05F000, 0x0C060800 );
+
+    /* Writes past the end of the block leave it alone */
+    xlat_invalidate_word( 0x0C060800 );
+    xlat_invalidate_block( 0x0C060800, 0x100 );
+    assert( xlat_get_code( 0x0C05F000 ) == &block->code );
+    xlat_invalidate_word( 0x0C0607FE );
+    assert( xlat_get_code( 0x0C05F000 ) == NULL );
+
+    block = xlat_start_block( 0x0C05F000 );
+    memset( block->code, 0x90, 256 );
+    xlat_commit_block( 256, 0x0C05F000, 0x0C060800 );
+    xlat_invalidate_long( 0x0C060400 );
+    assert( xlat_get_code( 0x0C05F000 ) == NULL );
+
+    block = xlat_start_block( 0x0C05F000 );
+    memset( block->code, 0x90, 256 );
+    xlat_commit_block( 256, 0x0C05F000, 0x0C060800 );
+    xlat_invalidate_block( 0x0C060100, 0x10 );
+    assert( xlat_get_code( 0x0C05F000 ) == NULL );
+}
+
+/**
+ * Create a block with an (empty) recovery and fixup table, so that it can be
+ * moved between cache spaces
+ */
+static xlat_cache_block_t make_movable_block( sh4addr_t address, int size )
+{
+    xlat_cache_block_t block = xlat_start_block( address );
+    if( block->size < size ) {
+        block = xlat_extend_block( size );
+    }
+    memset( block->code, 0x90, size );
+    block->recover_table_offset = size - sizeof(struct xlat_recovery_record) - sizeof(uint32_t);
+    block->recover_table_size = 1;
+    XLAT_FIXUP_TABLE(block)[0] = 0;
+    xlat_commit_block( size, address, address+2 );
+    return block;
+}
+
+static int in_space( void *code, xlat_cache_block_t space, uint32_t size )
+{
+    return (uintptr_t)code >= (uintptr_t)space && (uintptr_t)code < ((uintptr_t)space) + size;
+}
+
+/**
+ * Test promotion of blocks through the temp and old spaces of the
+ * generational cache
+ */
+void test_generational()
+{
+    struct xlat_cache_stats stats, stats0;
+    int i;
+
+    xlat_configure_cache( TRUE, 64*1024, 64*1024, 16*1024, 32*1024 );
+    xlat_get_cache_stats( &stats0 );
+    assert( stats0.live_blocks[XLAT_SPACE_NEW] == 0 );
+
+    /* Fill the new space twice over - the first blocks are pushed out to temp */
+    for( i=0; i<128; i++ ) {
+        make_movable_block( 0x0C030000 + i*0x100, 1024 );
+    }
+    xlat_get_cache_stats( &stats );
+    assert( stats.temp_promotions > stats0.temp_promotions );
+    assert( stats.live_blocks[XLAT_SPACE_TEMP] > 0 );
+    void *code = xlat_get_code( 0x0C030000 + 64*0x100 );
+    assert( code != NULL && in_space( code, xlat_temp_cache, 16*1024 ) );
+    XLAT_BLOCK_MARK_USED(code);
+    xlat_check_integrity();
+
+    /* Keep going until the temp space wraps - the used block goes to old space,
+     * while unused blocks are discarded */
+    for( i=128; i<256; i++ ) {
+        make_movable_block( 0x0C030000 + i*0x100, 1024 );
+    }
+    xlat_get_cache_stats( &stats );
+    assert( stats.old_promotions == stats0.old_promotions + 1 );
+    assert( stats.evictions > stats0.evictions );
+    assert( stats.live_blocks[XLAT_SPACE_OLD] == 1 );
+    code = xlat_get_code( 0x0C030000 + 64*0x100 );
+    assert( code != NULL && in_space( code, xlat_old_cache, 32*1024 ) );
+    assert( xlat_get_code( 0x0C030000 + 65*0x100 ) == NULL );
+    xlat_check_integrity();
+
+    /* Blocks without a fixup table can't be moved, and are simply discarded */
+    xlat_flush_cache();
+    xlat_get_cache_stats( &stats0 );
+    for( i=0; i<128; i++ ) {
+        xlat_cache_block_t block = xlat_start_block( 0x0C030000 + i*0x100 );
+        if( block->size < 1024 ) {
+            block = xlat_extend_block( 1024 );
+        }
+        memset( block->code, 0x90, 1024 );
+        xlat_commit_block( 1024, 0x0C030000 + i*0x100, 0x0C030002 + i*0x100 );
+    }
+    xlat_get_cache_stats( &stats );
+    assert( stats.temp_promotions == stats0.temp_promotions );
+    assert( stats.live_blocks[XLAT_SPACE_TEMP] == 0 );
+    assert( stats.flushes == stats0.flushes );
+    assert( xlat_get_code( 0x0C030000 ) == NULL );
+    xlat_check_integrity();
+}
+
+/**
+ * Test growing the new space up to its limit, and skipping over used blocks
+ * once it's full
+ */
+void test_growth()
+{
+    struct xlat_cache_stats stats;
+    int i;
+
+    xlat_configure_cache( FALSE, 64*1024, 256*1024, 0, 0 );
+    xlat_get_cache_stats( &stats );
+    assert( stats.new_space_size == 64*1024 );
+
+    /* 192KB of blocks fit without evicting anything */
+    for( i=0; i<192; i++ ) {
+        make_movable_block( 0x0C040000 + i*0x100, 1024 );
+    }
+    xlat_get_cache_stats( &stats );
+    assert( stats.new_space_size == 256*1024 );
+    assert( stats.grows == 2 );
+    assert( stats.live_blocks[XLAT_SPACE_NEW] == 192 );
+    assert( xlat_get_code( 0x0C040000 ) != NULL );
+    xlat_check_integrity();
+
+    /* Once it's full, used blocks survive the next pass */
+    void *code = xlat_get_code( 0x0C040000 + 3*0x100 );
+    XLAT_BLOCK_MARK_USED(code);
+    for( i=192; i<320; i++ ) {
+        make_movable_block( 0x0C040000 + i*0x100, 1024 );
+    }
+    xlat_get_cache_stats( &stats );
+    assert( stats.new_space_size == 256*1024 );
+    assert( stats.aged == 1 );
+    assert( xlat_get_code( 0x0C040000 + 3*0x100 ) == code );
+    assert( XLAT_BLOCK_FOR_CODE(code)->active == 1 );
+    assert( xlat_get_code( 0x0C040000 ) == NULL );
+    xlat_check_integrity();
+}
+
 int main()
 {
     xlat_cache_init();
+    xlat_configure_cache( FALSE, XLAT_NEW_CACHE_SIZE, XLAT_NEW_CACHE_SIZE, 0, 0 );
     xlat_check_integrity();
     
     test_initial();
+    test_target_cache();
+    test_replace_block();
+    test_spanning_block();
+    xlat_check_integrity();
+    test_growth();
+    test_generational();
     return 0;
 }
@@ -131,8 +131,14 @@ actiontoken_t action_file_next( actionfile_t af )
             (af->token.symbol == NONE && af->text[af->yyposn] == '%' && af->text[af->yyposn+1] == '%') ) {
         /* Begin action block */
         af->token.symbol = ACTIONS;
+        af->token.threaded = 0;
         memset( af->token.actions, 0, sizeof(af->token.actions) );
 
+        if( strncmp( &af->text[af->yyposn], "threaded", 8 ) == 0 &&
+                isspace(af->text[af->yyposn+8]) ) {
+            af->token.threaded = 1;
+            af->yyposn += 8;
+        }
         char *operation = &af->text[af->yyposn];
         while( af->yyposn < af->length ) {
             if( af->text[af->yyposn] == '\n' ) {
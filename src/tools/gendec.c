@@ -38,15 +38,26 @@ const char *out_filename = NULL;
 
 FILE *ins_file, *act_file, *out_file;
 
-char *option_list = "tmho:w";
+/* Table decoders are generated for 16-bit instructions, either as a single
+ * 65536-entry table or as 256 rows (indexed by the high byte) of 256 entries,
+ * with identical rows shared */
+#define TABLE_NONE 0
+#define TABLE_FLAT 1
+#define TABLE_SPLIT 2
+#define TABLE_ENTRIES 65536
+#define TABLE_ROW_SIZE 256
+
+char *option_list = "tmho:wj::";
 int gen_mode = GEN_SOURCE;
 int emit_warnings = 0;
+int table_mode = TABLE_NONE;
 
 struct option longopts[] = { 
     { "help", no_argument, NULL, 'h' },
     { "output", required_argument, NULL, 'o' },
     { "template", no_argument, NULL, 't' },
     { "warnings", no_argument, NULL, 'w' },
+    { "table", optional_argument, NULL, 'j' },
     { NULL, 0, 0, 0 } };
 
 static void usage() {
@@ -56,6 +67,8 @@ static void usage() {
     printf( "  -o, --output=FILE  Generate output to the given file\n" );
     printf( "  -t, --template     Generate a template skeleton instead of an instruction matcher\n" );
     printf( "  -w, --warnings     Emit warnings when unmatched instructions are found\n" );
+    printf( "  -j, --table[=2]    Decode with a lookup table instead of a decision tree\n" );
+    printf( "                     (with =2, a two-level table of 256x256 entries)\n" );
 }
 
 /**
@@ -209,16 +222,37 @@ static void fprint_action( struct rule *rule, const struct action *action, int d
     }
 }
 
+/**
+ * Print a leaf of a threaded block's decoder, which hands the address of the
+ * rule's handler (or of the undefined-instruction handler) to THREADED_DECODED
+ */
+static void fprint_decoded( struct rule *rule, int rule_no, int depth, FILE *f )
+{
+    if( rule == NULL ) {
+        fprintf( f, "%*cTHREADED_DECODED(&&threaded_undef);\n", depth*8, ' ' );
+    } else {
+        fprintf( f, "%*cTHREADED_DECODED(&&threaded_%d); /* %s */\n", depth*8, ' ', rule_no, rule->format );
+    }
+}
+
 static void split_and_generate( struct ruleset *rules, const struct action *actions, 
                          int ruleidx[], int rule_count, int input_mask, 
-                         int depth, FILE *f ) {
+                         int depth, int threaded, FILE *f ) {
     uint32_t mask;
     int i,j;
 
     if( rule_count == 0 ) {
-        fprintf( f, "%*cUNDEF(ir);\n", depth*8, ' ' );
+        if( threaded ) {
+            fprint_decoded( NULL, -1, depth, f );
+        } else {
+            fprintf( f, "%*cUNDEF(ir);\n", depth*8, ' ' );
+        }
     } else if( rule_count == 1 ) {
-        fprint_action( rules->rules[ruleidx[0]], &actions[ruleidx[0]], depth, f );
+        if( threaded ) {
+            fprint_decoded( rules->rules[ruleidx[0]], ruleidx[0], depth, f );
+        } else {
+            fprint_action( rules->rules[ruleidx[0]], &actions[ruleidx[0]], depth, f );
+        }
     } else {
 
         mask = find_mask(rules, ruleidx, rule_count, input_mask);
@@ -259,18 +293,216 @@ static void split_and_generate( struct ruleset *rules, const struct action *acti
             } else {
                 fprintf( f, "%*ccase 0x%X:\n", depth*8+4, ' ', options[i]>>mask_shift );
                 split_and_generate( rules, actions, subruleidx, subrule_count,
-                                    mask|input_mask, depth+1, f );
+                                    mask|input_mask, depth+1, threaded, f );
                 fprintf( f, "%*cbreak;\n", depth*8+8, ' ' );
             }
         }
         if( has_empty_options ) {
-            fprintf( f, "%*cdefault:\n%*cUNDEF(ir);\n%*cbreak;\n",
-                    depth*8+4, ' ', depth*8+8, ' ', depth*8 + 8, ' ' );
+            fprintf( f, "%*cdefault:\n", depth*8+4, ' ' );
+            if( threaded ) {
+                fprint_decoded( NULL, -1, depth+1, f );
+            } else {
+                fprintf( f, "%*cUNDEF(ir);\n", depth*8+8, ' ' );
+            }
+            fprintf( f, "%*cbreak;\n", depth*8+8, ' ' );
         }
         fprintf( f, "%*c}\n", depth*8, ' ' );
     }
 }
 
+/**
+ * Decode a single instruction the same way as the decision tree built by
+ * split_and_generate, which only tests the bits needed to tell the remaining
+ * rules apart (so an instruction isn't necessarily checked against every bit
+ * of the rule it ends up with).
+ * @return the index of the matching rule, -1 if there is none, or -2 if the
+ * rules can't be told apart.
+ */
+static int decode_instruction( struct ruleset *rules, int ruleidx[], int rule_count,
+                               uint32_t input_mask, uint32_t ir )
+{
+    uint32_t mask;
+    int j;
+
+    if( rule_count == 0 ) {
+        return -1;
+    } else if( rule_count == 1 ) {
+        return ruleidx[0];
+    }
+
+    mask = find_mask(rules, ruleidx, rule_count, input_mask);
+    if( mask == 0 ) {
+        fprintf( stderr, "Error: unable to find a valid bitmask (%d rules, %08X input mask)\n", rule_count, input_mask );
+        dump_rulesubset( rules, ruleidx, rule_count, stderr );
+        return -2;
+    }
+
+    int subruleidx[rule_count];
+    int subrule_count = 0;
+    for( j=0; j<rule_count; j++ ) {
+        if( (rules->rules[ruleidx[j]]->bits & mask) == (ir & mask) ) {
+            subruleidx[subrule_count++] = ruleidx[j];
+        }
+    }
+    return decode_instruction( rules, subruleidx, subrule_count, mask|input_mask, ir );
+}
+
+/**
+ * Fill in table with the rule matched by each 16-bit instruction, using
+ * rule_count for undefined instructions.
+ * @return 0 on success, otherwise -1
+ */
+static int build_decode_table( struct ruleset *rules, int ruleidx[], int table[] )
+{
+    uint32_t i;
+
+    for( i=0; i<rules->rule_count; i++ ) {
+        if( rules->rules[i]->bit_count > 16 ) {
+            fprintf( stderr, "Error: table decoding requires 16-bit instructions (rule %s)\n",
+                     rules->rules[i]->format );
+            return -1;
+        }
+    }
+    for( i=0; i<TABLE_ENTRIES; i++ ) {
+        int rule = decode_instruction( rules, ruleidx, rules->rule_count, 0, i );
+        if( rule == -2 ) {
+            return -1;
+        }
+        table[i] = (rule == -1 ? rules->rule_count : rule);
+    }
+    return 0;
+}
+
+static void fprint_table_values( const int values[], int count, int depth, FILE *f )
+{
+    int i;
+    for( i=0; i<count; i++ ) {
+        if( (i&0x0F) == 0 ) {
+            fprintf( f, "%*c", depth*8, ' ' );
+        }
+        fprintf( f, "%d%s", values[i], i == count-1 ? "\n" : ((i&0x0F) == 0x0F ? ",\n" : ", ") );
+    }
+}
+
+/**
+ * Emit the static lookup table(s) for the current block, and return the C
+ * expression that looks up ir in them.
+ */
+static const char *fprint_decode_table( const int table[], int depth, FILE *f )
+{
+    if( table_mode == TABLE_FLAT ) {
+        fprintf( f, "%*cstatic const uint16_t gendec_table[%d] = {\n", depth*8, ' ', TABLE_ENTRIES );
+        fprint_table_values( table, TABLE_ENTRIES, depth+1, f );
+        fprintf( f, "%*c};\n", depth*8, ' ' );
+        return "gendec_table[ir&0xFFFF]";
+    } else {
+        int rows[TABLE_ENTRIES/TABLE_ROW_SIZE];
+        int row_start[TABLE_ENTRIES/TABLE_ROW_SIZE];
+        int row_count = 0, i, j;
+
+        for( i=0; i<TABLE_ENTRIES/TABLE_ROW_SIZE; i++ ) {
+            const int *row = &table[i*TABLE_ROW_SIZE];
+            for( j=0; j<row_count; j++ ) {
+                if( memcmp( row, &table[row_start[j]], TABLE_ROW_SIZE*sizeof(int) ) == 0 ) {
+                    break;
+                }
+            }
+            if( j == row_count ) {
+                row_start[row_count++] = i*TABLE_ROW_SIZE;
+            }
+            rows[i] = j;
+        }
+
+        fprintf( f, "%*cstatic const uint8_t gendec_rows[%d] = {\n", depth*8, ' ', TABLE_ENTRIES/TABLE_ROW_SIZE );
+        fprint_table_values( rows, TABLE_ENTRIES/TABLE_ROW_SIZE, depth+1, f );
+        fprintf( f, "%*c};\n", depth*8, ' ' );
+        fprintf( f, "%*cstatic const uint16_t gendec_table[%d][%d] = {\n", depth*8, ' ', row_count, TABLE_ROW_SIZE );
+        for( j=0; j<row_count; j++ ) {
+            fprintf( f, "%*c{\n", depth*8+4, ' ' );
+            fprint_table_values( &table[row_start[j]], TABLE_ROW_SIZE, depth+1, f );
+            fprintf( f, "%*c}%s\n", depth*8+4, ' ', j == row_count-1 ? "" : "," );
+        }
+        fprintf( f, "%*c};\n", depth*8, ' ' );
+        return "gendec_table[gendec_rows[(ir>>8)&0xFF]][ir&0xFF]";
+    }
+}
+
+/**
+ * Generate a table decoder for a regular block - a switch on the rule number
+ * looked up from the instruction, with a case for each rule that can match.
+ */
+static int generate_table( struct ruleset *rules, const struct action *actions,
+                           int ruleidx[], FILE *f )
+{
+    int table[TABLE_ENTRIES];
+    char used[MAX_RULES+1];
+    const char *lookup;
+    uint32_t i;
+
+    if( build_decode_table( rules, ruleidx, table ) != 0 ) {
+        return -1;
+    }
+    memset( used, 0, sizeof(used) );
+    for( i=0; i<TABLE_ENTRIES; i++ ) {
+        used[table[i]] = 1;
+    }
+
+    fprintf( f, "%*c{\n", 8, ' ' );
+    lookup = fprint_decode_table( table, 1, f );
+    fprintf( f, "%*cswitch( %s ) {\n", 8, ' ', lookup );
+    for( i=0; i<rules->rule_count; i++ ) {
+        if( used[i] ) {
+            fprintf( f, "%*ccase %d:\n", 12, ' ', i );
+            fprint_action( rules->rules[i], &actions[i], 2, f );
+            fprintf( f, "%*cbreak;\n", 16, ' ' );
+        }
+    }
+    fprintf( f, "%*cdefault:\n%*cUNDEF(ir);\n%*cbreak;\n", 12, ' ', 16, ' ', 16, ' ' );
+    fprintf( f, "%*c}\n%*c}\n", 8, ' ', 8, ' ' );
+    return 0;
+}
+
+/**
+ * Generate a threaded block (one introduced by "%%threaded"). Rather than
+ * executing the matching action in place, the decoder passes the address of a
+ * per-rule label to THREADED_DECODED(), and the actions follow it as
+ * labelled handlers, each (including the undefined-instruction handler) ending
+ * in THREADED_NEXT(). The action file defines both macros, which are expected
+ * to transfer control with a computed goto - the decoder need only run once
+ * per instruction, and the handler addresses can be cached. Labels are local
+ * to the enclosing function, so only one threaded block can appear in each.
+ */
+static int generate_threaded( struct ruleset *rules, const struct action *actions,
+                              int ruleidx[], FILE *f )
+{
+    int i;
+
+    if( table_mode != TABLE_NONE ) {
+        int table[TABLE_ENTRIES];
+        const char *lookup;
+        if( build_decode_table( rules, ruleidx, table ) != 0 ) {
+            return -1;
+        }
+        fprintf( f, "%*c{\n", 8, ' ' );
+        fprintf( f, "%*cstatic void * const gendec_handlers[%d] = {\n", 8, ' ', rules->rule_count+1 );
+        for( i=0; i<rules->rule_count; i++ ) {
+            fprintf( f, "%*c&&threaded_%d,\n", 16, ' ', i );
+        }
+        fprintf( f, "%*c&&threaded_undef\n%*c};\n", 16, ' ', 8, ' ' );
+        lookup = fprint_decode_table( table, 1, f );
+        fprintf( f, "%*cTHREADED_DECODED(gendec_handlers[%s]);\n%*c}\n", 8, ' ', lookup, 8, ' ' );
+    } else {
+        split_and_generate( rules, actions, ruleidx, rules->rule_count, 0, 1, 1, f );
+    }
+    for( i=0; i<rules->rule_count; i++ ) {
+        fprintf( f, "threaded_%d:\n", i );
+        fprint_action( rules->rules[i], &actions[i], 1, f );
+        fprintf( f, "%*cTHREADED_NEXT();\n", 8, ' ' );
+    }
+    fprintf( f, "threaded_undef:\n%*cUNDEF(ir);\n%*cTHREADED_NEXT();\n", 8, ' ', 8, ' ' );
+    return 0;
+}
+
 static int generate_decoder( struct ruleset *rules, actionfile_t af, FILE *out )
 {
     int ruleidx[rules->rule_count];
@@ -293,7 +525,17 @@ static int generate_decoder( struct ruleset *rules, actionfile_t af, FILE *out )
                 check_actions( rules, token );
             }
             fprintf( out, "#pragma clang diagnostic push\n#pragma clang diagnostic ignored \"-Wunused-variable\"\n" );
-            split_and_generate( rules, token->actions, ruleidx, rules->rule_count, 0, 1, out );
+            if( token->threaded ) {
+                if( generate_threaded( rules, token->actions, ruleidx, out ) != 0 ) {
+                    return -1;
+                }
+            } else if( table_mode != TABLE_NONE ) {
+                if( generate_table( rules, token->actions, ruleidx, out ) != 0 ) {
+                    return -1;
+                }
+            } else {
+                split_and_generate( rules, token->actions, ruleidx, rules->rule_count, 0, 1, 0, out );
+            }
             fprintf( out, "#pragma clang diagnostic pop\n" );
         }
         token = action_file_next(af);
@@ -313,7 +555,7 @@ static int generate_template( struct ruleset *rules, actionfile_t af, FILE *out
             fprintf( stderr, "Error parsing action file" );
             return -1;
         } else {
-            fputs( "%%\n", out );
+            fputs( token->threaded ? "%%threaded\n" : "%%\n", out );
             for( i=0; i<rules->rule_count; i++ ) {
                 fprintf( out, "%s {: %s :}\n", rules->rules[i]->format,
                         token->actions[i].text == NULL ? "" : token->actions[i].text );
@@ -343,6 +585,16 @@ int main( int argc, char *argv[] )
         case 'w':
             emit_warnings = 1;
             break;
+        case 'j':
+            if( optarg == NULL || strcmp( optarg, "1" ) == 0 ) {
+                table_mode = TABLE_FLAT;
+            } else if( strcmp( optarg, "2" ) == 0 ) {
+                table_mode = TABLE_SPLIT;
+            } else {
+                usage();
+                exit(1);
+            }
+            break;
         case 'h':
             usage();
             exit(0);
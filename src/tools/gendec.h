@@ -77,6 +77,7 @@ typedef struct actiontoken {
     const char *filename;
     int lineno;
     char *text;
+    int threaded; /* ACTIONS block introduced by "%%threaded" */
     struct action actions[MAX_RULES];
 } *actiontoken_t;
 
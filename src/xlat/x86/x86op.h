@@ -143,7 +143,13 @@ extern unsigned char *xlat_output;
 #define OP16(x) *((uint16_t *)xlat_output) = (x); xlat_output+=2
 #define OP32(x) *((uint32_t *)xlat_output) = (x); xlat_output+=4
 #define OP64(x) *((uint64_t *)xlat_output) = (x); xlat_output+=8
-#define OPPTR(x) *((void **)xlat_output) = ((void *)x); xlat_output+=(sizeof(void*))
+
+/* Called before emitting an absolute pointer (to allow relocation) */
+#ifndef XLAT_RELOC
+#define XLAT_RELOC()
+#endif
+
+#define OPPTR(x) XLAT_RELOC(); *((void **)xlat_output) = ((void *)x); xlat_output+=(sizeof(void*))
 
 /* Primary opcode emitter, eg OPCODE(0x0FBE) for MOVSX */
 #define OPCODE(x) if( (x) > 0xFFFF ) { OP((x)>>16); OP(((x)>>8)&0xFF); OP((x)&0xFF); } else if( (x) > 0xFF ) { OP((x)>>8); OP((x)&0xFF); } else { OP(x); }
@@ -408,6 +414,7 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define CMPQ_imms_r64(imm,r1)        x86_encode_imms_rm64(0x83, 0x81, 7, imm, r1)
 #define CMPQ_r64_r64(r1,r2)          x86_encode_r64_rm64(0x39, r1, r2)
 
+#define DIVL_r32(r1)                 x86_encode_r32_rm32(0xF7, 6, r1)
 #define IDIVL_r32(r1)                x86_encode_r32_rm32(0xF7, 7, r1)
 #define IDIVL_rbpdisp(disp)          x86_encode_r32_rbpdisp32(0xF7, 7, disp)
 #define IDIVQ_r64(r1)                x86_encode_r64_rm64(0xF7, 7, r1)
@@ -434,6 +441,7 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define LEAP_sib_rptr(ss,ii,bb,d,r1) x86_encode_rptr_memptr(0x8D, r1, bb, ii, ss, d)
 
 #define MOVB_r8_r8(r1,r2)            x86_encode_r32_rm32(0x88, r1, r2)
+#define MOVB_r8_sib(r1,ss,ii,bb,d)   x86_encode_r32_mem32(0x88, r1, bb, ii, ss, d)
 #define MOVL_imm32_r32(i32,r1)       x86_encode_opcode32(0xB8, r1); OP32(i32)
 #define MOVL_imm32_rbpdisp(i,disp)   x86_encode_r32_rbpdisp32(0xC7,0,disp); OP32(i)
 #define MOVL_imm32_rspdisp(i,disp)   x86_encode_r32_rspdisp32(0xC7,0,disp); OP32(i)
@@ -459,11 +467,14 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define MOVP_rptr_rptr(r1,r2)        x86_encode_reg_rm(PREF_PTR, 0x89, r1, r2)
 #define MOVP_sib_rptr(ss,ii,bb,d,r1) x86_encode_rptr_memptr(0x8B, r1, bb, ii, ss, d)
 #define MOVP_rptrdisp_rptr(r1,dsp,r2) x86_encode_rptr_memptrdisp(0x8B, r2, r1, dsp)
+#define MOVP_rptr_rptrdisp(r1,r2,dsp) x86_encode_rptr_memptrdisp(0x89, r1, r2, dsp)
 
 #define MOVSXL_r8_r32(r1,r2)         x86_encode_r32_rm32(0x0FBE, r2, r1)
 #define MOVSXL_r16_r32(r1,r2)        x86_encode_r32_rm32(0x0FBF, r2, r1)
 #define MOVSXL_rbpdisp8_r32(disp,r1) x86_encode_r32_rbpdisp32(0x0FBE, r1, disp) 
 #define MOVSXL_rbpdisp16_r32(dsp,r1) x86_encode_r32_rbpdisp32(0x0FBF, r1, dsp) 
+#define MOVSXL_sib8_r32(ss,ii,bb,d,r1) x86_encode_r32_mem32(0x0FBE, r1, bb, ii, ss, d)
+#define MOVSXL_sib16_r32(ss,ii,bb,d,r1) x86_encode_r32_mem32(0x0FBF, r1, bb, ii, ss, d)
 #define MOVSXQ_imm32_r64(i32,r1)     x86_encode_r64_rm64(0xC7, 0, r1); OP32(i32) /* Technically a MOV */
 #define MOVSXQ_r8_r64(r1,r2)         x86_encode_r64_rm64(0x0FBE, r2, r1)
 #define MOVSXQ_r16_r64(r1,r2)        x86_encode_r64_rm64(0x0FBF, r2, r1)
@@ -475,6 +486,8 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define MOVZXL_rbpdisp8_r32(disp,r1) x86_encode_r32_rbpdisp32(0x0FB6, r1, disp)
 #define MOVZXL_rbpdisp16_r32(dsp,r1) x86_encode_r32_rbpdisp32(0x0FB7, r1, dsp)
 
+#define MOVW_r16_sib(r1,ss,ii,bb,d)  OP(0x66); x86_encode_r32_mem32(0x89, r1, bb, ii, ss, d)
+
 #define MULL_r32(r1)                 x86_encode_r32_rm32(0xF7, 4, r1)
 #define MULL_rbpdisp(disp)           x86_encode_r32_rbpdisp32(0xF7,4,disp)
 #define MULL_rspdisp(disp)           x86_encode_r32_rspdisp32(0xF7,4,disp)
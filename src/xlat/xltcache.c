@@ -18,12 +18,14 @@
 
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <signal.h>
 #include <assert.h>
 
 #include "dreamcast.h"
 #include "sh4/sh4core.h"
 #include "sh4/sh4trans.h"
 #include "xlat/xltcache.h"
+#include "xlat/xltperf.h"
 
 #define XLAT_LUT_PAGE_BITS 12
 #define XLAT_LUT_TOTAL_BITS 28
@@ -51,6 +53,14 @@
 #define MIN_BLOCK_SIZE 32
 #define MIN_TOTAL_SIZE (sizeof(struct xlat_cache_block)+MIN_BLOCK_SIZE)
 
+/* The new space is reserved at its maximum size, and committed in multiples
+ * of this (which must be a multiple of the system page size) as it grows */
+#define XLAT_CACHE_GRANULARITY (64*1024)
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
 #define BLOCK_INACTIVE 0
 #define BLOCK_ACTIVE 1
 #define BLOCK_USED 2
@@ -59,33 +69,141 @@ xlat_cache_block_t xlat_new_cache;
 xlat_cache_block_t xlat_new_cache_ptr;
 xlat_cache_block_t xlat_new_create_ptr;
 
-#ifdef XLAT_GENERATIONAL_CACHE
+/* Generational cache: blocks evicted from the new space are moved to the temp 
+ * space, and from there to the old space if they were used while in the temp
+ * space. Otherwise blocks are just discarded when evicted */
+static gboolean xlat_generational = FALSE;
 xlat_cache_block_t xlat_temp_cache;
 xlat_cache_block_t xlat_temp_cache_ptr;
 xlat_cache_block_t xlat_old_cache;
 xlat_cache_block_t xlat_old_cache_ptr;
-#endif
+
+static uint32_t xlat_new_cache_size = XLAT_NEW_CACHE_SIZE; /* Current (committed) size */
+static uint32_t xlat_new_cache_max_size = XLAT_NEW_CACHE_MAX_SIZE;
+static uint32_t xlat_temp_cache_size = XLAT_TEMP_CACHE_SIZE;
+static uint32_t xlat_old_cache_size = XLAT_OLD_CACHE_SIZE;
+
+static struct xlat_cache_stats xlat_stats;
+
+/* Background translation arena */
+static xlat_cache_block_t xlat_arena;
+static xlat_cache_block_t xlat_arena_ptr; /* Next free block */
+static xlat_cache_block_t xlat_arena_published_end; /* End of the last published block */
+#define XLAT_ARENA_END ((xlat_cache_block_t)(((char *)xlat_arena) + XLAT_ARENA_SIZE))
+
+static uint32_t xlat_generation = 0;
 
 static void **xlat_lut[XLAT_LUT_PAGES];
+
+/* Write-protection of translated code in main RAM. Protection is tracked per
+ * LUT page (8KB), so a single write fault flushes exactly one LUT page (in
+ * each of the 4 RAM mirrors) */
+#define XLAT_PROTECT_PAGE_SIZE (1<<13)
+#define XLAT_PROTECT_PAGES ((16*1024*1024)/XLAT_PROTECT_PAGE_SIZE)
+#define XLAT_PROTECT_PAGE(addr) (((addr)&0x00FFFFFF) >> 13)
+#define XLAT_IS_RAM_ADDR(addr) (((addr)&0x1C000000) == 0x0C000000)
+#define IS_PAGE_PROTECTED(page) (xlat_protected_pages[(page)>>5] & (1<<((page)&0x1F)))
+
+gboolean xlat_protect_active = FALSE;
+static gboolean xlat_protect_enabled = FALSE;
+static gboolean xlat_protect_handler_installed = FALSE;
+static uint32_t xlat_protected_pages[XLAT_PROTECT_PAGES/32];
+static struct sigaction xlat_protect_old_segv, xlat_protect_old_bus;
+static xlat_fault_handler_t xlat_fault_handler = NULL;
+static void xlat_protect_page( sh4addr_t address );
+static void xlat_unprotect_all( void );
+DEFINE_HOOK( xlat_protect_hook, xlat_protect_hook_t );
+
+/* Code pages marked by xlat_add_code_page(), indexed by LUT page */
+#define IS_CODE_PAGE(page) (xlat_code_pages[(page)>>5] & (1<<((page)&0x1F)))
+static uint32_t xlat_code_pages[XLAT_LUT_PAGES/32];
+DEFINE_HOOK( xlat_code_hook, xlat_code_hook_t );
+
 static gboolean xlat_initialized = FALSE;
 static xlat_target_fns_t xlat_target = NULL;
 
+struct xlat_target_cache_entry xlat_target_cache[XLAT_TARGET_CACHE_ENTRIES];
+static uint64_t xlat_target_cache_hits = 0;  /* Hits from entries no longer in the cache */
+static uint64_t xlat_target_cache_misses = 0;
+
+static void xlat_target_cache_remove( xlat_target_cache_entry_t ent )
+{
+    xlat_target_cache_hits += ent->hits;
+    ent->code = NULL;
+    ent->vma = XLAT_TARGET_CACHE_EMPTY;
+    ent->xlat_sh4_mode = 0;
+    ent->hits = 0;
+    ent->context = XLAT_CONTEXT_NONE;
+}
+
+/**
+ * Remove any target cache entry referencing the given block (prior to the 
+ * block being deleted or moved)
+ */
+static void xlat_target_cache_remove_block( xlat_cache_block_t block )
+{
+    xlat_target_cache_entry_t ent = &xlat_target_cache[XLAT_TARGET_CACHE_INDEX(block->address)];
+    if( ent->code == (void *)block->code ) {
+        xlat_target_cache_remove(ent);
+    }
+}
+
+void xlat_target_cache_flush( void )
+{
+    int i;
+    for( i=0; i<XLAT_TARGET_CACHE_ENTRIES; i++ ) {
+        xlat_target_cache_remove( &xlat_target_cache[i] );
+    }
+}
+
+/**
+ * Map a cache space, reserving max_size bytes of address space of which the
+ * first size bytes are initially usable.
+ */
+static xlat_cache_block_t xlat_alloc_space( uint32_t size, uint32_t max_size )
+{
+    void *space;
+    if( size == max_size ) {
+        space = mmap( NULL, size, PROT_EXEC|PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANON, -1, 0 );
+        assert( space != MAP_FAILED );
+    } else {
+        space = mmap( NULL, max_size, PROT_NONE, MAP_PRIVATE|MAP_ANON|MAP_NORESERVE, -1, 0 );
+        assert( space != MAP_FAILED );
+        int status = mprotect( space, size, PROT_EXEC|PROT_READ|PROT_WRITE );
+        assert( status == 0 );
+    }
+    return (xlat_cache_block_t)space;
+}
+
+/**
+ * Map the new, temp and old spaces at their configured sizes
+ */
+static void xlat_alloc_spaces( void )
+{
+    xlat_new_cache = xlat_alloc_space( xlat_new_cache_size, xlat_new_cache_max_size );
+    xlat_new_cache_ptr = xlat_new_cache;
+    xlat_new_create_ptr = xlat_new_cache;
+    if( xlat_generational ) {
+        xlat_temp_cache = xlat_alloc_space( xlat_temp_cache_size, xlat_temp_cache_size );
+        xlat_old_cache = xlat_alloc_space( xlat_old_cache_size, xlat_old_cache_size );
+    } else {
+        xlat_temp_cache = xlat_old_cache = NULL;
+    }
+    xlat_temp_cache_ptr = xlat_temp_cache;
+    xlat_old_cache_ptr = xlat_old_cache;
+}
+
 void xlat_cache_init(void) 
 {
     if( !xlat_initialized ) {
         xlat_initialized = TRUE;
-        xlat_new_cache = (xlat_cache_block_t)mmap( NULL, XLAT_NEW_CACHE_SIZE, PROT_EXEC|PROT_READ|PROT_WRITE,
-                MAP_PRIVATE|MAP_ANON, -1, 0 );
-        xlat_new_cache_ptr = xlat_new_cache;
-        xlat_new_create_ptr = xlat_new_cache;
-#ifdef XLAT_GENERATIONAL_CACHE
-        xlat_temp_cache = mmap( NULL, XLAT_TEMP_CACHE_SIZE, PROT_EXEC|PROT_READ|PROT_WRITE,
+        assert( sizeof(struct xlat_target_cache_entry) == (1<<XLAT_TARGET_CACHE_ENTRY_SHIFT) );
+        xlat_alloc_spaces();
+        xlat_arena = (xlat_cache_block_t)mmap( NULL, XLAT_ARENA_SIZE, PROT_EXEC|PROT_READ|PROT_WRITE,
                 MAP_PRIVATE|MAP_ANON, -1, 0 );
-        xlat_old_cache = mmap( NULL, XLAT_OLD_CACHE_SIZE, PROT_EXEC|PROT_READ|PROT_WRITE,
-                MAP_PRIVATE|MAP_ANON, -1, 0 );
-        xlat_temp_cache_ptr = xlat_temp_cache;
-        xlat_old_cache_ptr = xlat_old_cache;
-#endif
+        xlat_arena_ptr = xlat_arena;
+        xlat_arena_published_end = xlat_arena;
 //        xlat_lut = mmap( NULL, XLAT_LUT_PAGES*sizeof(void *), PROT_READ|PROT_WRITE,
 //                MAP_PRIVATE|MAP_ANON, -1, 0);
         memset( xlat_lut, 0, XLAT_LUT_PAGES*sizeof(void *) );
@@ -98,6 +216,91 @@ void xlat_set_target_fns( xlat_target_fns_t target )
     xlat_target = target;
 }
 
+void xlat_configure_cache( gboolean generational, uint32_t new_size, uint32_t new_max_size,
+                           uint32_t temp_size, uint32_t old_size )
+{
+    if( new_size == 0 ) new_size = XLAT_NEW_CACHE_SIZE;
+    if( new_max_size == 0 ) new_max_size = XLAT_NEW_CACHE_MAX_SIZE;
+    if( temp_size == 0 ) temp_size = XLAT_TEMP_CACHE_SIZE;
+    if( old_size == 0 ) old_size = XLAT_OLD_CACHE_SIZE;
+    /* Each space needs at least its header and end-of-cache sentinel */
+    assert( new_size >= 2*MIN_TOTAL_SIZE && temp_size >= 2*MIN_TOTAL_SIZE && old_size >= 2*MIN_TOTAL_SIZE );
+    if( new_max_size < new_size ) {
+        new_max_size = new_size;
+    }
+    if( xlat_initialized ) {
+        munmap( xlat_new_cache, xlat_new_cache_max_size );
+        if( xlat_generational ) {
+            munmap( xlat_temp_cache, xlat_temp_cache_size );
+            munmap( xlat_old_cache, xlat_old_cache_size );
+        }
+    }
+    xlat_generational = generational;
+    if( new_max_size == new_size ) {
+        /* Fixed size */
+        xlat_new_cache_size = xlat_new_cache_max_size = (new_size + 3) & 0xFFFFFFFC;
+    } else {
+        xlat_new_cache_size = (new_size + XLAT_CACHE_GRANULARITY - 1) & ~(XLAT_CACHE_GRANULARITY-1);
+        xlat_new_cache_max_size = (new_max_size + XLAT_CACHE_GRANULARITY - 1) & ~(XLAT_CACHE_GRANULARITY-1);
+    }
+    xlat_temp_cache_size = (temp_size + 3) & 0xFFFFFFFC;
+    xlat_old_cache_size = (old_size + 3) & 0xFFFFFFFC;
+    if( xlat_initialized ) {
+        xlat_alloc_spaces();
+        xlat_flush_cache();
+    }
+}
+
+/**
+ * Grow the new space (if it's below its limit) by committing more of its
+ * reserved address range, doubling its size each time. The end-of-cache 
+ * sentinel becomes a free block covering the additional space.
+ * @return TRUE if the space was grown
+ */
+static gboolean xlat_grow_new_space( void )
+{
+    uint32_t oldsize = xlat_new_cache_size;
+    uint32_t newsize;
+    xlat_cache_block_t tail;
+
+    if( oldsize >= xlat_new_cache_max_size ) {
+        return FALSE;
+    }
+    if( oldsize > xlat_new_cache_max_size - oldsize ) {
+        newsize = xlat_new_cache_max_size;
+    } else {
+        newsize = oldsize * 2;
+    }
+    if( mprotect( ((char *)xlat_new_cache) + oldsize, newsize - oldsize, 
+            PROT_EXEC|PROT_READ|PROT_WRITE ) != 0 ) {
+        return FALSE; /* Out of memory - stay at this size for now */
+    }
+    tail = (xlat_cache_block_t)(((char *)xlat_new_cache) + oldsize - sizeof(struct xlat_cache_block));
+    assert( tail->size == 0 );
+    tail->active = 0;
+    tail->size = newsize - oldsize - sizeof(struct xlat_cache_block);
+    tail = NEXT(tail);
+    tail->active = 1;
+    tail->size = 0;
+    xlat_new_cache_size = newsize;
+    xlat_stats.grows++;
+    return TRUE;
+}
+
+/**
+ * Reset a cache space to a single free block followed by the end-of-cache
+ * sentinel
+ */
+static void xlat_reset_space( xlat_cache_block_t space, uint32_t size )
+{
+    xlat_cache_block_t tmp;
+    space->active = 0;
+    space->size = size - 2*sizeof(struct xlat_cache_block);
+    tmp = NEXT(space);
+    tmp->active = 1;
+    tmp->size = 0;
+}
+
 /**
  * Reset the cache structure to its default state
  */
@@ -106,43 +309,137 @@ void xlat_flush_cache()
     xlat_cache_block_t tmp;
     int i;
     xlat_new_cache_ptr = xlat_new_cache;
-    xlat_new_cache_ptr->active = 0;
-    xlat_new_cache_ptr->size = XLAT_NEW_CACHE_SIZE - 2*sizeof(struct xlat_cache_block);
-    tmp = NEXT(xlat_new_cache_ptr);
-    tmp->active = 1;
-    tmp->size = 0;
-#ifdef XLAT_GENERATIONAL_CACHE
-    xlat_temp_cache_ptr = xlat_temp_cache;
-    xlat_temp_cache_ptr->active = 0;
-    xlat_temp_cache_ptr->size = XLAT_TEMP_CACHE_SIZE - 2*sizeof(struct xlat_cache_block);
-    tmp = NEXT(xlat_temp_cache_ptr);
-    tmp->active = 1;
-    tmp->size = 0;
-    xlat_old_cache_ptr = xlat_old_cache;
-    xlat_old_cache_ptr->active = 0;
-    xlat_old_cache_ptr->size = XLAT_OLD_CACHE_SIZE - 2*sizeof(struct xlat_cache_block);
-    tmp = NEXT(xlat_old_cache_ptr);
-    tmp->active = 1;
-    tmp->size = 0;
-#endif
+    xlat_reset_space( xlat_new_cache, xlat_new_cache_size );
+    if( xlat_generational ) {
+        xlat_temp_cache_ptr = xlat_temp_cache;
+        xlat_reset_space( xlat_temp_cache, xlat_temp_cache_size );
+        xlat_old_cache_ptr = xlat_old_cache;
+        xlat_reset_space( xlat_old_cache, xlat_old_cache_size );
+    }
+    /* Published arena blocks go with everything else, but the space can only
+     * be reclaimed once the background translator is idle (xlat_reset_arena) */
+    for( tmp = xlat_arena; tmp < xlat_arena_published_end; tmp = NEXT(tmp) ) {
+        tmp->active = 0;
+    }
     for( i=0; i<XLAT_LUT_PAGES; i++ ) {
         if( xlat_lut[i] != NULL ) {
             memset( xlat_lut[i], 0, XLAT_LUT_PAGE_SIZE );
         }
     }
+    xlat_target_cache_flush();
+    xlat_unprotect_all();
+    if( XLAT_PERF_ENABLED() ) {
+        xlat_perf_unload_all();
+    }
+    xlat_generation++;
+    xlat_stats.flushes++;
+}
+
+void xlat_get_cache_stats( struct xlat_cache_stats *stats )
+{
+    xlat_cache_block_t spaces[3] = { xlat_new_cache, xlat_temp_cache, xlat_old_cache };
+    int i;
+    *stats = xlat_stats;
+    stats->new_space_size = xlat_new_cache_size;
+    for( i=0; i<3; i++ ) {
+        xlat_cache_block_t ptr = spaces[i];
+        stats->live_blocks[i] = 0;
+        stats->live_bytes[i] = 0;
+        if( ptr != NULL ) {
+            for( ; ptr->size != 0; ptr = NEXT(ptr) ) {
+                if( ptr->active ) {
+                    stats->live_blocks[i]++;
+                    stats->live_bytes[i] += ptr->size;
+                }
+            }
+        }
+    }
+}
+
+uint64_t xlat_get_displaced_count( void )
+{
+    return xlat_stats.temp_promotions + xlat_stats.old_promotions + xlat_stats.evictions;
+}
+
+/**
+ * @return the block's fixup table, or NULL if the block doesn't have one (or
+ * has too many fixups to record)
+ */
+static uint32_t *xlat_get_fixup_table( xlat_cache_block_t block )
+{
+    if( block->recover_table_size == 0 ) {
+        return NULL;
+    }
+    uint32_t *fixups = XLAT_FIXUP_TABLE(block);
+    if( fixups[0] == XLAT_FIXUP_OVERFLOW ) {
+        return NULL;
+    }
+    return fixups;
 }
 
 void xlat_delete_block( xlat_cache_block_t block )
 {
+    xlat_target_cache_remove_block(block);
+    if( XLAT_PERF_ENABLED() ) {
+        xlat_perf_unload_block(block);
+    }
     block->active = 0;
-    *block->lut_entry = block->chain;
-    if( block->use_list != NULL )
+    if( XLAT_CODE_ADDR(*block->lut_entry) == block->code ) {
+        *block->lut_entry = block->chain;
+    } else {
+        /* Not the head of the chain (ie a block for another mode, or one
+         * that's been superseded) - unlink it in place */
+        void *p = XLAT_CODE_ADDR(*block->lut_entry);
+        while( p != NULL ) {
+            xlat_cache_block_t prev = XLAT_BLOCK_FOR_CODE(p);
+            if( prev->chain == block->code ) {
+                prev->chain = block->chain;
+                break;
+            }
+            p = prev->chain;
+        }
+    }
+    if( block->use_list != NULL ) {
         xlat_target->unlink_block(block->use_list);
+        block->use_list = NULL;
+    }
+    /* Remove any links from this block from the targets' use-lists */
+    uint32_t *fixups = xlat_get_fixup_table(block);
+    if( fixups != NULL ) {
+        uint32_t i;
+        for( i=1; i<=fixups[0]; i++ ) {
+            if( fixups[i] & XLAT_FIXUP_LINK ) {
+                xlat_target->move_link( &block->code[fixups[i] & ~XLAT_FIXUP_LINK], NULL );
+            }
+        }
+    }
+}
+
+void xlat_add_code_page( sh4addr_t address )
+{
+    uint32_t page = XLAT_LUT_PAGE(XLAT_CODE_PAGE_ADDR(address));
+    xlat_code_pages[page>>5] |= (1<<(page&0x1F));
+    xlat_protect_page( address );
+}
+
+/**
+ * Report the code page containing the given address (if it's marked) to the
+ * code hooks.
+ */
+static void xlat_flush_code_page( sh4addr_t address )
+{
+    sh4addr_t addr = XLAT_CODE_PAGE_ADDR(address);
+    uint32_t page = XLAT_LUT_PAGE(addr);
+    if( IS_CODE_PAGE(page) ) {
+        xlat_code_pages[page>>5] &= ~(1<<(page&0x1F));
+        CALL_HOOKS( xlat_code_hook, addr );
+    }
 }
 
 static void xlat_flush_page_by_lut( void **page )
 {
     int i;
+    xlat_generation++;
     for( i=0; i<XLAT_LUT_PAGE_ENTRIES; i++ ) {
         if( IS_ENTRY_POINT(page[i]) ) {
             void *p = XLAT_CODE_ADDR(page[i]);
@@ -156,15 +453,33 @@ static void xlat_flush_page_by_lut( void **page )
     }
 }
 
+/**
+ * A block may run on from the end of one LUT page into the next (for a delay
+ * slot, or a block that crosses a page boundary), in which case the start of
+ * the second page holds a run of continuation entries. If the entry for addr
+ * is within that run, flush the previous page, which owns the block.
+ */
+static void xlat_flush_spilled_page( void **page, sh4addr_t addr )
+{
+    int i, entry = XLAT_LUT_ENTRY(addr);
+    void **prev = xlat_lut[XLAT_LUT_PAGE(addr - entry*2 - 2)];
+    for( i=0; i<=entry; i++ ) {
+        if( !IS_ENTRY_CONTINUATION(page[i]) ) {
+            return;
+        }
+    }
+    if( prev != NULL ) {
+        xlat_flush_page_by_lut(prev);
+    }
+}
+
 void FASTCALL xlat_invalidate_word( sh4addr_t addr )
 {
     void **page = xlat_lut[XLAT_LUT_PAGE(addr)];
+    xlat_flush_code_page(addr);
     if( page != NULL ) {
         int entry = XLAT_LUT_ENTRY(addr);
-        if( entry == 0 && IS_ENTRY_CONTINUATION(page[entry]) ) {
-            /* First entry may be a delay-slot for the previous page */
-            xlat_flush_page_by_lut(xlat_lut[XLAT_LUT_PAGE(addr-2)]);
-        }
+        xlat_flush_spilled_page(page, addr);
         if( page[entry] != NULL ) {
             xlat_flush_page_by_lut(page);
         }
@@ -174,28 +489,65 @@ void FASTCALL xlat_invalidate_word( sh4addr_t addr )
 void FASTCALL xlat_invalidate_long( sh4addr_t addr )
 {
     void **page = xlat_lut[XLAT_LUT_PAGE(addr)];
+    xlat_flush_code_page(addr);
     if( page != NULL ) {
         int entry = XLAT_LUT_ENTRY(addr);
-        if( entry == 0 && IS_ENTRY_CONTINUATION(page[entry]) ) {
-            /* First entry may be a delay-slot for the previous page */
-            xlat_flush_page_by_lut(xlat_lut[XLAT_LUT_PAGE(addr-2)]);
-        }
+        xlat_flush_spilled_page(page, addr);
         if( *(uint64_t *)&page[entry] != 0 ) {
             xlat_flush_page_by_lut(page);
         }
     }
 }
 
+/**
+ * Flush all LUT pages covered by the given protected page, and unprotect it
+ */
+static void xlat_flush_protected_page( uint32_t page )
+{
+    int i;
+    for( i=0; i<4; i++ ) {
+        sh4addr_t addr = 0x0C000000 + (i<<24) + (page<<13);
+        void **lut = xlat_lut[XLAT_LUT_PAGE(addr)];
+        if( lut != NULL ) {
+            xlat_flush_spilled_page(lut, addr);
+            xlat_flush_page_by_lut(lut);
+        }
+    }
+    xlat_flush_code_page( 0x0C000000 + (page<<13) );
+    xlat_protected_pages[page>>5] &= ~(1<<(page&0x1F));
+    mem_unprotect( dc_main_ram + (page<<13), XLAT_PROTECT_PAGE_SIZE );
+    CALL_HOOKS( xlat_protect_hook, page<<13, XLAT_PROTECT_PAGE_SIZE );
+}
+
 void FASTCALL xlat_invalidate_block( sh4addr_t address, size_t size )
 {
     int i;
+    if( xlat_protect_active && XLAT_IS_RAM_ADDR(address) ) {
+        /* Only need to release the protected pages - anything else can't
+         * contain code */
+        uint32_t end = (address & 0x00FFFFFF) + size;
+        uint32_t page;
+        for( page = XLAT_PROTECT_PAGE(address); page < XLAT_PROTECT_PAGES && (page<<13) < end; page++ ) {
+            if( IS_PAGE_PROTECTED(page) ) {
+                xlat_flush_protected_page(page);
+            }
+        }
+        return;
+    }
+
+    uint32_t code_page;
+    for( code_page = address >> 13; code_page <= (address + size - 1) >> 13; code_page++ ) {
+        xlat_flush_code_page(code_page << 13);
+    }
+
     int entry_count = size >> 1; // words;
     uint32_t page_no = XLAT_LUT_PAGE(address);
     int entry = XLAT_LUT_ENTRY(address);
 
-    if( entry == 0 && xlat_lut[page_no] != NULL && IS_ENTRY_CONTINUATION(xlat_lut[page_no][entry])) {
-        /* First entry may be a delay-slot for the previous page */
-        xlat_flush_page_by_lut(xlat_lut[XLAT_LUT_PAGE(address-2)]);
+    if( xlat_lut[page_no] != NULL ) {
+        /* Later pages in the range are preceded by a page that's also in the
+         * range, so only the first can be owned by a block outside it */
+        xlat_flush_spilled_page(xlat_lut[page_no], address);
     }
     do {
         void **page = xlat_lut[page_no];
@@ -241,6 +593,40 @@ void * FASTCALL xlat_get_code( sh4addr_t address )
     return result;
 }
 
+void * FASTCALL xlat_target_cache_miss( sh4vma_t vma, uint32_t xlat_sh4_mode )
+{
+    void *code = xlat_get_code(vma);
+    while( code != NULL && XLAT_BLOCK_MODE(code) != xlat_sh4_mode ) {
+        code = XLAT_BLOCK_CHAIN(code);
+    }
+    xlat_target_cache_misses++;
+    if( code != NULL ) {
+        XLAT_BLOCK_MARK_USED(code);
+        xlat_target_cache_insert( vma, xlat_sh4_mode, XLAT_CONTEXT_NONE, code );
+    }
+    return code;
+}
+
+void xlat_target_cache_insert( sh4vma_t vma, uint32_t xlat_sh4_mode, uint32_t context, void *code )
+{
+    xlat_target_cache_entry_t ent = &xlat_target_cache[XLAT_TARGET_CACHE_INDEX(vma)];
+    xlat_target_cache_remove(ent);
+    ent->code = code;
+    ent->vma = vma;
+    ent->xlat_sh4_mode = xlat_sh4_mode;
+    ent->context = context;
+}
+
+void xlat_get_target_cache_stats( uint64_t *hits, uint64_t *misses )
+{
+    int i;
+    *hits = xlat_target_cache_hits;
+    for( i=0; i<XLAT_TARGET_CACHE_ENTRIES; i++ ) {
+        *hits += xlat_target_cache[i].hits;
+    }
+    *misses = xlat_target_cache_misses;
+}
+
 xlat_recovery_record_t xlat_get_pre_recovery( void *code, void *native_pc )
 {
     if( code != NULL ) {
@@ -259,6 +645,11 @@ xlat_recovery_record_t xlat_get_pre_recovery( void *code, void *native_pc )
     return NULL;	
 }
 
+/**
+ * Retrieve the LUT page for address, allocating it if needed. Only the 
+ * emulation thread may allocate pages (see xlat_alloc_lut_range), as it
+ * reads the table without locking.
+ */
 static void **xlat_get_lut_page( sh4addr_t address )
 {
     void **page = xlat_lut[XLAT_LUT_PAGE(address)];
@@ -280,6 +671,14 @@ void ** FASTCALL xlat_get_lut_entry( sh4addr_t address )
     return &page[XLAT_LUT_ENTRY(address)];
 }
 
+void xlat_alloc_lut_range( sh4addr_t address, uint32_t size )
+{
+    sh4addr_t end = address + size;
+    for( address &= ~0x1FFF; address < end; address += 0x2000 ) {
+        xlat_get_lut_page(address);
+    }
+}
+
 
 
 uint32_t FASTCALL xlat_get_block_size( void *block )
@@ -320,70 +719,95 @@ static inline xlat_cache_block_t xlat_cut_block( xlat_cache_block_t block, int c
     }
 }
 
-#ifdef XLAT_GENERATIONAL_CACHE
 /**
- * Promote a block in temp space (or elsewhere for that matter) to old space.
- *
- * @param block to promote.
+ * Move a block to dest, which must already be allocated and large enough to 
+ * hold it. Links to the block are removed (they'll be re-established the next
+ * time they're taken), links from the block and pointers into it are updated 
+ * from its fixup table, and the block takes over its old position in the LUT.
  */
-static void xlat_promote_to_old_space( xlat_cache_block_t block )
+static void xlat_move_block( xlat_cache_block_t block, xlat_cache_block_t dest )
 {
-    int allocation = (int)-sizeof(struct xlat_cache_block);
-    int size = block->size;
-    xlat_cache_block_t curr = xlat_old_cache_ptr;
-    xlat_cache_block_t start_block = curr;
-    do {
-        allocation += curr->size + sizeof(struct xlat_cache_block);
-        curr = NEXT(curr);
-        if( allocation > size ) {
-            break; /* done */
+    uint32_t *fixups = XLAT_FIXUP_TABLE(block);
+    uintptr_t delta = ((uintptr_t)dest->code) - ((uintptr_t)block->code);
+    uint32_t i;
+
+    xlat_target_cache_remove_block(block);
+    if( block->use_list != NULL ) {
+        xlat_target->unlink_block(block->use_list);
+        block->use_list = NULL;
+    }
+    dest->active = BLOCK_ACTIVE;
+    dest->lut_entry = block->lut_entry;
+    dest->chain = block->chain;
+    dest->address = block->address;
+    dest->use_list = NULL;
+    dest->xlat_sh4_mode = block->xlat_sh4_mode;
+    dest->hot_count = block->hot_count;
+    dest->recover_table_offset = block->recover_table_offset;
+    dest->recover_table_size = block->recover_table_size;
+    memcpy( dest->code, block->code, block->size );
+    if( XLAT_PERF_ENABLED() ) {
+        xlat_perf_move_block( block, dest );
+    }
+    for( i=1; i<=fixups[0]; i++ ) {
+        uint32_t offset = fixups[i] & ~XLAT_FIXUP_LINK;
+        if( fixups[i] & XLAT_FIXUP_LINK ) {
+            xlat_target->move_link( &block->code[offset], &dest->code[offset] );
+        } else {
+            *((uintptr_t *)&dest->code[offset]) += delta;
         }
-        if( curr->size == 0 ) { /* End-of-cache Sentinel */
-            /* Leave what we just released as free space and start again from the
-             * top of the cache
-             */
-            start_block->active = 0;
-            start_block->size = allocation;
-            allocation = (int)-sizeof(struct xlat_cache_block);
-            start_block = curr = xlat_old_cache;
+    }
+
+    /* Replace the block in its LUT chain */
+    if( XLAT_CODE_ADDR(*block->lut_entry) == block->code ) {
+        *block->lut_entry = (void *)(((uintptr_t)&dest->code) | 
+                (((uintptr_t)*block->lut_entry) & (uintptr_t)XLAT_LUT_ENTRY_USED));
+    } else {
+        void *p = XLAT_CODE_ADDR(*block->lut_entry);
+        while( p != NULL ) {
+            xlat_cache_block_t prev = XLAT_BLOCK_FOR_CODE(p);
+            if( prev->chain == block->code ) {
+                prev->chain = dest->code;
+                break;
+            }
+            p = prev->chain;
         }
-    } while(1);
-    start_block->active = 1;
-    start_block->size = allocation;
-    start_block->lut_entry = block->lut_entry;
-    start_block->chain = block->chain;
-    start_block->fpscr_mask = block->fpscr_mask;
-    start_block->fpscr = block->fpscr;
-    start_block->recover_table_offset = block->recover_table_offset;
-    start_block->recover_table_size = block->recover_table_size;
-    *block->lut_entry = &start_block->code;
-    memcpy( start_block->code, block->code, block->size );
-    xlat_old_cache_ptr = xlat_cut_block(start_block, size );
-    if( xlat_old_cache_ptr->size == 0 ) {
-        xlat_old_cache_ptr = xlat_old_cache;
     }
+    block->active = BLOCK_INACTIVE;
 }
 
 /**
- * Similarly to the above method, promotes a block to temp space.
- * TODO: Try to combine these - they're nearly identical
+ * Evict a block to make room in its cache space
  */
-void xlat_promote_to_temp_space( xlat_cache_block_t block )
+static void xlat_evict_block( xlat_cache_block_t block )
+{
+    xlat_delete_block( block );
+    xlat_stats.evictions++;
+}
+
+/**
+ * Allocate space for a block of the given size in a temp or old space,
+ * starting from *ptr and wrapping around to the start of the space if needed.
+ * Blocks in the way are released via the release function.
+ * @return the allocated block, or NULL if the space is too small.
+ */
+static xlat_cache_block_t xlat_alloc_in_space( xlat_cache_block_t space, uint32_t space_size,
+        xlat_cache_block_t *ptr, int size, void (*release)(xlat_cache_block_t) )
 {
-    int size = block->size;
     int allocation = (int)-sizeof(struct xlat_cache_block);
-    xlat_cache_block_t curr = xlat_temp_cache_ptr;
+    xlat_cache_block_t curr = *ptr;
     xlat_cache_block_t start_block = curr;
+
+    if( size > (int)(space_size - 2*sizeof(struct xlat_cache_block)) ) {
+        return NULL;
+    }
     do {
-        if( curr->active == BLOCK_USED ) {
-            xlat_promote_to_old_space( curr );
-        } else if( curr->active == BLOCK_ACTIVE ) {
-            // Active but not used, release block
-            *((uintptr_t *)curr->lut_entry) &= ((uintptr_t)0x03);
+        if( curr->active ) {
+            release(curr);
         }
         allocation += curr->size + sizeof(struct xlat_cache_block);
         curr = NEXT(curr);
-        if( allocation > size ) {
+        if( allocation >= size ) {
             break; /* done */
         }
         if( curr->size == 0 ) { /* End-of-cache Sentinel */
@@ -393,67 +817,268 @@ void xlat_promote_to_temp_space( xlat_cache_block_t block )
             start_block->active = 0;
             start_block->size = allocation;
             allocation = (int)-sizeof(struct xlat_cache_block);
-            start_block = curr = xlat_temp_cache;
+            start_block = curr = space;
         }
     } while(1);
-    start_block->active = 1;
+    start_block->active = BLOCK_ACTIVE;
     start_block->size = allocation;
-    start_block->lut_entry = block->lut_entry;
-    start_block->chain = block->chain;
-    start_block->fpscr_mask = block->fpscr_mask;
-    start_block->fpscr = block->fpscr;
-    start_block->recover_table_offset = block->recover_table_offset;
-    start_block->recover_table_size = block->recover_table_size;
-    *block->lut_entry = &start_block->code;
-    memcpy( start_block->code, block->code, block->size );
-    xlat_temp_cache_ptr = xlat_cut_block(start_block, size );
-    if( xlat_temp_cache_ptr->size == 0 ) {
-        xlat_temp_cache_ptr = xlat_temp_cache;
+    *ptr = xlat_cut_block(start_block, size);
+    if( (*ptr)->size == 0 ) {
+        *ptr = space;
     }
-
+    return start_block;
 }
-#else 
-void xlat_promote_to_temp_space( xlat_cache_block_t block )
+
+/**
+ * Promote a block in temp space to old space, evicting the oldest blocks in
+ * the old space to make room.
+ */
+static void xlat_promote_to_old_space( xlat_cache_block_t block )
 {
-    *block->lut_entry = block->chain;
-    xlat_delete_block(block);
+    xlat_cache_block_t dest = xlat_get_fixup_table(block) == NULL ? NULL :
+        xlat_alloc_in_space( xlat_old_cache, xlat_old_cache_size, &xlat_old_cache_ptr, 
+                block->size, xlat_evict_block );
+    if( dest == NULL ) {
+        xlat_evict_block(block);
+    } else {
+        xlat_move_block( block, dest );
+        xlat_stats.old_promotions++;
+    }
 }
-#endif
 
 /**
- * Returns the next block in the new cache list that can be written to by the
- * translator. If the next block is active, it is evicted first.
+ * Release a block from the temp space - if it's been used since it was
+ * promoted, promote it again to the old space, otherwise discard it.
  */
-xlat_cache_block_t xlat_start_block( sh4addr_t address )
+static void xlat_release_temp_block( xlat_cache_block_t block )
 {
-    if( xlat_new_cache_ptr->size == 0 ) {
-        xlat_new_cache_ptr = xlat_new_cache;
+    if( block->active >= BLOCK_USED ) {
+        xlat_promote_to_old_space( block );
+    } else {
+        xlat_evict_block( block );
     }
+}
 
-    if( xlat_new_cache_ptr->active ) {
-        xlat_promote_to_temp_space( xlat_new_cache_ptr );
+/**
+ * Remove a block from the new space (to make room for a new block). In 
+ * generational mode the block is moved to the temp space, otherwise it's just
+ * discarded.
+ */
+void xlat_promote_to_temp_space( xlat_cache_block_t block )
+{
+    xlat_cache_block_t dest = NULL;
+    if( xlat_generational && xlat_get_fixup_table(block) != NULL ) {
+        dest = xlat_alloc_in_space( xlat_temp_cache, xlat_temp_cache_size, &xlat_temp_cache_ptr,
+                block->size, xlat_release_temp_block );
     }
-    xlat_new_create_ptr = xlat_new_cache_ptr;
-    xlat_new_create_ptr->active = 1;
-    xlat_new_cache_ptr = NEXT(xlat_new_cache_ptr);
+    if( dest == NULL ) {
+        xlat_evict_block(block);
+    } else {
+        xlat_move_block( block, dest );
+        xlat_stats.temp_promotions++;
+    }
+}
 
-    /* Add the LUT entry for the block */
-    void **p = xlat_get_lut_entry(address);
+/**
+ * Add the LUT entry for the block (at block->address), ahead of any existing
+ * blocks for the same address.
+ */
+static void xlat_link_block_lut( xlat_cache_block_t block )
+{
+    void **p = xlat_get_lut_entry(block->address);
     void *entry = *p;
     if( IS_ENTRY_POINT(entry) ) {
         xlat_cache_block_t oldblock = XLAT_BLOCK_FOR_LUT_ENTRY(entry);
         assert( oldblock->active );
-        xlat_new_create_ptr->chain = XLAT_CODE_ADDR(entry);
+        block->chain = XLAT_CODE_ADDR(entry);
     } else {
-        xlat_new_create_ptr->chain = NULL;
+        block->chain = NULL;
     }
-    xlat_new_create_ptr->use_list = NULL;
 
-    *p = &xlat_new_create_ptr->code;
+    *p = &block->code;
     if( IS_ENTRY_CONTINUATION(entry) ) {
         *((uintptr_t *)p) |= (uintptr_t)XLAT_LUT_ENTRY_USED;
     }
-    xlat_new_create_ptr->lut_entry = p;
+    block->lut_entry = p;
+    xlat_protect_page( block->address );
+}
+
+/**
+ * Write-protect the RAM page containing the given address (if any)
+ */
+static void xlat_protect_page( sh4addr_t address )
+{
+    if( xlat_protect_active && XLAT_IS_RAM_ADDR(address) ) {
+        uint32_t page = XLAT_PROTECT_PAGE(address);
+        if( !IS_PAGE_PROTECTED(page) ) {
+            xlat_protected_pages[page>>5] |= (1<<(page&0x1F));
+            mem_protect( dc_main_ram + (page<<13), XLAT_PROTECT_PAGE_SIZE );
+            CALL_HOOKS( xlat_protect_hook, page<<13, XLAT_PROTECT_PAGE_SIZE );
+        }
+    }
+}
+
+gboolean xlat_is_protected_page( sh4addr_t address )
+{
+    return XLAT_IS_RAM_ADDR(address) && IS_PAGE_PROTECTED(XLAT_PROTECT_PAGE(address));
+}
+
+static void xlat_unprotect_all( void )
+{
+    int i;
+    for( i=0; i<XLAT_PROTECT_PAGES/32; i++ ) {
+        if( xlat_protected_pages[i] != 0 ) {
+            xlat_protected_pages[i] = 0;
+            mem_unprotect( dc_main_ram + (i<<18), 32*XLAT_PROTECT_PAGE_SIZE );
+        }
+    }
+    /* Always reported, as the hooks may also care about xlat_protect_active */
+    CALL_HOOKS( xlat_protect_hook, 0, XLAT_PROTECT_PAGES*XLAT_PROTECT_PAGE_SIZE );
+}
+
+/**
+ * SIGSEGV/SIGBUS handler - if the fault was a write to a protected RAM page,
+ * flush the code in that page and allow the write to proceed. Otherwise give
+ * the secondary handler (if any) a chance, and failing that restore the
+ * previous handler, so that the fault is reported when the instruction
+ * restarts.
+ */
+static void xlat_protect_fault( int signo, siginfo_t *info, void *context )
+{
+    uintptr_t ram = (uintptr_t)dc_main_ram;
+    uintptr_t addr = (uintptr_t)info->si_addr;
+    if( addr >= ram && addr < ram + XLAT_PROTECT_PAGES*XLAT_PROTECT_PAGE_SIZE ) {
+        uint32_t page = (addr - ram) >> 13;
+        if( IS_PAGE_PROTECTED(page) ) {
+            xlat_flush_protected_page(page);
+            return;
+        }
+    }
+    if( xlat_fault_handler != NULL && xlat_fault_handler( info->si_addr, context ) ) {
+        return;
+    }
+    sigaction( signo, signo == SIGSEGV ? &xlat_protect_old_segv : &xlat_protect_old_bus, NULL );
+}
+
+static void xlat_install_fault_handler( void )
+{
+    if( !xlat_protect_handler_installed ) {
+        struct sigaction sa;
+        memset( &sa, 0, sizeof(sa) );
+        sa.sa_sigaction = xlat_protect_fault;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset( &sa.sa_mask );
+        sigaction( SIGSEGV, &sa, &xlat_protect_old_segv );
+        sigaction( SIGBUS, &sa, &xlat_protect_old_bus );
+        xlat_protect_handler_installed = TRUE;
+    }
+}
+
+void xlat_set_write_protect( gboolean enable )
+{
+    if( enable ) {
+        xlat_install_fault_handler();
+    }
+    xlat_protect_enabled = enable;
+}
+
+void xlat_set_fault_handler( xlat_fault_handler_t handler )
+{
+    xlat_fault_handler = handler;
+    if( handler != NULL ) {
+        xlat_install_fault_handler();
+    }
+}
+
+void xlat_protect_start( void )
+{
+    int i, j, k;
+    if( !xlat_protect_enabled ) {
+        return;
+    }
+    xlat_protect_active = TRUE;
+    for( j=0; j<XLAT_PROTECT_PAGES; j++ ) {
+        sh4addr_t addr = 0x0C000000 + (j<<13);
+        if( IS_CODE_PAGE(XLAT_LUT_PAGE(addr)) ) {
+            xlat_protect_page(addr);
+        }
+    }
+    for( i=0; i<4; i++ ) {
+        for( j=0; j<XLAT_PROTECT_PAGES; j++ ) {
+            sh4addr_t addr = 0x0C000000 + (i<<24) + (j<<13);
+            void **lut = xlat_lut[XLAT_LUT_PAGE(addr)];
+            if( lut != NULL && !IS_PAGE_PROTECTED(j) ) {
+                for( k=0; k<XLAT_LUT_PAGE_ENTRIES; k++ ) {
+                    if( lut[k] != NULL ) {
+                        xlat_protect_page(addr);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    CALL_HOOKS( xlat_protect_hook, 0, XLAT_PROTECT_PAGES*XLAT_PROTECT_PAGE_SIZE );
+}
+
+void xlat_protect_stop( void )
+{
+    xlat_protect_active = FALSE;
+    xlat_unprotect_all();
+}
+
+/**
+ * Give a used block in the new space a second chance instead of evicting it:
+ * clear its used mark, and drop the links and target cache entry that let it
+ * run without going through the dispatcher, so that it's marked again the
+ * next time it runs.
+ */
+static void xlat_age_block( xlat_cache_block_t block )
+{
+    block->active = BLOCK_ACTIVE;
+    xlat_target_cache_remove_block(block);
+    if( block->use_list != NULL ) {
+        xlat_target->unlink_block(block->use_list);
+        block->use_list = NULL;
+    }
+    xlat_stats.aged++;
+}
+
+/**
+ * Returns the next block in the new cache list that can be written to by the
+ * translator. When the end of the cache is reached, the cache is grown if it's
+ * below its limit, and otherwise allocation wraps around to the start. Blocks
+ * that have been used since the last time around are skipped over (in the
+ * non-generational cache), and if the next block is active, it is evicted 
+ * first.
+ */
+xlat_cache_block_t xlat_start_block( sh4addr_t address )
+{
+    for(;;) {
+        if( xlat_new_cache_ptr->size == 0 ) {
+            if( !xlat_grow_new_space() ) {
+                xlat_new_cache_ptr = xlat_new_cache;
+            }
+        } else if( !xlat_generational && xlat_new_cache_ptr->active >= BLOCK_USED ) {
+            xlat_age_block( xlat_new_cache_ptr );
+            xlat_new_cache_ptr = NEXT(xlat_new_cache_ptr);
+        } else {
+            break;
+        }
+    }
+
+    if( xlat_new_cache_ptr->active ) {
+        xlat_promote_to_temp_space( xlat_new_cache_ptr );
+    }
+    xlat_new_create_ptr = xlat_new_cache_ptr;
+    xlat_new_create_ptr->active = 1;
+    xlat_new_cache_ptr = NEXT(xlat_new_cache_ptr);
+
+    xlat_new_create_ptr->use_list = NULL;
+    xlat_new_create_ptr->address = address;
+    xlat_new_create_ptr->hot_count = -1;
+    xlat_new_create_ptr->recover_table_offset = 0;
+    xlat_new_create_ptr->recover_table_size = 0;
+    xlat_link_block_lut( xlat_new_create_ptr );
 
     return xlat_new_create_ptr;
 }
@@ -462,7 +1087,10 @@ xlat_cache_block_t xlat_extend_block( uint32_t newSize )
 {
     assert( xlat_new_create_ptr->use_list == NULL );
     while( xlat_new_create_ptr->size < newSize ) {
-        if( xlat_new_cache_ptr->size == 0 ) {
+        if( xlat_new_cache_ptr->size == 0 && xlat_grow_new_space() ) {
+            /* The sentinel is now a free block following this one */
+            continue;
+        } else if( xlat_new_cache_ptr->size == 0 ) {
             /* Migrate to the front of the cache to keep it contiguous */
             xlat_new_create_ptr->active = 0;
             sh4ptr_t olddata = xlat_new_create_ptr->code;
@@ -470,6 +1098,7 @@ xlat_cache_block_t xlat_extend_block( uint32_t newSize )
             int size = oldsize + MIN_BLOCK_SIZE; /* minimum expansion */
             void **lut_entry = xlat_new_create_ptr->lut_entry;
             void *chain = xlat_new_create_ptr->chain;
+            sh4addr_t address = xlat_new_create_ptr->address;
             int allocation = (int)-sizeof(struct xlat_cache_block);
             xlat_new_cache_ptr = xlat_new_cache;
             do {
@@ -484,7 +1113,10 @@ xlat_cache_block_t xlat_extend_block( uint32_t newSize )
             xlat_new_create_ptr->size = allocation;
             xlat_new_create_ptr->lut_entry = lut_entry;
             xlat_new_create_ptr->chain = chain;
+            xlat_new_create_ptr->address = address;
             xlat_new_create_ptr->use_list = NULL;
+            xlat_new_create_ptr->recover_table_offset = 0;
+            xlat_new_create_ptr->recover_table_size = 0;
             *lut_entry = &xlat_new_create_ptr->code;
             memmove( xlat_new_create_ptr->code, olddata, oldsize );
         } else {
@@ -499,21 +1131,82 @@ xlat_cache_block_t xlat_extend_block( uint32_t newSize )
 
 }
 
-void xlat_commit_block( uint32_t destsize, sh4addr_t startpc, sh4addr_t endpc )
+void xlat_add_block_range( sh4addr_t startpc, sh4addr_t endpc )
 {
-    void **entry = xlat_get_lut_entry(startpc+2);
-    /* assume main entry has already been set at this point */
+    void **entry = xlat_get_lut_entry(startpc);
 
-    for( sh4addr_t pc = startpc+2; pc < endpc; pc += 2 ) {
-        if( XLAT_LUT_ENTRY(pc) == 0 )
+    for( sh4addr_t pc = startpc; pc < endpc; pc += 2 ) {
+        if( XLAT_LUT_ENTRY(pc) == 0 ) {
             entry = xlat_get_lut_entry(pc);
+            xlat_protect_page(pc);
+        }
         *((uintptr_t *)entry) |= (uintptr_t)XLAT_LUT_ENTRY_USED;
         entry++;
     }
+}
+
+void xlat_commit_block( uint32_t destsize, sh4addr_t startpc, sh4addr_t endpc )
+{
+    /* assume main entry has already been set at this point */
+    xlat_add_block_range( startpc+2, endpc );
 
     xlat_new_cache_ptr = xlat_cut_block( xlat_new_create_ptr, destsize );
 }
 
+xlat_cache_block_t xlat_start_arena_block( sh4addr_t address )
+{
+    if( ((char *)XLAT_ARENA_END) - ((char *)xlat_arena_ptr) < 
+            MIN_TOTAL_SIZE + sizeof(struct xlat_cache_block) ) {
+        return NULL;
+    }
+    xlat_cache_block_t block = xlat_arena_ptr;
+    block->active = 0;
+    block->size = ((char *)XLAT_ARENA_END) - ((char *)block->code);
+    block->lut_entry = NULL;
+    block->address = address;
+    block->chain = NULL;
+    block->use_list = NULL;
+    block->hot_count = -1;
+    block->recover_table_offset = 0;
+    block->recover_table_size = 0;
+    return block;
+}
+
+void xlat_commit_arena_block( xlat_cache_block_t block, uint32_t destsize )
+{
+    assert( block == xlat_arena_ptr );
+    destsize = (destsize + 3) & 0xFFFFFFFC; // force word alignment
+    assert( destsize <= block->size );
+    block->size = destsize;
+    xlat_arena_ptr = NEXT(block);
+}
+
+void xlat_publish_block( xlat_cache_block_t block, sh4addr_t startpc, sh4addr_t endpc )
+{
+    assert( block >= xlat_arena_published_end && block < xlat_arena_ptr );
+    xlat_link_block_lut( block );
+    block->active = 1;
+    xlat_add_block_range( startpc+2, endpc );
+    xlat_arena_published_end = NEXT(block);
+}
+
+void xlat_reset_arena( void )
+{
+    xlat_cache_block_t block;
+    for( block = xlat_arena; block < xlat_arena_published_end; block = NEXT(block) ) {
+        if( block->active ) {
+            xlat_delete_block( block );
+        }
+    }
+    xlat_arena_ptr = xlat_arena;
+    xlat_arena_published_end = xlat_arena;
+}
+
+uint32_t xlat_get_generation( void )
+{
+    return xlat_generation;
+}
+
 void xlat_check_cache_integrity( xlat_cache_block_t cache, xlat_cache_block_t ptr, int size )
 {
     int foundptr = 0;
@@ -567,29 +1260,40 @@ sh4addr_t xlat_get_address( unsigned char *ptr )
  * Sanity check that the given pointer is at least contained in one of cache
  * regions, and has a sane-ish size. We don't do a full region walk atm.
  */
+gboolean xlat_is_in_cache( void *p )
+{
+    char *ptr = (char *)p;
+    return (uintptr_t)(ptr - (char *)xlat_new_cache) < xlat_new_cache_size ||
+        (xlat_generational && (uintptr_t)(ptr - (char *)xlat_temp_cache) < xlat_temp_cache_size) ||
+        (xlat_generational && (uintptr_t)(ptr - (char *)xlat_old_cache) < xlat_old_cache_size) ||
+        (uintptr_t)(ptr - (char *)xlat_arena) < XLAT_ARENA_SIZE;
+}
+
 gboolean xlat_is_code_pointer( void *p )
 {
     char *region;
     uintptr_t region_size;
 
     xlat_cache_block_t block = XLAT_BLOCK_FOR_CODE(p);
-    if( (((char *)block) - (char *)xlat_new_cache) < XLAT_NEW_CACHE_SIZE ) {
+    if( (uintptr_t)(((char *)block) - (char *)xlat_new_cache) < xlat_new_cache_size ) {
          /* Pointer is in new cache */
         region = (char *)xlat_new_cache;
-        region_size = XLAT_NEW_CACHE_SIZE;
-    }
-#ifdef XLAT_GENERATIONAL_CACHE
-    else if( (((char *)block) - (char *)xlat_temp_cache) < XLAT_TEMP_CACHE_SIZE ) {
+        region_size = xlat_new_cache_size;
+    } else if( xlat_generational && 
+            (uintptr_t)(((char *)block) - (char *)xlat_temp_cache) < xlat_temp_cache_size ) {
          /* Pointer is in temp cache */
         region = (char *)xlat_temp_cache;
-        region_size = XLAT_TEMP_CACHE_SIZE;
-    } else if( (((char *)block) - (char *)xlat_odl_cache) < XLAT_OLD_CACHE_SIZE ) {
+        region_size = xlat_temp_cache_size;
+    } else if( xlat_generational &&
+            (uintptr_t)(((char *)block) - (char *)xlat_old_cache) < xlat_old_cache_size ) {
         /* Pointer is in old cache */
         region = (char *)xlat_old_cache;
-        region_size = XLAT_OLD_CACHE_SIZE;
-    }
-#endif
-    else {
+        region_size = xlat_old_cache_size;
+    } else if( (uintptr_t)(((char *)block) - (char *)xlat_arena) < XLAT_ARENA_SIZE ) {
+        /* Pointer is in the background translation arena */
+        region = (char *)xlat_arena;
+        region_size = XLAT_ARENA_SIZE;
+    } else {
         /* Not a valid cache pointer */
         return FALSE;
     }
@@ -603,39 +1307,45 @@ gboolean xlat_is_code_pointer( void *p )
 
 void xlat_check_integrity( )
 {
-    xlat_check_cache_integrity( xlat_new_cache, xlat_new_cache_ptr, XLAT_NEW_CACHE_SIZE );
-#ifdef XLAT_GENERATIONAL_CACHE
-    xlat_check_cache_integrity( xlat_temp_cache, xlat_temp_cache_ptr, XLAT_TEMP_CACHE_SIZE );
-    xlat_check_cache_integrity( xlat_old_cache, xlat_old_cache_ptr, XLAT_OLD_CACHE_SIZE );
-#endif
+    xlat_check_cache_integrity( xlat_new_cache, xlat_new_cache_ptr, xlat_new_cache_size );
+    if( xlat_generational ) {
+        xlat_check_cache_integrity( xlat_temp_cache, xlat_temp_cache_ptr, xlat_temp_cache_size );
+        xlat_check_cache_integrity( xlat_old_cache, xlat_old_cache_ptr, xlat_old_cache_size );
+    }
 }
 
 unsigned int xlat_get_active_block_count()
 {
+    xlat_cache_block_t spaces[3] = { xlat_new_cache, xlat_temp_cache, xlat_old_cache };
     unsigned int count = 0;
-    xlat_cache_block_t ptr = xlat_new_cache;
-    while( ptr->size != 0 ) {
-        if( ptr->active != 0 ) {
-            count++;
+    int i;
+    for( i=0; i<3; i++ ) {
+        xlat_cache_block_t ptr = spaces[i];
+        while( ptr != NULL && ptr->size != 0 ) {
+            if( ptr->active != 0 ) {
+                count++;
+            }
+            ptr = NEXT(ptr);
         }
-        ptr = NEXT(ptr);
     }
     return count;
 }
 
 unsigned int xlat_get_active_blocks( struct xlat_block_ref *blocks, unsigned int size )
 {
+    xlat_cache_block_t spaces[3] = { xlat_new_cache, xlat_temp_cache, xlat_old_cache };
     unsigned int count = 0;
-    xlat_cache_block_t ptr = xlat_new_cache;
-    while( ptr->size != 0 ) {
-        if( ptr->active != 0 ) {
-            blocks[count].block = ptr;
-            blocks[count].pc = 0;
-            count++;
-        }
-        if( count >= size )
-            break;
-        ptr = NEXT(ptr);
+    int i;
+    for( i=0; i<3 && count < size; i++ ) {
+        xlat_cache_block_t ptr = spaces[i];
+        while( ptr != NULL && ptr->size != 0 && count < size ) {
+            if( ptr->active != 0 ) {
+                blocks[count].block = ptr;
+                blocks[count].pc = 0;
+                count++;
+            }
+            ptr = NEXT(ptr);
+        }
     }
     return count;
 }
@@ -29,28 +29,67 @@
  * agressively.
  *
  * The recovery table contains (at least) one entry per abortable instruction,
- * 
+ * plus one entry per side-exit for blocks that span multiple branches (traces).
+ * Within a trace the instruction count and pc offset are independent, as the
+ * executed instructions are no longer contiguous.
  */
 typedef struct xlat_recovery_record {
     uint32_t xlat_offset;    // native (translated) pc 
     uint32_t sh4_icount;     // instruction number of the corresponding SH4 instruction
                              // (0 = first instruction, 1 = second instruction, ... )
+    int32_t sh4_pc_offset;   // offset of the corresponding SH4 pc from the block start
 } *xlat_recovery_record_t;
 
 struct xlat_cache_block {
     int active;  /* 0 = deleted, 1 = normal. 2 = accessed (temp-space only) */
     uint32_t size;
     void **lut_entry; /* For deletion */
+    sh4addr_t address; /* SH4 address of the block entry point (as used for the lut) */
     void *chain;
     void *use_list;
     uint32_t xlat_sh4_mode; /* comparison with sh4r.xlat_sh4_mode */
+    int32_t hot_count; /* Executions left before re-translation, or -1 if final */
     uint32_t recover_table_offset; // Offset from code[0] of the recovery table;
     uint32_t recover_table_size;
     unsigned char code[0];
 } __attribute__((packed));
 
+/**
+ * Indirect branch target cache. This is a small direct-mapped table from
+ * (vma, xlat_sh4_mode, context) to translated code, which is probed inline by
+ * the translated code on indirect branches (JMP, JSR, RTS, BRAF etc), so that
+ * the common case doesn't need to call out to the LUT and walk the mode chain.
+ * As it's keyed on the vma, entries are also tagged with the address space
+ * context they were looked up in - XLAT_CONTEXT_NONE while address translation
+ * is disabled, or the tag of the current ASID's mappings when it's enabled
+ * (so each ASID effectively has its own entries, which stay valid across
+ * context switches until its mappings change). The cache is flushed whenever
+ * address translation is turned on or off. Entries are removed when the target
+ * block is deleted.
+ */
+#define XLAT_TARGET_CACHE_BITS 9
+#define XLAT_TARGET_CACHE_ENTRIES (1<<XLAT_TARGET_CACHE_BITS)
+#define XLAT_TARGET_CACHE_ENTRY_SHIFT 5  /* log2(sizeof(struct xlat_target_cache_entry)) */
+#define XLAT_TARGET_CACHE_INDEX(vma) (((vma)>>1) & (XLAT_TARGET_CACHE_ENTRIES-1))
+#define XLAT_TARGET_CACHE_EMPTY 0xFFFFFFFF /* Never a valid (even) vma */
+#define XLAT_CONTEXT_NONE 0 /* Context of entries with address translation disabled */
+
+typedef struct xlat_target_cache_entry {
+    void *code;
+    sh4vma_t vma;
+    uint32_t xlat_sh4_mode;
+    uint32_t hits;   /* Incremented by the translated code */
+    uint32_t context;
+} __attribute__((aligned(1<<XLAT_TARGET_CACHE_ENTRY_SHIFT))) *xlat_target_cache_entry_t;
+
+extern struct xlat_target_cache_entry xlat_target_cache[XLAT_TARGET_CACHE_ENTRIES];
+
 typedef struct xlat_target_fns {
     void (*unlink_block)(void *use_list);
+    /* Remove a branch site from the use-list of the block it's linked to (if
+     * it's linked). If newsite is not NULL, the site has been copied there 
+     * and needs to be rewritten in its unlinked form */
+    void (*move_link)(void *site, void *newsite);
 } *xlat_target_fns_t;
 
 typedef struct xlat_cache_block *xlat_cache_block_t;
@@ -61,11 +100,70 @@ typedef struct xlat_cache_block *xlat_cache_block_t;
 #define XLAT_BLOCK_CHAIN(code) (XLAT_BLOCK_FOR_CODE(code)->chain)
 #define XLAT_RECOVERY_TABLE(code) ((xlat_recovery_record_t)(((char *)code) + XLAT_BLOCK_FOR_CODE(code)->recover_table_offset))
 
+/**
+ * Translated blocks are followed (after the recovery table) by a fixup table 
+ * of everything in the code that depends on where the block is, so that it 
+ * can be moved between cache spaces. This is a count, followed by the offsets
+ * from the start of the code of each absolute pointer into the block itself,
+ * and of each branch that may be linked to another block (flagged with 
+ * XLAT_FIXUP_LINK). A count of XLAT_FIXUP_OVERFLOW indicates that the block
+ * had too many fixups to record, and can't be moved.
+ */
+#define XLAT_FIXUP_LINK 0x80000000
+#define XLAT_FIXUP_OVERFLOW 0xFFFFFFFF
+#define XLAT_FIXUP_TABLE(block) ((uint32_t *)&(block)->code[(block)->recover_table_offset + \
+        (block)->recover_table_size*sizeof(struct xlat_recovery_record)])
+
+/**
+ * Note that a block has been entered, which keeps it from being discarded
+ * while it's in the temp space of the generational cache.
+ */
+#define XLAT_BLOCK_MARK_USED(code) do { if( XLAT_BLOCK_FOR_CODE(code)->active == 1 ) XLAT_BLOCK_FOR_CODE(code)->active = 2; } while(0)
+
 /**
  * Initialize the translation cache
  */
 void xlat_cache_init(void);
 
+/**
+ * Select between the generational cache (where blocks evicted from the new
+ * space are kept in the temp and old spaces if they're still in use) and the
+ * plain cache (where they're discarded), and set the size of each space in
+ * bytes (0 for the default). The new space starts at new_size, and grows as 
+ * needed up to new_max_size before it starts evicting blocks. Flushes the
+ * cache if it's already initialized.
+ */
+void xlat_configure_cache( gboolean generational, uint32_t new_size, uint32_t new_max_size,
+                           uint32_t temp_size, uint32_t old_size );
+
+#define XLAT_SPACE_NEW  0
+#define XLAT_SPACE_TEMP 1
+#define XLAT_SPACE_OLD  2
+
+struct xlat_cache_stats {
+    uint64_t temp_promotions; /* Blocks moved from the new space to the temp space */
+    uint64_t old_promotions;  /* Blocks moved from the temp space to the old space */
+    uint64_t evictions;       /* Blocks discarded to make room */
+    uint64_t flushes;         /* Full cache flushes */
+    uint64_t grows;           /* Times the new space has been grown */
+    uint64_t aged;            /* Used blocks skipped over (rather than evicted) in the new space */
+    uint32_t new_space_size;  /* Current size of the new space */
+    uint32_t live_blocks[3];  /* Current active blocks, by space */
+    uint64_t live_bytes[3];   /* Current size of the active blocks, by space */
+};
+
+/**
+ * Retrieve the cache counters (since startup), and the current usage of each
+ * space.
+ */
+void xlat_get_cache_stats( struct xlat_cache_stats *stats );
+
+/**
+ * @return the total number of blocks that have been moved or evicted. If this
+ * changes while translating, any block may have been overwritten.
+ */
+uint64_t xlat_get_displaced_count( void );
+
 /**
  * Setup target support.
  */
@@ -93,6 +191,57 @@ xlat_cache_block_t xlat_extend_block( uint32_t newSize );
  */
 void xlat_commit_block( uint32_t destsize, sh4addr_t startpc, sh4addr_t endpc );
 
+/**
+ * Mark an additional range of SH4 code as belonging to the current translation
+ * block (only valid between calls to xlat_start_block() and xlat_commit_block()),
+ * for blocks that are not a single linear range.
+ * @param startpc PC of the first instruction in the range
+ * @param endpc PC of the next instruction after the range.
+ */
+void xlat_add_block_range( sh4addr_t startpc, sh4addr_t endpc );
+
+/**
+ * Background translation arena. Blocks translated off the emulation thread 
+ * are allocated here rather than in the new cache (as allocating in the new 
+ * cache may evict blocks), and are only linked into the LUT when the emulation 
+ * thread publishes them. Allocation is strictly sequential, and the space is
+ * only reclaimed as a whole by xlat_reset_arena().
+ *
+ * Start a new block at the end of the arena, occupying all of the remaining 
+ * space. 
+ * @return the new block, or NULL if the arena is full.
+ */
+xlat_cache_block_t xlat_start_arena_block( sh4addr_t address );
+
+/**
+ * Commit an arena block (which must be the last one started) with its final 
+ * size. The block remains inactive until it's published.
+ */
+void xlat_commit_arena_block( xlat_cache_block_t block, uint32_t destsize );
+
+/**
+ * Link a committed arena block into the LUT ahead of any existing blocks for
+ * its address, and mark it active. Blocks must be published in the order 
+ * they were committed (although blocks may be skipped).
+ * @param startpc PC at the start of the translation block.
+ * @param endpc PC at the end of the translation block.
+ */
+void xlat_publish_block( xlat_cache_block_t block, sh4addr_t startpc, sh4addr_t endpc );
+
+/**
+ * Delete all active arena blocks, and free the arena for reuse. Must not be
+ * called while a block is being translated into the arena.
+ */
+void xlat_reset_arena( void );
+
+/**
+ * Retrieve the cache generation, which is incremented whenever blocks are 
+ * flushed due to changes to the underlying SH4 code (or the whole cache is 
+ * flushed). A translation made from code read at generation N is only valid 
+ * for publishing if the generation is still N.
+ */
+uint32_t xlat_get_generation( void );
+
 /**
  * Delete (deactivate) the specified block from the cache. Caller is responsible
  * for ensuring that there really is a block there.
@@ -124,12 +273,46 @@ struct xlat_recovery_record *xlat_get_pre_recovery( void *code, void *native_pc
  */
 void * FASTCALL xlat_get_code_by_vma( sh4vma_t address );
 
+/**
+ * Retrieve the entry point for the translated code at the given address with
+ * the given xlat_sh4_mode, and add it to the target cache. Called from 
+ * translated code when the target cache misses. 
+ * @return the code pointer, or NULL if there is no matching translation.
+ */
+void * FASTCALL xlat_target_cache_miss( sh4vma_t vma, uint32_t xlat_sh4_mode );
+
+/**
+ * Add the given code to the target cache for (vma, xlat_sh4_mode, context),
+ * replacing whatever was in its slot.
+ */
+void xlat_target_cache_insert( sh4vma_t vma, uint32_t xlat_sh4_mode, uint32_t context, void *code );
+
+/**
+ * Remove all entries from the target cache (without affecting the translated
+ * code itself).
+ */
+void xlat_target_cache_flush( void );
+
+/**
+ * Retrieve the indirect branch target cache hit and miss counts since the
+ * translation cache was initialized.
+ */
+void xlat_get_target_cache_stats( uint64_t *hits, uint64_t *misses );
+
 /**
  * Retrieve the address of the lookup table entry corresponding to the
  * given SH4 address.
  */
 void ** FASTCALL xlat_get_lut_entry( sh4addr_t address );
 
+/**
+ * Allocate the lookup table pages covering the given range of SH4 addresses,
+ * so that xlat_get_lut_entry within the range doesn't modify the table. Used
+ * before handing the range to the background translator, as the emulation 
+ * thread reads the table without locking.
+ */
+void xlat_alloc_lut_range( sh4addr_t address, uint32_t size );
+
 /**
  * Retrieve the current host address of the running translated code block.
  * @return the host PC, or null if there is no currently executing translated
@@ -173,6 +356,90 @@ void FASTCALL xlat_invalidate_block( sh4addr_t address, size_t bytes );
  */
 void xlat_flush_cache();
 
+/**
+ * TRUE while translated code in main RAM is being write-protected, in which
+ * case RAM writes don't need to check for self-modifying code - the first
+ * write to a page containing code will fault and flush the page instead.
+ * (Writes made by the host kernel, eg read() into RAM, still need an 
+ * xlat_invalidate_block() first).
+ */
+extern gboolean xlat_protect_active;
+
+/**
+ * Enable/disable write-protection of main RAM pages containing translated 
+ * code. Takes effect from the next xlat_protect_start()
+ */
+void xlat_set_write_protect( gboolean enable );
+
+/**
+ * Write-protect all RAM pages currently holding translated code, and
+ * protect new pages as blocks are added. Called when the SH4 starts running.
+ */
+void xlat_protect_start( void );
+
+/**
+ * Remove all write-protection from main RAM. Called when the SH4 stops so 
+ * that RAM can be freely written (eg by loaders) while stopped.
+ */
+void xlat_protect_stop( void );
+
+/**
+ * Test if a main RAM address is in a page currently write-protected because
+ * it holds translated code.
+ */
+gboolean xlat_is_protected_page( sh4addr_t address );
+
+/**
+ * Hook called whenever the write-protection of main RAM changes, with the
+ * affected range given as an offset into main RAM. Starting and stopping
+ * protection report the entire RAM.
+ */
+typedef void (*xlat_protect_hook_t)( uint32_t offset, uint32_t size, void *user_data );
+DECLARE_HOOK( xlat_protect_hook, xlat_protect_hook_t );
+
+/**
+ * Code caches other than the translator's (ie the interpreter's predecoded
+ * instructions) are kept in 8KB pages of physical memory, and rely on the same
+ * self-modifying code detection as translated blocks. The mirrors of main RAM
+ * share a single page, identified by its address in the first mirror.
+ */
+#define XLAT_CODE_PAGE_SIZE (1<<13)
+#define XLAT_CODE_PAGE_ADDR(addr) \
+    (((((addr)&0x1C000000) == 0x0C000000) ? ((addr)&0x1CFFFFFF) : (addr)) & ~(XLAT_CODE_PAGE_SIZE-1))
+
+/**
+ * Mark the code page containing the given physical address as holding cached
+ * code, so that the next write to it (or invalidation covering it) reports
+ * the page to the xlat_code_hook. The mark is cleared when that happens.
+ */
+void xlat_add_code_page( sh4addr_t address );
+
+/**
+ * Hook called with the address of a marked code page (as given by
+ * XLAT_CODE_PAGE_ADDR) when its contents may have changed.
+ */
+typedef void (*xlat_code_hook_t)( sh4addr_t page, void *user_data );
+DECLARE_HOOK( xlat_code_hook, xlat_code_hook_t );
+
+/**
+ * Secondary SIGSEGV/SIGBUS handler, given the fault address and the signal
+ * context for faults that aren't writes to protected code pages. 
+ * @return TRUE if the fault has been dealt with and the instruction can be
+ * restarted, otherwise FALSE.
+ */
+typedef gboolean (*xlat_fault_handler_t)( void *addr, void *context );
+
+/**
+ * Set the secondary fault handler (or NULL for none), installing the fault
+ * handler if it isn't already
+ */
+void xlat_set_fault_handler( xlat_fault_handler_t handler );
+
+/**
+ * Test if the given pointer is anywhere within the translation cache
+ */
+gboolean xlat_is_in_cache( void *p );
+
 /**
  * Test if the given pointer is within the translation cache, and (is likely)
  * the start of a code block
@@ -0,0 +1,304 @@
+/**
+ * $Id$
+ *
+ * Descriptions of translated code for the Linux perf profiler. perf can't
+ * see into the translation cache by itself, so samples in translated code
+ * would otherwise all show up as [unknown]. Two formats are supported:
+ *
+ *   map     - /tmp/perf-<pid>.map, a text file with one "start size name"
+ *             line per block. perf report picks it up automatically.
+ *   jitdump - /tmp/jit-<pid>.dump, a binary log of code load/move records
+ *             (including a copy of the code itself), which perf inject --jit
+ *             turns into per-block ELF images so that perf annotate works on
+ *             the generated code. Record with perf record -k mono.
+ *
+ * Copyright (c) 2026 agent.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "lxdream.h"
+#include "elf.h"
+#include "xlat/xltperf.h"
+
+#define JITDUMP_MAGIC   0x4A695444
+#define JITDUMP_VERSION 1
+
+#define JIT_CODE_LOAD   0
+#define JIT_CODE_MOVE   1
+#define JIT_CODE_CLOSE  3
+
+#if SIZEOF_VOID_P == 8
+#define JITDUMP_ELF_MACH EM_X86_64
+#else
+#define JITDUMP_ELF_MACH EM_386
+#endif
+
+struct jitdump_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct jitdump_record_header {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jitdump_code_load {
+    struct jitdump_record_header header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    /* followed by the null-terminated name, then the code */
+};
+
+struct jitdump_code_move {
+    struct jitdump_record_header header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t old_code_addr;
+    uint64_t new_code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+/**
+ * What we remember about each live block - the move records need the size
+ * and index, and the map format repeats the name at the new address.
+ */
+struct xlat_perf_entry {
+    uint64_t code_index;
+    uint32_t code_size;
+    char name[0];
+};
+
+xlat_perf_format_t xlat_perf_format = XLAT_PERF_NONE;
+
+static FILE *xlat_perf_file = NULL;
+static void *xlat_perf_marker = NULL;
+static size_t xlat_perf_marker_size = 0;
+static GHashTable *xlat_perf_blocks = NULL;
+static uint64_t xlat_perf_next_index = 0;
+static gboolean xlat_perf_atexit_registered = FALSE;
+
+static uint64_t xlat_perf_timestamp( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t xlat_perf_tid( void )
+{
+#ifdef SYS_gettid
+    return (uint32_t)syscall( SYS_gettid );
+#else
+    return (uint32_t)getpid();
+#endif
+}
+
+static gboolean xlat_perf_open_jitdump( void )
+{
+    char filename[64];
+    struct jitdump_header header;
+    int fd;
+
+    snprintf( filename, sizeof(filename), "/tmp/jit-%d.dump", (int)getpid() );
+    xlat_perf_file = fopen( filename, "w+" );
+    if( xlat_perf_file == NULL ) {
+        WARN( "Unable to create %s: %s", filename, strerror(errno) );
+        return FALSE;
+    }
+
+    /* perf record finds the dump by watching for an executable mapping of it */
+    fd = fileno(xlat_perf_file);
+    xlat_perf_marker_size = sysconf(_SC_PAGESIZE);
+    xlat_perf_marker = mmap( NULL, xlat_perf_marker_size, PROT_READ|PROT_EXEC, MAP_PRIVATE, fd, 0 );
+    if( xlat_perf_marker == MAP_FAILED ) {
+        WARN( "Unable to map %s: %s", filename, strerror(errno) );
+        xlat_perf_marker = NULL;
+        fclose( xlat_perf_file );
+        xlat_perf_file = NULL;
+        unlink( filename );
+        return FALSE;
+    }
+
+    memset( &header, 0, sizeof(header) );
+    header.magic = JITDUMP_MAGIC;
+    header.version = JITDUMP_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = JITDUMP_ELF_MACH;
+    header.pid = getpid();
+    header.timestamp = xlat_perf_timestamp();
+    fwrite( &header, sizeof(header), 1, xlat_perf_file );
+    return TRUE;
+}
+
+static gboolean xlat_perf_open_map( void )
+{
+    char filename[64];
+
+    snprintf( filename, sizeof(filename), "/tmp/perf-%d.map", (int)getpid() );
+    xlat_perf_file = fopen( filename, "w" );
+    if( xlat_perf_file == NULL ) {
+        WARN( "Unable to create %s: %s", filename, strerror(errno) );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean xlat_perf_open( xlat_perf_format_t format )
+{
+    gboolean result = TRUE;
+
+    xlat_perf_close();
+    switch( format ) {
+    case XLAT_PERF_MAP:
+        result = xlat_perf_open_map();
+        break;
+    case XLAT_PERF_JITDUMP:
+        result = xlat_perf_open_jitdump();
+        break;
+    default:
+        return TRUE;
+    }
+
+    if( result ) {
+        xlat_perf_format = format;
+        xlat_perf_blocks = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, g_free );
+        if( !xlat_perf_atexit_registered ) {
+            atexit( xlat_perf_close );
+            xlat_perf_atexit_registered = TRUE;
+        }
+    }
+    return result;
+}
+
+void xlat_perf_close( void )
+{
+    if( xlat_perf_file != NULL ) {
+        if( xlat_perf_format == XLAT_PERF_JITDUMP ) {
+            struct jitdump_record_header rec;
+            rec.id = JIT_CODE_CLOSE;
+            rec.total_size = sizeof(rec);
+            rec.timestamp = xlat_perf_timestamp();
+            fwrite( &rec, sizeof(rec), 1, xlat_perf_file );
+        }
+        fclose( xlat_perf_file );
+        xlat_perf_file = NULL;
+    }
+    if( xlat_perf_marker != NULL ) {
+        munmap( xlat_perf_marker, xlat_perf_marker_size );
+        xlat_perf_marker = NULL;
+    }
+    if( xlat_perf_blocks != NULL ) {
+        g_hash_table_destroy( xlat_perf_blocks );
+        xlat_perf_blocks = NULL;
+    }
+    xlat_perf_format = XLAT_PERF_NONE;
+}
+
+static void xlat_perf_write_map_line( void *code, struct xlat_perf_entry *entry )
+{
+    fprintf( xlat_perf_file, "%lx %x %s\n", (unsigned long)(uintptr_t)code,
+             entry->code_size, entry->name );
+    fflush( xlat_perf_file );
+}
+
+void xlat_perf_load_block( xlat_cache_block_t block, const char *name )
+{
+    size_t namelen = strlen(name) + 1;
+    struct xlat_perf_entry *entry = g_malloc( sizeof(struct xlat_perf_entry) + namelen );
+    entry->code_index = xlat_perf_next_index++;
+    entry->code_size = xlat_get_code_size( block->code );
+    memcpy( entry->name, name, namelen );
+    g_hash_table_insert( xlat_perf_blocks, block->code, entry );
+
+    if( xlat_perf_format == XLAT_PERF_MAP ) {
+        xlat_perf_write_map_line( block->code, entry );
+    } else {
+        struct jitdump_code_load rec;
+        rec.header.id = JIT_CODE_LOAD;
+        rec.header.total_size = sizeof(rec) + namelen + entry->code_size;
+        rec.header.timestamp = xlat_perf_timestamp();
+        rec.pid = getpid();
+        rec.tid = xlat_perf_tid();
+        rec.vma = (uintptr_t)block->code;
+        rec.code_addr = (uintptr_t)block->code;
+        rec.code_size = entry->code_size;
+        rec.code_index = entry->code_index;
+        fwrite( &rec, sizeof(rec), 1, xlat_perf_file );
+        fwrite( name, namelen, 1, xlat_perf_file );
+        fwrite( block->code, entry->code_size, 1, xlat_perf_file );
+        fflush( xlat_perf_file );
+    }
+}
+
+void xlat_perf_move_block( xlat_cache_block_t block, xlat_cache_block_t dest )
+{
+    struct xlat_perf_entry *entry = g_hash_table_lookup( xlat_perf_blocks, block->code );
+    if( entry == NULL ) {
+        return; /* Loaded before the output was opened */
+    }
+    g_hash_table_steal( xlat_perf_blocks, block->code );
+    g_hash_table_insert( xlat_perf_blocks, dest->code, entry );
+
+    if( xlat_perf_format == XLAT_PERF_MAP ) {
+        xlat_perf_write_map_line( dest->code, entry );
+    } else {
+        struct jitdump_code_move rec;
+        rec.header.id = JIT_CODE_MOVE;
+        rec.header.total_size = sizeof(rec);
+        rec.header.timestamp = xlat_perf_timestamp();
+        rec.pid = getpid();
+        rec.tid = xlat_perf_tid();
+        rec.vma = (uintptr_t)dest->code;
+        rec.old_code_addr = (uintptr_t)block->code;
+        rec.new_code_addr = (uintptr_t)dest->code;
+        rec.code_size = entry->code_size;
+        rec.code_index = entry->code_index;
+        fwrite( &rec, sizeof(rec), 1, xlat_perf_file );
+        fflush( xlat_perf_file );
+    }
+}
+
+void xlat_perf_unload_block( xlat_cache_block_t block )
+{
+    g_hash_table_remove( xlat_perf_blocks, block->code );
+}
+
+void xlat_perf_unload_all( void )
+{
+    g_hash_table_remove_all( xlat_perf_blocks );
+}
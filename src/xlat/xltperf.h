@@ -0,0 +1,77 @@
+/**
+ * $Id$
+ *
+ * Descriptions of translated code for the Linux perf profiler.
+ *
+ * Copyright (c) 2026 agent.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_xltperf_H
+#define lxdream_xltperf_H 1
+
+#include "xlat/xltcache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    XLAT_PERF_NONE,
+    XLAT_PERF_MAP,     /* /tmp/perf-<pid>.map: address, size and name per block */
+    XLAT_PERF_JITDUMP  /* /tmp/jit-<pid>.dump: the jitdump format read by perf inject */
+} xlat_perf_format_t;
+
+/** Current output format. The hooks below must only be called if it's not XLAT_PERF_NONE */
+extern xlat_perf_format_t xlat_perf_format;
+
+#define XLAT_PERF_ENABLED() (xlat_perf_format != XLAT_PERF_NONE)
+
+/**
+ * Start writing block descriptions in the given format, closing any current
+ * output. XLAT_PERF_NONE just closes the current output.
+ * @return FALSE if the output file couldn't be created.
+ */
+gboolean xlat_perf_open( xlat_perf_format_t format );
+
+/**
+ * Finish and close the output file, if any.
+ */
+void xlat_perf_close( void );
+
+/**
+ * Describe a newly committed (or published) block, whose code is now live.
+ */
+void xlat_perf_load_block( xlat_cache_block_t block, const char *name );
+
+/**
+ * Note that a block has been moved to dest (by the generational cache).
+ */
+void xlat_perf_move_block( xlat_cache_block_t block, xlat_cache_block_t dest );
+
+/**
+ * Note that a block has been deleted. Neither format has a way to record
+ * this: the next block loaded at the same address takes over the range from
+ * that point on.
+ */
+void xlat_perf_unload_block( xlat_cache_block_t block );
+
+/**
+ * Note that every block has been deleted (ie the cache was flushed).
+ */
+void xlat_perf_unload_all( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_xltperf_H */